@@ -39,13 +39,16 @@ struct CardDataC {
 	unsigned int ot;
 	unsigned int category;
 };
+// points into DataManager::_stringPool, never null
 struct CardString {
-	std::wstring name;
-	std::wstring text;
-	std::wstring desc[16];
+	const wchar_t* name;
+	const wchar_t* text;
+	const wchar_t* desc[16];
 };
 typedef std::unordered_map<unsigned int, CardDataC>::const_iterator code_pointer;
 
+#ifndef YGOPRO_SERVER_MODE
+
 class ClientCard {
 public:
 	irr::core::matrix4 mTransform;
@@ -121,6 +124,8 @@ public:
 	static bool deck_sort_name(code_pointer l1, code_pointer l2);
 };
 
+#endif //YGOPRO_SERVER_MODE
+
 }
 
 #endif //CLIENT_CARD_H
@@ -1501,12 +1501,12 @@ static bool is_declarable(T const& cd, const std::vector<int>& opcode) {
 void ClientField::UpdateDeclarableList() {
 	const wchar_t* pname = mainGame->ebANCard->getText();
 	int trycode = BufferIO::GetVal(pname);
-	CardString cstr;
+	const CardString* cstr;
 	CardData cd;
-	if(dataManager.GetString(trycode, &cstr) && dataManager.GetData(trycode, &cd) && is_declarable(cd, declare_opcodes)) {
+	if((cstr = dataManager.GetCardString(trycode)) && dataManager.GetData(trycode, &cd) && is_declarable(cd, declare_opcodes)) {
 		mainGame->lstANCard->clear();
 		ancard.clear();
-		mainGame->lstANCard->addItem(cstr.name.c_str());
+		mainGame->lstANCard->addItem(cstr->name);
 		ancard.push_back(trycode);
 		return;
 	}
@@ -1517,11 +1517,11 @@ void ClientField::UpdateDeclarableList() {
 		int selcode = (sel == -1) ? 0 : cache[sel];
 		mainGame->lstANCard->clear();
 		for(const auto& trycode : cache) {
-			if(dataManager.GetString(trycode, &cstr) && dataManager.GetData(trycode, &cd) && is_declarable(cd, declare_opcodes)) {
+			if((cstr = dataManager.GetCardString(trycode)) && dataManager.GetData(trycode, &cd) && is_declarable(cd, declare_opcodes)) {
 				ancard.push_back(trycode);
-				mainGame->lstANCard->addItem(cstr.name.c_str());
+				mainGame->lstANCard->addItem(cstr->name);
 				if(trycode == selcode)
-					mainGame->lstANCard->setSelected(cstr.name.c_str());
+					mainGame->lstANCard->setSelected(cstr->name);
 			}
 		}
 		if(!ancard.empty())
@@ -1530,15 +1530,15 @@ void ClientField::UpdateDeclarableList() {
 	mainGame->lstANCard->clear();
 	ancard.clear();
 	for(auto cit = dataManager._strings.begin(); cit != dataManager._strings.end(); ++cit) {
-		if(cit->second.name.find(pname) != std::wstring::npos) {
+		if(wcsstr(cit->second.name, pname)) {
 			auto cp = dataManager.GetCodePointer(cit->first);	//verified by _strings
 			//datas.alias can be double card names or alias
 			if(is_declarable(cp->second, declare_opcodes)) {
-				if(pname == cit->second.name) { //exact match
-					mainGame->lstANCard->insertItem(0, cit->second.name.c_str(), -1);
+				if(!wcscmp(pname, cit->second.name)) { //exact match
+					mainGame->lstANCard->insertItem(0, cit->second.name, -1);
 					ancard.insert(ancard.begin(), cit->first);
 				} else {
-					mainGame->lstANCard->addItem(cit->second.name.c_str());
+					mainGame->lstANCard->addItem(cit->second.name);
 					ancard.push_back(cit->first);
 				}
 			}
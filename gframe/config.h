@@ -55,6 +55,7 @@ inline int myswprintf(wchar_t(&buf)[N], const wchar_t* fmt, TR... args) {
 	return swprintf(buf, N, fmt, args...);
 }
 
+#ifndef YGOPRO_SERVER_MODE
 #include <irrlicht.h>
 #ifdef __APPLE__
 #include <OpenGL/gl.h>
@@ -65,6 +66,7 @@ inline int myswprintf(wchar_t(&buf)[N], const wchar_t* fmt, TR... args) {
 #endif //__APPLE__
 #include "CGUITTFont.h"
 #include "CGUIImageButton.h"
+#endif //YGOPRO_SERVER_MODE
 #include <iostream>
 #include <stdio.h>
 #include <stdlib.h>
@@ -79,12 +81,14 @@ inline int myswprintf(wchar_t(&buf)[N], const wchar_t* fmt, TR... args) {
 #include "../ocgcore/ocgapi.h"
 #include "../ocgcore/common.h"
 
+#ifndef YGOPRO_SERVER_MODE
 using namespace irr;
 using namespace core;
 using namespace scene;
 using namespace video;
 using namespace io;
 using namespace gui;
+#endif //YGOPRO_SERVER_MODE
 
 extern const unsigned short PRO_VERSION;
 extern int enable_log;
@@ -92,5 +96,8 @@ extern bool exit_on_return;
 extern bool open_file;
 extern wchar_t open_file_name[256];
 extern bool bot_mode;
+#ifdef YGOPRO_SERVER_MODE
+extern bool prefer_expansion_script;
+#endif
 
 #endif
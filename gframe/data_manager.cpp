@@ -1,15 +1,193 @@
 #include "data_manager.h"
+#ifndef YGOPRO_SERVER_MODE
 #include "game.h"
+#endif
 #include <stdio.h>
+#include <sys/stat.h>
+#include "../lua/lua.h"
+#include "../lua/lauxlib.h"
 
 namespace ygo {
 
 const wchar_t* DataManager::unknown_string = L"???";
 wchar_t DataManager::strBuffer[4096];
-byte DataManager::scriptBuffer[0x20000];
+thread_local byte DataManager::scriptBuffer[0x20000];
 DataManager dataManager;
 
+#define SNAPSHOT_MAGIC		0x504e5359 // YSNP
+#define SNAPSHOT_VERSION	2
+
+// a database snapshot is a header, the packed rows, then every distinct string once, null terminated.
+// it holds no pointers, so it can be read or mapped in one go
+struct SnapshotHeader {
+	unsigned int magic;
+	unsigned int version;
+	unsigned int wchar_size;
+	unsigned int count;
+	unsigned long long source_hash;
+	unsigned long long source_size;
+	unsigned int blob_size;
+	unsigned int card_size; // sizeof(SnapshotCard), so that a changed CardDataC rejects old snapshots
+};
+struct SnapshotCard {
+	CardDataC data;
+	unsigned int str[18][2];
+};
+// the same layout is built in memory while reading a database, and its blob then becomes the string pool
+struct SnapshotBuilder {
+	std::vector<SnapshotCard> cards;
+	std::vector<wchar_t> blob;
+	std::unordered_map<std::wstring, unsigned int> offsets;
+
+	void Intern(const wchar_t* str, unsigned int* ref) {
+		auto it = offsets.find(str);
+		if(it == offsets.end()) {
+			it = offsets.emplace(str, blob.size()).first;
+			blob.insert(blob.end(), it->first.begin(), it->first.end());
+			blob.push_back(0);
+		}
+		ref[0] = it->second;
+		ref[1] = it->first.length();
+	}
+};
+static FILE* OpenDataFile(const char* file, bool write) {
+#ifdef _WIN32
+	wchar_t fname[1024];
+	BufferIO::DecodeUTF8(file, fname);
+	return _wfopen(fname, write ? L"wb" : L"rb");
+#else
+	return fopen(file, write ? "wb" : "rb");
+#endif
+}
+static bool GetFileSize(const char* file, unsigned long long* size) {
+#ifdef _WIN32
+	wchar_t fname[1024];
+	BufferIO::DecodeUTF8(file, fname);
+	struct _stat64 st;
+	if(_wstat64(fname, &st))
+		return false;
+#else
+	struct stat st;
+	if(stat(file, &st))
+		return false;
+#endif
+	*size = st.st_size;
+	return true;
+}
+// FNV-1a over 64-bit words; the mtime can not tell apart two versions of a database,
+// sqlite grows the file in whole pages and copies keep the mtime
+static bool GetFileHash(const char* file, unsigned long long* hash) {
+	FILE* fp = OpenDataFile(file, false);
+	if(!fp)
+		return false;
+	unsigned long long h = 0xcbf29ce484222325ULL;
+	unsigned long long buffer[0x2000];
+	size_t len;
+	while((len = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+		if(len % 8)
+			memset((char*)buffer + len, 0, 8 - len % 8);
+		for(size_t i = 0; i < (len + 7) / 8; ++i)
+			h = (h ^ buffer[i]) * 0x100000001b3ULL;
+	}
+	bool read = !ferror(fp);
+	fclose(fp);
+	*hash = h;
+	return read;
+}
+// written under a temporary name first, so that a process loading the snapshot never sees half of it
+static void SaveSnapshot(const char* file, SnapshotHeader& header, SnapshotBuilder& builder) {
+	char path[1024];
+	char temp[1024];
+	snprintf(path, sizeof(path), "%s.snap", file);
+	snprintf(temp, sizeof(temp), "%s.snap.tmp", file);
+	FILE* fp = OpenDataFile(temp, true);
+	if(!fp)
+		return;
+	header.count = builder.cards.size();
+	header.blob_size = builder.blob.size();
+	bool written = fwrite(&header, sizeof(header), 1, fp) == 1;
+	if(written && header.count)
+		written = fwrite(builder.cards.data(), sizeof(SnapshotCard), header.count, fp) == header.count;
+	if(written && header.blob_size)
+		written = fwrite(builder.blob.data(), sizeof(wchar_t), header.blob_size, fp) == header.blob_size;
+	fclose(fp);
+	remove(path);
+	if(!written || rename(temp, path))
+		remove(temp);
+}
+// load the rows of file from its snapshot, if one was written for this exact version of the file
+bool DataManager::LoadSnapshot(const char* file) {
+	unsigned long long source_size;
+	if(!GetFileSize(file, &source_size))
+		return false;
+	char path[1024];
+	snprintf(path, sizeof(path), "%s.snap", file);
+	FILE* fp = OpenDataFile(path, false);
+	if(!fp)
+		return false;
+	SnapshotHeader header;
+	bool valid = fread(&header, sizeof(header), 1, fp) == 1 && header.magic == SNAPSHOT_MAGIC
+		&& header.version == SNAPSHOT_VERSION && header.wchar_size == sizeof(wchar_t)
+		&& header.card_size == sizeof(SnapshotCard) && header.source_size == source_size;
+	// the file is only hashed when everything cheaper matched
+	unsigned long long source_hash;
+	if(valid)
+		valid = GetFileHash(file, &source_hash) && header.source_hash == source_hash;
+	std::vector<SnapshotCard> cards;
+	std::vector<wchar_t> blob;
+	if(valid) {
+		cards.resize(header.count);
+		blob.resize(header.blob_size);
+		if(header.count)
+			valid = fread(cards.data(), sizeof(SnapshotCard), header.count, fp) == header.count;
+		if(valid && header.blob_size)
+			valid = fread(blob.data(), sizeof(wchar_t), header.blob_size, fp) == header.blob_size;
+	}
+	fclose(fp);
+	if(valid && !blob.empty() && blob.back() != 0)
+		valid = false;
+	for(size_t i = 0; valid && i < cards.size(); ++i) {
+		for(int j = 0; j < 18; ++j) {
+			// every string has to end inside the blob
+			unsigned int offset = cards[i].str[j][0];
+			unsigned int length = cards[i].str[j][1];
+			if(offset >= blob.size() || length >= blob.size() - offset || blob[offset + length] != 0) {
+				valid = false;
+				break;
+			}
+		}
+	}
+	if(!valid)
+		return false;
+	AddCards(cards.data(), cards.size(), blob);
+	return true;
+}
+// take over blob as a block of the string pool and point the card strings into it
+void DataManager::AddCards(const SnapshotCard* cards, size_t count, std::vector<wchar_t>& blob) {
+	_stringPool.emplace_back();
+	_stringPool.back().swap(blob);
+	const wchar_t* pool = _stringPool.back().data();
+	for(size_t i = 0; i < count; ++i) {
+		const SnapshotCard& card = cards[i];
+		_datas.insert(std::make_pair(card.data.code, card.data));
+		CardString cs;
+		cs.name = pool + card.str[0][0];
+		cs.text = pool + card.str[1][0];
+		for(int j = 0; j < 16; ++j)
+			cs.desc[j] = pool + card.str[j + 2][0];
+		_strings.emplace(card.data.code, cs);
+	}
+}
 bool DataManager::LoadDB(const char* file) {
+	if(LoadSnapshot(file))
+		return true;
+	SnapshotHeader header;
+	header.magic = SNAPSHOT_MAGIC;
+	header.version = SNAPSHOT_VERSION;
+	header.wchar_size = sizeof(wchar_t);
+	header.card_size = sizeof(SnapshotCard);
+	bool stamped = GetFileSize(file, &header.source_size) && GetFileHash(file, &header.source_hash);
+	SnapshotBuilder builder;
 	sqlite3* pDB;
 	if(sqlite3_open_v2(file, &pDB, SQLITE_OPEN_READONLY, 0) != SQLITE_OK)
 		return Error(pDB);
@@ -17,8 +195,11 @@ bool DataManager::LoadDB(const char* file) {
 	const char* sql = "select * from datas,texts where datas.id=texts.id";
 	if(sqlite3_prepare_v2(pDB, sql, -1, &pStmt, 0) != SQLITE_OK)
 		return Error(pDB);
-	CardDataC cd;
-	CardString cs;
+	SnapshotCard card;
+	memset(&card, 0, sizeof(card));
+	CardDataC& cd = card.data;
+	for(int i = 0; i < 18; ++i)
+		builder.Intern(L"", card.str[i]);
 	int step = 0;
 	do {
 		step = sqlite3_step(pStmt);
@@ -44,26 +225,20 @@ bool DataManager::LoadDB(const char* file) {
 			cd.race = sqlite3_column_int(pStmt, 8);
 			cd.attribute = sqlite3_column_int(pStmt, 9);
 			cd.category = sqlite3_column_int(pStmt, 10);
-			_datas.insert(std::make_pair(cd.code, cd));
-			if(const char* text = (const char*)sqlite3_column_text(pStmt, 12)) {
-				BufferIO::DecodeUTF8(text, strBuffer);
-				cs.name = strBuffer;
-			}
-			if(const char* text = (const char*)sqlite3_column_text(pStmt, 13)) {
-				BufferIO::DecodeUTF8(text, strBuffer);
-				cs.text = strBuffer;
-			}
-			for(int i = 0; i < 16; ++i) {
-				if(const char* text = (const char*)sqlite3_column_text(pStmt, i + 14)) {
+			for(int i = 0; i < 18; ++i) {
+				if(const char* text = (const char*)sqlite3_column_text(pStmt, i + 12)) {
 					BufferIO::DecodeUTF8(text, strBuffer);
-					cs.desc[i] = strBuffer;
+					builder.Intern(strBuffer, card.str[i]);
 				}
 			}
-			_strings.emplace(cd.code, cs);
+			builder.cards.push_back(card);
 		}
 	} while(step != SQLITE_DONE);
 	sqlite3_finalize(pStmt);
 	sqlite3_close(pDB);
+	if(stamped)
+		SaveSnapshot(file, header, builder);
+	AddCards(builder.cards.data(), builder.cards.size(), builder.blob);
 	return true;
 }
 bool DataManager::LoadStrings(const char* file) {
@@ -98,6 +273,12 @@ bool DataManager::LoadStrings(const char* file) {
 	fclose(fp);
 	for(int i = 0; i < 255; ++i)
 		myswprintf(numStrings[i], L"%d", i);
+	// set name (without the extra info) to code; the first one in map order wins, as with a linear search
+	_setnameIndex.clear();
+	for(auto csit = _setnameStrings.begin(); csit != _setnameStrings.end(); ++csit) {
+		auto xpos = csit->second.find_first_of(L'|');//setname|extra info
+		_setnameIndex.insert(std::make_pair(csit->second.substr(0, xpos), csit->first));
+	}
 	return true;
 }
 bool DataManager::Error(sqlite3* pDB, sqlite3_stmt* pStmt) {
@@ -118,30 +299,26 @@ bool DataManager::GetData(int code, CardData* pData) {
 code_pointer DataManager::GetCodePointer(int code) {
 	return _datas.find(code);
 }
-bool DataManager::GetString(int code, CardString* pStr) {
+const CardString* DataManager::GetCardString(int code) {
 	auto csit = _strings.find(code);
-	if(csit == _strings.end()) {
-		pStr->name = unknown_string;
-		pStr->text = unknown_string;
-		return false;
-	}
-	*pStr = csit->second;
-	return true;
+	if(csit == _strings.end())
+		return 0;
+	return &csit->second;
 }
 const wchar_t* DataManager::GetName(int code) {
 	auto csit = _strings.find(code);
 	if(csit == _strings.end())
 		return unknown_string;
-	if(!csit->second.name.empty())
-		return csit->second.name.c_str();
+	if(*csit->second.name)
+		return csit->second.name;
 	return unknown_string;
 }
 const wchar_t* DataManager::GetText(int code) {
 	auto csit = _strings.find(code);
 	if(csit == _strings.end())
 		return unknown_string;
-	if(!csit->second.text.empty())
-		return csit->second.text.c_str();
+	if(*csit->second.text)
+		return csit->second.text;
 	return unknown_string;
 }
 const wchar_t* DataManager::GetDesc(int strCode) {
@@ -152,8 +329,8 @@ const wchar_t* DataManager::GetDesc(int strCode) {
 	auto csit = _strings.find(code);
 	if(csit == _strings.end())
 		return unknown_string;
-	if(!csit->second.desc[offset].empty())
-		return csit->second.desc[offset].c_str();
+	if(*csit->second.desc[offset])
+		return csit->second.desc[offset];
 	return unknown_string;
 }
 const wchar_t* DataManager::GetSysString(int code) {
@@ -183,12 +360,10 @@ const wchar_t* DataManager::GetSetName(int code) {
 	return csit->second.c_str();
 }
 unsigned int DataManager::GetSetCode(const wchar_t* setname) {
-	for(auto csit = _setnameStrings.begin(); csit != _setnameStrings.end(); ++csit) {
-		auto xpos = csit->second.find_first_of(L'|');//setname|extra info
-		if(csit->second.compare(0, xpos, setname) == 0)
-			return csit->first;
-	}
-	return 0;
+	auto csit = _setnameIndex.find(setname);
+	if(csit == _setnameIndex.end())
+		return 0;
+	return csit->second;
 }
 const wchar_t* DataManager::GetNumString(int num, bool bracket) {
 	if(!bracket)
@@ -315,17 +490,21 @@ byte* DataManager::ScriptReaderEx(const char* script_name, int* slen) {
 	// default script name: ./script/c%d.lua
 	char first[256];
 	char second[256];
+#ifdef YGOPRO_SERVER_MODE
+	if(prefer_expansion_script) {
+#else
 	if(mainGame->gameConf.prefer_expansion_script) {
+#endif
 		sprintf(first, "expansions/%s", script_name + 2);
 		sprintf(second, "%s", script_name + 2);
 	} else {
 		sprintf(first, "%s", script_name + 2);
 		sprintf(second, "expansions/%s", script_name + 2);
 	}
-	if(ScriptReader(first, slen))
-		return scriptBuffer;
+	if(byte* buffer = dataManager.ReadScript(first, slen))
+		return buffer;
 	else
-		return ScriptReader(second, slen);
+		return dataManager.ReadScript(second, slen);
 }
 byte* DataManager::ScriptReader(const char* script_name, int* slen) {
 	FILE *fp;
@@ -346,4 +525,53 @@ byte* DataManager::ScriptReader(const char* script_name, int* slen) {
 	return scriptBuffer;
 }
 
+static int ScriptWriter(lua_State* L, const void* p, size_t sz, void* ud) {
+	std::vector<byte>* chunk = (std::vector<byte>*)ud;
+	chunk->insert(chunk->end(), (const byte*)p, (const byte*)p + sz);
+	return 0;
+}
+// keep every .lua in path in memory, optionally as compiled chunks, so that scripts in that
+// directory are never read from disk again. must be called before any duel starts
+int DataManager::LoadScripts(const char* path, bool precompile) {
+	lua_State* L = precompile ? luaL_newstate() : 0;
+	int count = 0;
+	FileSystem::TraversalDir(path, [this, path, L, &count](const char* name, bool isdir) {
+		if(isdir || !strrchr(name, '.') || mystrncasecmp(strrchr(name, '.'), ".lua", 4))
+			return;
+		char fpath[1024];
+		sprintf(fpath, "%s/%s", path, name);
+		int len;
+		byte* buffer = ScriptReader(fpath, &len);
+		if(!buffer)
+			return;
+		std::vector<byte> script(buffer, buffer + len);
+		if(L) {
+			// scripts that do not compile stay as source, so the engine reports the error as usual
+			char chunkname[1024];
+			sprintf(chunkname, "./%s", fpath);
+			std::vector<byte> chunk;
+			if(luaL_loadbuffer(L, (const char*)buffer, len, chunkname) == LUA_OK && !lua_dump(L, ScriptWriter, &chunk, 0))
+				script.swap(chunk);
+			lua_settop(L, 0);
+		}
+		_scripts[fpath].swap(script);
+		count++;
+	});
+	if(L)
+		lua_close(L);
+	_scriptPaths.insert(path);
+	return count;
+}
+byte* DataManager::ReadScript(const char* script_name, int* slen) {
+	auto it = _scripts.find(script_name);
+	if(it != _scripts.end()) {
+		*slen = it->second.size();
+		return it->second.data();
+	}
+	const char* pend = strrchr(script_name, '/');
+	if(pend && _scriptPaths.count(std::string(script_name, pend - script_name)))
+		return 0;
+	return ScriptReader(script_name, slen);
+}
+
 }
@@ -5,18 +5,24 @@
 #include "sqlite3.h"
 #include "client_card.h"
 #include <unordered_map>
+#include <set>
+#include <vector>
 
 namespace ygo {
 
+struct SnapshotCard;
+
 class DataManager {
 public:
 	DataManager(): _datas(8192), _strings(8192) {}
 	bool LoadDB(const char* file);
+	bool LoadSnapshot(const char* file);
+	void AddCards(const SnapshotCard* cards, size_t count, std::vector<wchar_t>& blob);
 	bool LoadStrings(const char* file);
 	bool Error(sqlite3* pDB, sqlite3_stmt* pStmt = 0);
 	bool GetData(int code, CardData* pData);
 	code_pointer GetCodePointer(int code);
-	bool GetString(int code, CardString* pStr);
+	const CardString* GetCardString(int code);
 	const wchar_t* GetName(int code);
 	const wchar_t* GetText(int code);
 	const wchar_t* GetDesc(int strCode);
@@ -32,13 +38,19 @@ public:
 	const wchar_t* FormatType(int type);
 	const wchar_t* FormatSetName(unsigned long long setcode);
 	const wchar_t* FormatLinkMarker(int link_marker);
+	int LoadScripts(const char* path, bool precompile = false);
+	byte* ReadScript(const char* script_name, int* slen);
 
 	std::unordered_map<unsigned int, CardDataC> _datas;
 	std::unordered_map<unsigned int, CardString> _strings;
+	std::vector<std::vector<wchar_t>> _stringPool;
 	std::unordered_map<unsigned int, std::wstring> _counterStrings;
 	std::unordered_map<unsigned int, std::wstring> _victoryStrings;
 	std::unordered_map<unsigned int, std::wstring> _setnameStrings;
+	std::unordered_map<std::wstring, unsigned int> _setnameIndex;
 	std::unordered_map<unsigned int, std::wstring> _sysStrings;
+	std::unordered_map<std::string, std::vector<byte>> _scripts;
+	std::set<std::string> _scriptPaths;
 
 	wchar_t numStrings[256][4];
 	wchar_t numBuffer[6];
@@ -49,7 +61,7 @@ public:
 	wchar_t lmBuffer[32];
 
 	static wchar_t strBuffer[4096];
-	static byte scriptBuffer[0x20000];
+	static thread_local byte scriptBuffer[0x20000];
 	static const wchar_t* unknown_string;
 	static int CardReader(int, void*);
 	static byte* ScriptReaderEx(const char* script_name, int* slen);
@@ -884,10 +884,64 @@ void DeckBuilder::FilterCards() {
 			query_elements.push_back(element);
 		}
 	}
-	auto strpointer = dataManager._strings.begin();
-	for(code_pointer ptr = dataManager._datas.begin(); ptr != dataManager._datas.end(); ++ptr, ++strpointer) {
+	if(search_index.IsStale())
+		search_index.Build();
+	// narrow the scan down to the cards the index can not rule out; each of them still goes through the full filter
+	CardMask candidates, element_mask, other_mask;
+	search_index.All(candidates);
+	for(auto elements_iterator = query_elements.begin(); elements_iterator != query_elements.end(); ++elements_iterator) {
+		if(elements_iterator->exclude)
+			continue;
+		if(elements_iterator->type == element_t::type_t::name) {
+			search_index.MatchName(element_mask, elements_iterator->keyword.c_str());
+		} else if(elements_iterator->type == element_t::type_t::setcode) {
+			search_index.MatchSetCode(element_mask, elements_iterator->setcode);
+		} else {
+			if(dataManager.GetData(BufferIO::GetVal(elements_iterator->keyword.c_str()), 0))
+				continue;
+			search_index.MatchName(element_mask, elements_iterator->keyword.c_str());
+			search_index.MatchText(other_mask, elements_iterator->keyword.c_str());
+			search_index.Add(element_mask, other_mask);
+			if(elements_iterator->setcode) {
+				search_index.MatchSetCode(other_mask, elements_iterator->setcode);
+				search_index.Add(element_mask, other_mask);
+			}
+		}
+		search_index.Intersect(candidates, element_mask);
+	}
+	switch(filter_type) {
+	case 1: {
+		search_index.Intersect(candidates, search_index.type_cards, TYPE_MONSTER);
+		for(unsigned int type = 1; type; type <<= 1) {
+			if(filter_type2 & type)
+				search_index.Intersect(candidates, search_index.type_cards, type);
+		}
+		if(filter_race)
+			search_index.Intersect(candidates, search_index.race_cards, filter_race);
+		if(filter_attrib)
+			search_index.Intersect(candidates, search_index.attribute_cards, filter_attrib);
+		search_index.MatchAttack(candidates, filter_atktype, filter_atk);
+		search_index.MatchDefense(candidates, filter_deftype, filter_def);
+		search_index.MatchLevel(candidates, filter_lvtype, filter_lv);
+		search_index.MatchScale(candidates, filter_scltype, filter_scl);
+		break;
+	}
+	case 2:
+	case 3: {
+		search_index.Intersect(candidates, search_index.type_cards, filter_type == 2 ? TYPE_SPELL : TYPE_TRAP);
+		for(unsigned int type = 1; type; type <<= 1) {
+			if(filter_type2 & type)
+				search_index.Intersect(candidates, search_index.type_cards, type);
+		}
+		break;
+	}
+	}
+	std::vector<unsigned int> indices;
+	search_index.Collect(candidates, indices);
+	for(auto index : indices) {
+		code_pointer ptr = search_index.cards[index];
 		const CardDataC& data = ptr->second;
-		const CardString& text = strpointer->second;
+		const CardString& text = *search_index.strings[index];
 		if(data.type & TYPE_TOKEN)
 			continue;
 		switch(filter_type) {
@@ -898,32 +952,7 @@ void DeckBuilder::FilterCards() {
 				continue;
 			if(filter_attrib && data.attribute != filter_attrib)
 				continue;
-			if(filter_atktype) {
-				if((filter_atktype == 1 && data.attack != filter_atk) || (filter_atktype == 2 && data.attack < filter_atk)
-				        || (filter_atktype == 3 && data.attack <= filter_atk) || (filter_atktype == 4 && (data.attack > filter_atk || data.attack < 0))
-				        || (filter_atktype == 5 && (data.attack >= filter_atk || data.attack < 0)) || (filter_atktype == 6 && data.attack != -2))
-					continue;
-			}
-			if(filter_deftype) {
-				if((filter_deftype == 1 && data.defense != filter_def) || (filter_deftype == 2 && data.defense < filter_def)
-				        || (filter_deftype == 3 && data.defense <= filter_def) || (filter_deftype == 4 && (data.defense > filter_def || data.defense < 0))
-				        || (filter_deftype == 5 && (data.defense >= filter_def || data.defense < 0)) || (filter_deftype == 6 && data.defense != -2)
-				        || (data.type & TYPE_LINK))
-					continue;
-			}
-			if(filter_lvtype) {
-				if((filter_lvtype == 1 && data.level != filter_lv) || (filter_lvtype == 2 && data.level < filter_lv)
-				        || (filter_lvtype == 3 && data.level <= filter_lv) || (filter_lvtype == 4 && data.level > filter_lv)
-				        || (filter_lvtype == 5 && data.level >= filter_lv) || filter_lvtype == 6)
-					continue;
-			}
-			if(filter_scltype) {
-				if((filter_scltype == 1 && data.lscale != filter_scl) || (filter_scltype == 2 && data.lscale < filter_scl)
-				        || (filter_scltype == 3 && data.lscale <= filter_scl) || (filter_scltype == 4 && (data.lscale > filter_scl))
-				        || (filter_scltype == 5 && (data.lscale >= filter_scl)) || filter_scltype == 6
-				        || !(data.type & TYPE_PENDULUM))
-					continue;
-			}
+			// ATK, DEF, level and scale are already applied to the candidates
 			break;
 		}
 		case 2: {
@@ -963,15 +992,15 @@ void DeckBuilder::FilterCards() {
 		for (auto elements_iterator = query_elements.begin(); elements_iterator != query_elements.end(); ++elements_iterator) {
 			bool match = false;
 			if (elements_iterator->type == element_t::type_t::name) {
-				match = CardNameContains(text.name.c_str(), elements_iterator->keyword.c_str());
+				match = CardNameContains(text.name, elements_iterator->keyword.c_str());
 			} else if (elements_iterator->type == element_t::type_t::setcode) {
 				match = elements_iterator->setcode && check_set_code(data, elements_iterator->setcode);
 			} else {
 				int trycode = BufferIO::GetVal(elements_iterator->keyword.c_str());
 				bool tryresult = dataManager.GetData(trycode, 0);
 				if(!tryresult) {
-					match = CardNameContains(text.name.c_str(), elements_iterator->keyword.c_str())
-						|| text.text.find(elements_iterator->keyword) != std::wstring::npos
+					match = CardNameContains(text.name, elements_iterator->keyword.c_str())
+						|| wcsstr(text.text, elements_iterator->keyword.c_str())
 						|| (elements_iterator->setcode && check_set_code(data, elements_iterator->setcode));
 				} else {
 					match = data.code == trycode || data.alias == trycode;
@@ -1060,26 +1089,6 @@ void DeckBuilder::SortList() {
 		break;
 	}
 }
-static inline wchar_t NormalizeChar(wchar_t c) {
-	/*
-	// Convert all symbols and punctuations to space.
-	if (c != 0 && c < 128 && !isalnum(c)) {
-		return ' ';
-	}
-	*/
-	// Convert latin chararacters to uppercase to ignore case.
-	if (c < 128 && isalpha(c)) {
-		return toupper(c);
-	}
-	// Remove some accentued characters that are not supported by the editbox.
-	if (c >= 232 && c <= 235) {
-		return 'E';
-	}
-	if (c >= 238 && c <= 239) {
-		return 'I';
-	}
-	return c;
-}
 bool DeckBuilder::CardNameContains(const wchar_t *haystack, const wchar_t *needle)
 {
 	if (!needle[0]) {
@@ -5,6 +5,7 @@
 #include <unordered_map>
 #include <vector>
 #include "client_card.h"
+#include "search_index.h"
 
 namespace ygo {
 
@@ -67,6 +68,7 @@ public:
 
 	const std::unordered_map<int, int>* filterList;
 	std::vector<code_pointer> results;
+	SearchIndex search_index;
 	wchar_t result_string[8];
 };
 
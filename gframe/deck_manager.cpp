@@ -1,7 +1,9 @@
 #include "deck_manager.h"
 #include "data_manager.h"
 #include "network.h"
+#ifndef YGOPRO_SERVER_MODE
 #include "game.h"
+#endif
 
 namespace ygo {
 
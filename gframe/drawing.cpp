@@ -341,7 +341,7 @@ void Game::DrawCard(ClientCard* pcard) {
 	driver->setTransform(irr::video::ETS_WORLD, pcard->mTransform);
 	auto m22 = pcard->mTransform(2, 2);
 	if(m22 > -0.99 || pcard->is_moving) {
-		matManager.mCard.setTexture(0, imageManager.GetTexture(pcard->code));
+		matManager.mCard.setTexture(0, imageManager.GetTexture(pcard->code, true));
 		driver->setMaterial(matManager.mCard);
 		driver->drawVertexPrimitiveList(matManager.vCardFront, 4, matManager.iRectangle, 2);
 	}
@@ -451,7 +451,7 @@ void Game::DrawMisc() {
 			im.setTranslation(pos);
 			driver->setTransform(irr::video::ETS_WORLD, im);
 			matManager.mCard.DiffuseColor = 0xbbffffff;
-			matManager.mCard.setTexture(0, imageManager.GetTexture((*cit)->code));
+			matManager.mCard.setTexture(0, imageManager.GetTexture((*cit)->code, true));
 			driver->setMaterial(matManager.mCard);
 			driver->drawVertexPrimitiveList(matManager.vCardFront, 4, matManager.iRectangle, 2);
 			pos.Z += 0.03f;
@@ -1103,50 +1103,66 @@ void Game::DrawThumb(code_pointer cp, position2di pos, const std::unordered_map<
 	int lcode = cp->second.alias;
 	if(lcode == 0)
 		lcode = code;
-	irr::video::ITexture* img = imageManager.GetTextureThumb(code);
+	irr::video::ITexture* img = imageManager.GetTextureThumb(code, true);
 	if(img == NULL)
 		return; //NULL->getSize() will cause a crash
-	dimension2d<u32> size = img->getOriginalSize();
-	driver->draw2DImage(img, mainGame->Resize(pos.X, pos.Y, pos.X + CARD_THUMB_WIDTH, pos.Y + CARD_THUMB_HEIGHT), rect<s32>(0, 0, size.Width, size.Height));
+	recti dest = mainGame->Resize(pos.X, pos.Y, pos.X + CARD_THUMB_WIDTH, pos.Y + CARD_THUMB_HEIGHT);
+	// icons, relative to the thumbnail
+	ThumbBadge badges[3];
+	int count = 0;
+	auto badge = [&](int id, irr::video::ITexture* texture, recti source, s32 x1, s32 y1, s32 x2, s32 y2) {
+		badges[count].id = id;
+		badges[count].texture = texture;
+		badges[count].source = source;
+		badges[count].dest = mainGame->Resize(pos.X + x1, pos.Y + y1, pos.X + x2, pos.Y + y2) - dest.UpperLeftCorner;
+		count++;
+	};
 
 	if(cp->second.ot == 5)
-		driver->draw2DImage(imageManager.tRush, mainGame->Resize(pos.X + 3, pos.Y + 46, pos.X + 41, pos.Y + 65), recti(0, 0, 152, 76), 0, 0, true);
+		badge(1, imageManager.tRush, recti(0, 0, 152, 76), 3, 46, 41, 65);
 
 	if(cp->second.ot == 5 && cp->second.category == 128) {
-		driver->draw2DImage(imageManager.tLegend, mainGame->Resize(pos.X, pos.Y, pos.X + 20, pos.Y + 20), recti(0, 0, 64, 64), 0, 0, true);
+		badge(2, imageManager.tLegend, recti(0, 0, 64, 64), 0, 0, 20, 20);
 	}
 	else if(lflist->count(lcode)) {
 		switch((*lflist).at(lcode)) {
 		case 0:
-			driver->draw2DImage(imageManager.tLim, mainGame->Resize(pos.X, pos.Y, pos.X + 20, pos.Y + 20), recti(0, 0, 64, 64), 0, 0, true);
+			badge(3, imageManager.tLim, recti(0, 0, 64, 64), 0, 0, 20, 20);
 			break;
 		case 1:
-			driver->draw2DImage(imageManager.tLim, mainGame->Resize(pos.X, pos.Y, pos.X + 20, pos.Y + 20), recti(64, 0, 128, 64), 0, 0, true);
+			badge(4, imageManager.tLim, recti(64, 0, 128, 64), 0, 0, 20, 20);
 			break;
 		case 2:
-			driver->draw2DImage(imageManager.tLim, mainGame->Resize(pos.X, pos.Y, pos.X + 20, pos.Y + 20), recti(0, 64, 64, 128), 0, 0, true);
+			badge(5, imageManager.tLim, recti(0, 64, 64, 128), 0, 0, 20, 20);
 			break;
 		}
 	}
 	if(mainGame->cbLimit->getSelected() >= 4 && (cp->second.ot & mainGame->gameConf.defaultOT)) {
 		switch(cp->second.ot) {
 		case 1:
-			driver->draw2DImage(imageManager.tOT, mainGame->Resize(pos.X + 7, pos.Y + 50, pos.X + 37, pos.Y + 65), recti(0, 128, 128, 192), 0, 0, true);
+			badge(6, imageManager.tOT, recti(0, 128, 128, 192), 7, 50, 37, 65);
 			break;
 		case 2:
-			driver->draw2DImage(imageManager.tOT, mainGame->Resize(pos.X + 7, pos.Y + 50, pos.X + 37, pos.Y + 65), recti(0, 192, 128, 256), 0, 0, true);
+			badge(7, imageManager.tOT, recti(0, 192, 128, 256), 7, 50, 37, 65);
 			break;
 		}
 	} else if(mainGame->cbLimit->getSelected() >= 4 || !(cp->second.ot & mainGame->gameConf.defaultOT)) {
 		switch(cp->second.ot) {
 		case 1:
-			driver->draw2DImage(imageManager.tOT, mainGame->Resize(pos.X + 7, pos.Y + 50, pos.X + 37, pos.Y + 65), recti(0, 0, 128, 64), 0, 0, true);
+			badge(8, imageManager.tOT, recti(0, 0, 128, 64), 7, 50, 37, 65);
 			break;
 		case 2:
-			driver->draw2DImage(imageManager.tOT, mainGame->Resize(pos.X + 7, pos.Y + 50, pos.X + 37, pos.Y + 65), recti(0, 64, 128, 128), 0, 0, true);
+			badge(9, imageManager.tOT, recti(0, 64, 128, 128), 7, 50, 37, 65);
 			break;
 		}
 	}
+	// batched through the atlas, and drawn by the next thumbAtlas.Draw
+	if(imageManager.thumbAtlas.Queue(img == imageManager.tUnknown ? 0 : code, img, badges, count, dest))
+		return;
+	dimension2d<u32> size = img->getOriginalSize();
+	driver->draw2DImage(img, dest, rect<s32>(0, 0, size.Width, size.Height));
+	for(int i = 0; i < count; ++i)
+		driver->draw2DImage(badges[i].texture, badges[i].dest + dest.UpperLeftCorner, badges[i].source, 0, 0, true);
 }
 void Game::DrawDeckBd() {
 	wchar_t textBuffer[64];
@@ -1168,10 +1184,12 @@ void Game::DrawDeckBd() {
 		lx = (deckManager.current_deck.main.size() - 41) / 4 + 11;
 		dx = 436.0f / (lx - 1);
 	}
-	for(size_t i = 0; i < deckManager.current_deck.main.size(); ++i) {
+	for(size_t i = 0; i < deckManager.current_deck.main.size(); ++i)
 		DrawThumb(deckManager.current_deck.main[i], position2di(314 + (i % lx) * dx, 164 + (i / lx) * 68), deckBuilder.filterList);
-		if(deckBuilder.hovered_pos == 1 && deckBuilder.hovered_seq == (int)i)
-			driver->draw2DRectangleOutline(mainGame->Resize(313 + (i % lx) * dx, 163 + (i / lx) * 68, 359 + (i % lx) * dx, 228 + (i / lx) * 68));
+	imageManager.thumbAtlas.Draw();
+	if(deckBuilder.hovered_pos == 1 && deckBuilder.hovered_seq >= 0 && deckBuilder.hovered_seq < (int)deckManager.current_deck.main.size()) {
+		size_t i = deckBuilder.hovered_seq;
+		driver->draw2DRectangleOutline(mainGame->Resize(313 + (i % lx) * dx, 163 + (i / lx) * 68, 359 + (i % lx) * dx, 228 + (i / lx) * 68));
 	}
 	//extra deck
 	driver->draw2DRectangle(mainGame->Resize(310, 440, 410, 460), 0x400000ff, 0x400000ff, 0x40000000, 0x40000000);
@@ -1185,10 +1203,12 @@ void Game::DrawDeckBd() {
 	if(deckManager.current_deck.extra.size() <= 10)
 		dx = 436.0f / 9;
 	else dx = 436.0f / (deckManager.current_deck.extra.size() - 1);
-	for(size_t i = 0; i < deckManager.current_deck.extra.size(); ++i) {
+	for(size_t i = 0; i < deckManager.current_deck.extra.size(); ++i)
 		DrawThumb(deckManager.current_deck.extra[i], position2di(314 + i * dx, 466), deckBuilder.filterList);
-		if(deckBuilder.hovered_pos == 2 && deckBuilder.hovered_seq == (int)i)
-			driver->draw2DRectangleOutline(mainGame->Resize(313 + i * dx, 465, 359 + i * dx, 531));
+	imageManager.thumbAtlas.Draw();
+	if(deckBuilder.hovered_pos == 2 && deckBuilder.hovered_seq >= 0 && deckBuilder.hovered_seq < (int)deckManager.current_deck.extra.size()) {
+		size_t i = deckBuilder.hovered_seq;
+		driver->draw2DRectangleOutline(mainGame->Resize(313 + i * dx, 465, 359 + i * dx, 531));
 	}
 	//side deck
 	driver->draw2DRectangle(mainGame->Resize(310, 537, 410, 557), 0x400000ff, 0x400000ff, 0x40000000, 0x40000000);
@@ -1202,10 +1222,12 @@ void Game::DrawDeckBd() {
 	if(deckManager.current_deck.side.size() <= 10)
 		dx = 436.0f / 9;
 	else dx = 436.0f / (deckManager.current_deck.side.size() - 1);
-	for(size_t i = 0; i < deckManager.current_deck.side.size(); ++i) {
+	for(size_t i = 0; i < deckManager.current_deck.side.size(); ++i)
 		DrawThumb(deckManager.current_deck.side[i], position2di(314 + i * dx, 564), deckBuilder.filterList);
-		if(deckBuilder.hovered_pos == 3 && deckBuilder.hovered_seq == (int)i)
-			driver->draw2DRectangleOutline(mainGame->Resize(313 + i * dx, 563, 359 + i * dx, 629));
+	imageManager.thumbAtlas.Draw();
+	if(deckBuilder.hovered_pos == 3 && deckBuilder.hovered_seq >= 0 && deckBuilder.hovered_seq < (int)deckManager.current_deck.side.size()) {
+		size_t i = deckBuilder.hovered_seq;
+		driver->draw2DRectangleOutline(mainGame->Resize(313 + i * dx, 563, 359 + i * dx, 629));
 	}
 	//search result
 	driver->draw2DRectangle(mainGame->Resize(805, 137, 920, 157), 0x400000ff, 0x400000ff, 0x40000000, 0x40000000);
@@ -1281,8 +1303,10 @@ void Game::DrawDeckBd() {
 			textFont->draw(textBuffer, mainGame->Resize(860, 209 + i * 66, 955, 229 + i * 66), 0xffffffff, false, false);
 		}
 	}
+	imageManager.thumbAtlas.Draw();
 	if(deckBuilder.is_draging) {
 		DrawThumb(deckBuilder.draging_pointer, position2di(deckBuilder.dragx - 22, deckBuilder.dragy - 32), deckBuilder.filterList);
+		imageManager.thumbAtlas.Draw();
 	}
 }
 static void DrawPlayerAvatar(IVideoDriver *driver, vector2di pos, int player, bool right)
@@ -0,0 +1,295 @@
+#include "network.h"
+#include "netserver.h"
+#include "../ocgcore/ocgapi.h"
+#include "../ocgcore/common.h"
+
+namespace ygo {
+
+void DuelMode::RefreshLocation(int player, int location, int flag, int use_cache) {
+	char query_buffer[0x4000];
+	char mask_buffer[0x4000];
+	char* qbuf = query_buffer;
+	BufferIO::WriteInt8(qbuf, MSG_UPDATE_DATA);
+	BufferIO::WriteInt8(qbuf, player);
+	BufferIO::WriteInt8(qbuf, location);
+	if(location == LOCATION_HAND)
+		flag |= QUERY_POSITION;
+	int len = query_field_card(pduel, player, location, flag, (unsigned char*)qbuf, use_cache) + 3;
+	if(location & (LOCATION_MZONE | LOCATION_SZONE | LOCATION_HAND)) {
+		MaskLocationQuery(mask_buffer, query_buffer, len);
+		SendLocationQuery(player, location, query_buffer, mask_buffer, len);
+	} else
+		SendLocationQuery(player, location, query_buffer, 0, len);
+}
+void DuelMode::RefreshField(int location, int flag, int use_cache) {
+	static const int order[] = { LOCATION_MZONE, LOCATION_SZONE, LOCATION_HAND, LOCATION_GRAVE, LOCATION_EXTRA };
+	for(int i = 0; i < 5; ++i) {
+		if(!(location & order[i]))
+			continue;
+		int qflag = flag ? flag : DefaultQueryFlag(order[i]);
+		RefreshLocation(0, order[i], qflag, use_cache);
+		RefreshLocation(1, order[i], qflag, use_cache);
+	}
+}
+static int QueryCacheIndex(int location) {
+	switch(location) {
+	case LOCATION_MZONE:
+		return 0;
+	case LOCATION_SZONE:
+		return 1;
+	case LOCATION_HAND:
+		return 2;
+	case LOCATION_GRAVE:
+		return 3;
+	case LOCATION_EXTRA:
+		return 4;
+	}
+	return -1;
+}
+static int QueryListIndex(unsigned int bit) {
+	if(bit == QUERY_TARGET_CARD)
+		return 0;
+	if(bit == QUERY_OVERLAY_CARD)
+		return 1;
+	return 2;
+}
+int DuelMode::DefaultQueryFlag(int location) {
+	switch(location) {
+	case LOCATION_MZONE:
+		return 0x881fff;
+	case LOCATION_SZONE:
+		return 0x681fff;
+	case LOCATION_HAND:
+		return 0x781fff;
+	}
+	return 0x81fff;
+}
+// copy a MSG_UPDATE_DATA into dst in one pass, blanking the records the opponent may not see:
+// face-down cards on the field and cards in hand that are not revealed
+void DuelMode::MaskLocationQuery(char* dst, char* src, int len) {
+	memcpy(dst, src, 3);
+	bool hand = src[2] == LOCATION_HAND;
+	char* qbuf = src + 3;
+	char* mbuf = dst + 3;
+	char* qend = src + len;
+	while(qbuf < qend) {
+		int clen = BufferIO::ReadInt32(qbuf);
+		BufferIO::WriteInt32(mbuf, clen);
+		if(clen == 4)
+			continue;
+		int qflag = *(int*)qbuf;
+		int offset = (qflag & QUERY_CODE) ? 8 : 4;
+		unsigned position = ((*(int*)(qbuf + offset)) >> 24) & 0xff;
+		bool hidden = hand ? !(position & POS_FACEUP) : (position & POS_FACEDOWN);
+		if(hidden)
+			memset(mbuf, 0, clen - 4);
+		else
+			memcpy(mbuf, qbuf, clen - 4);
+		qbuf += clen - 4;
+		mbuf += clen - 4;
+	}
+}
+// send a MSG_UPDATE_DATA to one viewer, keeping only the fields that viewer does not hold yet;
+// nothing is sent when the viewer is already up to date
+bool DuelMode::SendQueryUpdate(DuelPlayer* dp, int viewer, char* query, int len) {
+	int index = QueryCacheIndex(query[2]);
+	if(index < 0) {
+		NetServer::SendBufferToPlayer(dp, STOC_GAME_MSG, query, len);
+		return true;
+	}
+	char diff_buffer[0x4000];
+	int dlen = DiffLocationQuery(diff_buffer, query, len, query_cache[viewer][query[1] & 1][index]);
+	if(!dlen)
+		return false;
+	NetServer::SendBufferToPlayer(dp, STOC_GAME_MSG, diff_buffer, dlen);
+	return true;
+}
+// rewrite every record of src so that its flag only covers the fields that changed since the
+// last records recorded in cache; unchanged cards shrink to an empty record, which the client skips.
+// returns 0 when no card changed
+int DuelMode::DiffLocationQuery(char* dst, char* src, int len, std::vector<QueryCard>& cache) {
+	// every field ClientCard::UpdateInfo can read; anything else is passed through untouched
+	const unsigned int known_flag = 0xefffff;
+	const unsigned int list_flag = QUERY_TARGET_CARD | QUERY_OVERLAY_CARD | QUERY_COUNTERS;
+	size_t count = 0;
+	for(char* qbuf = src + 3; qbuf < src + len; qbuf += *(int*)qbuf)
+		count++;
+	if(cache.size() != count) {
+		cache.clear();
+		cache.resize(count);
+	}
+	memcpy(dst, src, 3);
+	char* qbuf = src + 3;
+	char* pbuf = dst + 3;
+	bool changed = false;
+	for(size_t i = 0; i < count; ++i) {
+		QueryCard& card = cache[i];
+		char* record = qbuf;
+		int clen = BufferIO::ReadInt32(qbuf);
+		qbuf += clen - 4;
+		unsigned int qflag = (clen > 8) ? *(unsigned int*)(record + 4) : 0;
+		if(!qflag) {
+			card.flag = 0;
+			BufferIO::WriteInt32(pbuf, 4);
+			continue;
+		}
+		if(qflag & ~known_flag) {
+			card.flag = 0;
+			memcpy(pbuf, record, clen);
+			pbuf += clen;
+			changed = true;
+			continue;
+		}
+		char* field[24];
+		int field_len[24];
+		char* f = record + 8;
+		unsigned int dflag = 0;
+		for(int b = 0; b < 24; ++b) {
+			unsigned int bit = 1U << b;
+			if(!(qflag & bit))
+				continue;
+			int flen = 4;
+			if(bit & list_flag)
+				flen += *(int*)f * 4;
+			else if(bit == QUERY_LINK)
+				flen = 8;
+			field[b] = f;
+			field_len[b] = flen;
+			f += flen;
+			bool same = false;
+			if(card.flag & bit) {
+				if(bit & list_flag) {
+					std::vector<int>& list = card.list[QueryListIndex(bit)];
+					same = list.size() == (size_t)(flen / 4 - 1) && (list.empty() || !memcmp(&list[0], field[b] + 4, flen - 4));
+				} else
+					same = card.value[b] == *(int*)field[b] && (bit != QUERY_LINK || card.link_marker == *(int*)(field[b] + 4));
+			}
+			if(!same)
+				dflag |= bit;
+		}
+		// the client renders the level string and the defense string from these pairs together
+		if((dflag & QUERY_LEVEL) && (qflag & QUERY_RANK))
+			dflag |= QUERY_RANK;
+		if((dflag & QUERY_TYPE) && (qflag & QUERY_DEFENSE))
+			dflag |= QUERY_DEFENSE;
+		if(!dflag) {
+			BufferIO::WriteInt32(pbuf, 4);
+			continue;
+		}
+		char* drecord = pbuf;
+		pbuf += 4;
+		BufferIO::WriteInt32(pbuf, dflag);
+		for(int b = 0; b < 24; ++b) {
+			unsigned int bit = 1U << b;
+			if(!(dflag & bit))
+				continue;
+			if(bit & list_flag) {
+				int* values = (int*)(field[b] + 4);
+				card.list[QueryListIndex(bit)].assign(values, values + field_len[b] / 4 - 1);
+			} else {
+				card.value[b] = *(int*)field[b];
+				if(bit == QUERY_LINK)
+					card.link_marker = *(int*)(field[b] + 4);
+			}
+			memcpy(pbuf, field[b], field_len[b]);
+			pbuf += field_len[b];
+		}
+		card.flag |= qflag;
+		*(int*)drecord = pbuf - drecord;
+		changed = true;
+	}
+	return changed ? pbuf - dst : 0;
+}
+void DuelMode::InvalidateQueryCache() {
+	for(int v = 0; v < QUERY_VIEWERS; ++v)
+		for(int p = 0; p < 2; ++p)
+			for(int i = 0; i < 5; ++i)
+				query_cache[v][p][i].clear();
+}
+void DuelMode::InvalidateQueryCache(int player, int location) {
+	if(location & LOCATION_OVERLAY)
+		location = LOCATION_MZONE;
+	int index = QueryCacheIndex(location);
+	if(player < 0 || player > 1 || index < 0)
+		return;
+	for(int v = 0; v < QUERY_VIEWERS; ++v)
+		query_cache[v][player][index].clear();
+}
+// drop the cached query state a duel message may have made stale on the client side.
+// messages that only animate or prompt keep it; moves and position changes touch their own
+// locations plus the field, whose cards hold equip/target links; everything else drops it all
+void DuelMode::TrackQueryCache(unsigned char msg, char* pbuf) {
+	switch(msg) {
+	case MSG_RETRY:
+	case MSG_HINT:
+	case MSG_WIN:
+	case MSG_SELECT_BATTLECMD:
+	case MSG_SELECT_IDLECMD:
+	case MSG_SELECT_EFFECTYN:
+	case MSG_SELECT_YESNO:
+	case MSG_SELECT_OPTION:
+	case MSG_SELECT_CARD:
+	case MSG_SELECT_TRIBUTE:
+	case MSG_SELECT_UNSELECT_CARD:
+	case MSG_SELECT_CHAIN:
+	case MSG_SELECT_PLACE:
+	case MSG_SELECT_DISFIELD:
+	case MSG_SELECT_POSITION:
+	case MSG_SELECT_COUNTER:
+	case MSG_SELECT_SUM:
+	case MSG_NEW_TURN:
+	case MSG_NEW_PHASE:
+	case MSG_FIELD_DISABLED:
+	case MSG_SUMMONING:
+	case MSG_SUMMONED:
+	case MSG_SPSUMMONING:
+	case MSG_SPSUMMONED:
+	case MSG_FLIPSUMMONED:
+	case MSG_CHAINING:
+	case MSG_CHAINED:
+	case MSG_CHAIN_SOLVING:
+	case MSG_CHAIN_SOLVED:
+	case MSG_CHAIN_END:
+	case MSG_CHAIN_NEGATED:
+	case MSG_CHAIN_DISABLED:
+	case MSG_CARD_SELECTED:
+	case MSG_RANDOM_SELECTED:
+	case MSG_BECOME_TARGET:
+	case MSG_DAMAGE:
+	case MSG_RECOVER:
+	case MSG_LPUPDATE:
+	case MSG_PAY_LPCOST:
+	case MSG_ATTACK:
+	case MSG_ATTACK_DISABLED:
+	case MSG_DAMAGE_STEP_START:
+	case MSG_DAMAGE_STEP_END:
+	case MSG_MISSED_EFFECT:
+	case MSG_TOSS_COIN:
+	case MSG_TOSS_DICE:
+	case MSG_ROCK_PAPER_SCISSORS:
+	case MSG_HAND_RES:
+	case MSG_ANNOUNCE_RACE:
+	case MSG_ANNOUNCE_ATTRIB:
+	case MSG_ANNOUNCE_CARD:
+	case MSG_ANNOUNCE_NUMBER:
+	case MSG_CARD_HINT:
+	case MSG_PLAYER_HINT:
+	case MSG_MATCH_KILL:
+		break;
+	case MSG_MOVE:
+	case MSG_POS_CHANGE:
+		InvalidateQueryCache(pbuf[4], (unsigned char)pbuf[5]);
+		if(msg == MSG_MOVE)
+			InvalidateQueryCache(pbuf[8], (unsigned char)pbuf[9]);
+		for(int p = 0; p < 2; ++p) {
+			InvalidateQueryCache(p, LOCATION_MZONE);
+			InvalidateQueryCache(p, LOCATION_SZONE);
+		}
+		break;
+	default:
+		InvalidateQueryCache();
+		break;
+	}
+}
+
+}
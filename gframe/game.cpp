@@ -10,8 +10,6 @@
 #include "single_mode.h"
 #include <sstream>
 
-const unsigned short PRO_VERSION = 0x133D;
-
 namespace ygo {
 
 Game* mainGame;
@@ -806,6 +804,7 @@ void Game::MainLoop() {
 		atkdy = (float)sin(atkframe);
 		driver->beginScene(true, true, SColor(0, 0, 0, 0));
 		gMutex.lock();
+		imageManager.UploadLoadedImages();
 		if(dInfo.isStarted) {
 			imageManager.LoadPendingTextures();
 			if (mainGame->showcardcode == 1 || mainGame->showcardcode == 3)
@@ -872,6 +871,13 @@ void Game::MainLoop() {
 	DuelClient::StopClient(true);
 	if(dInfo.isSingleMode)
 		SingleMode::StopPlay(true);
+	imageManager.StopLoaders();
+	if(gameConf.texture_cache_stats) {
+		char msgbuf[256];
+		sprintf(msgbuf, "[Texture cache]: %u hits, %u misses, %u evictions, %d KB in use", imageManager.textureHits,
+		        imageManager.textureMisses, imageManager.textureEvictions, (int)(imageManager.textureBytes >> 10));
+		ErrorLog(msgbuf);
+	}
 	std::this_thread::sleep_for(std::chrono::milliseconds(500));
 //	SaveConfig();
 //	device->drop();
@@ -1030,6 +1036,9 @@ void Game::LoadConfig() {
 	wchar_t wstr[256];
 	gameConf.use_d3d = 0;
 	gameConf.use_image_scale = 1;
+	gameConf.image_cache_size = 512;
+	gameConf.texture_cache_size = 128;
+	gameConf.texture_cache_stats = false;
 	gameConf.antialias = 0;
 	gameConf.serverport = 7911;
 	gameConf.textfontsize = 12;
@@ -1078,6 +1087,12 @@ void Game::LoadConfig() {
 			gameConf.use_d3d = atoi(valbuf) > 0;
 		} else if(!strcmp(strbuf, "use_image_scale")) {
 			gameConf.use_image_scale = atoi(valbuf) > 0;
+		} else if(!strcmp(strbuf, "image_cache_size")) {
+			gameConf.image_cache_size = atoi(valbuf);
+		} else if(!strcmp(strbuf, "texture_cache_size")) {
+			gameConf.texture_cache_size = atoi(valbuf);
+		} else if(!strcmp(strbuf, "texture_cache_stats")) {
+			gameConf.texture_cache_stats = atoi(valbuf) > 0;
 		} else if(!strcmp(strbuf, "errorlog")) {
 			enable_log = atoi(valbuf);
 		} else if(!strcmp(strbuf, "textfont")) {
@@ -1176,11 +1191,26 @@ void Game::LoadConfig() {
 	fclose(fp);
 }
 void Game::SaveConfig() {
-	FILE* fp = fopen("system.conf", "w");
+	// the ygoserver section at the end of the file is not the client's and is written back as it was
+	std::string server_conf;
+	FILE* fp = fopen("system.conf", "r");
+	if(fp) {
+		char linebuf[256];
+		while(fgets(linebuf, 256, fp)) {
+			if(server_conf.empty() && strncmp(linebuf, "#ygoserver", 10))
+				continue;
+			server_conf += linebuf;
+		}
+		fclose(fp);
+	}
+	fp = fopen("system.conf", "w");
 	fprintf(fp, "#config file\n#nickname & gamename should be less than 20 characters\n");
 	char linebuf[256];
 	fprintf(fp, "use_d3d = %d\n", gameConf.use_d3d ? 1 : 0);
 	fprintf(fp, "use_image_scale = %d\n", gameConf.use_image_scale ? 1 : 0);
+	fprintf(fp, "image_cache_size = %d\n", gameConf.image_cache_size);
+	fprintf(fp, "texture_cache_size = %d\n", gameConf.texture_cache_size);
+	fprintf(fp, "texture_cache_stats = %d\n", gameConf.texture_cache_stats ? 1 : 0);
 	fprintf(fp, "antialias = %d\n", gameConf.antialias);
 	fprintf(fp, "errorlog = %d\n", enable_log);
 	BufferIO::CopyWStr(ebNickName->getText(), gameConf.nickname, 20);
@@ -1225,6 +1255,7 @@ void Game::SaveConfig() {
 	fprintf(fp, "skin_index = %d\n", gameConf.skin_index);
 	fprintf(fp, "auto_save_replay = %d\n", (chkAutoSaveReplay->isChecked() ? 1 : 0));
 	fprintf(fp, "prefer_expansion_script = %d\n", gameConf.prefer_expansion_script);
+	fputs(server_conf.c_str(), fp);
 	fclose(fp);
 }
 void Game::PlayMusic(char* song, bool loop) {
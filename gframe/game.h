@@ -17,6 +17,9 @@ namespace ygo {
 struct Config {
 	bool use_d3d;
 	bool use_image_scale;
+	int image_cache_size;
+	int texture_cache_size;
+	bool texture_cache_stats;
 	unsigned short antialias;
 	unsigned short serverport;
 	unsigned char textfontsize;
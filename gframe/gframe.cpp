@@ -1,6 +1,8 @@
 #include "config.h"
 #include "game.h"
 #include "data_manager.h"
+#include "replay_verifier.h"
+#include "image_cache.h"
 #include <event2/thread.h>
 #include <memory>
 #ifdef __APPLE__
@@ -58,6 +60,22 @@ int main(int argc, char* argv[]) {
 #endif //_WIN32
 	ygo::Game _game;
 	ygo::mainGame = &_game;
+	if(argc >= 3 && !strcmp(argv[1], "--verify-replays")) { // headless, no window is created
+		_game.gameConf.prefer_expansion_script = 0;
+		_game.LoadConfig();
+		_game.LoadExpansionDB();
+		if(!ygo::dataManager.LoadDB("cards.cdb")) {
+			fprintf(stderr, "Failed to load cards.cdb\n");
+			return EXIT_FAILURE;
+		}
+		unsigned int workers = (argc >= 4) ? atoi(argv[3]) : 0;
+		return ygo::ReplayVerifier::VerifyDirectory(argv[2], workers) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	if(argc >= 2 && !strcmp(argv[1], "--prewarm-images")) { // headless, no window is created
+		_game.LoadConfig();
+		unsigned int workers = (argc >= 3) ? atoi(argv[2]) : 0;
+		return ygo::ImageCache::Prewarm(workers) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
 	if(!ygo::mainGame->Initialize())
 		return 0;
 
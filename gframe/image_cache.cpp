@@ -0,0 +1,284 @@
+#include "image_cache.h"
+#include "image_manager.h"
+#include "game.h"
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+namespace ygo {
+
+struct PrewarmJob {
+	std::string file;
+	s32 width;
+	s32 height;
+};
+
+static std::atomic<unsigned int> temp_count(0);
+
+std::mutex ImageCache::entries_mutex;
+bool ImageCache::entries_scanned = false;
+unsigned long long ImageCache::entries_size = 0;
+ImageCache::EntryList ImageCache::entries;
+std::unordered_map<std::string, ImageCache::EntryList::iterator> ImageCache::entry_index;
+
+irr::video::IImage* ImageCache::Read(irr::video::IVideoDriver* driver, const char* file, s32 width, s32 height) {
+	ImageCacheHeader header;
+	FILE* fp = OpenEntry(file, width, height, header);
+	if(!fp)
+		return NULL;
+	irr::video::IImage* image = driver->createImage((irr::video::ECOLOR_FORMAT)header.format, irr::core::dimension2d<u32>(width, height));
+	size_t size = image->getImageDataSizeInBytes();
+	bool complete = fread(image->lock(), 1, size, fp) == size;
+	image->unlock();
+	fclose(fp);
+	if(!complete) {
+		image->drop();
+		return NULL;
+	}
+	return image;
+}
+// written under a temporary name first, so that a reader never sees half an entry
+void ImageCache::Write(const char* file, s32 width, s32 height, irr::video::IImage* image) {
+	ImageCacheHeader header;
+	char path[256];
+	if(!GetEntry(file, width, height, header, path))
+		return;
+	header.format = image->getColorFormat();
+	size_t size = image->getImageDataSizeInBytes();
+	unsigned long long limit = GetLimit();
+	if(limit && sizeof(header) + size > limit)
+		return;
+	FileSystem::MakeDir(IMAGE_CACHE_DIR);
+	char temp[300];
+	snprintf(temp, sizeof(temp), "%s.%u.tmp", path, temp_count++);
+	FILE* fp = fopen(temp, "wb");
+	if(!fp)
+		return;
+	bool written = fwrite(&header, sizeof(header), 1, fp) == 1;
+	written = written && fwrite(image->lock(), 1, size, fp) == size;
+	image->unlock();
+	fclose(fp);
+	remove(path);
+	if(!written || rename(temp, path)) {
+		remove(temp);
+		return;
+	}
+	AddEntry(path, sizeof(header) + size);
+}
+// scale every card picture under pics/ and expansions/pics/ into the cache on a pool of threads,
+// at the sizes GetTexture, GetTextureThumb and GetTextureField ask for
+bool ImageCache::Prewarm(unsigned int workers) {
+	std::vector<PrewarmJob> jobs;
+	const char* roots[] = { "expansions/pics", "pics" };
+	for(const char* root : roots) {
+		char dir[256];
+		FileSystem::TraversalDir(root, [&jobs, root](const char* name, bool isdir) {
+			const char* ext = strrchr(name, '.');
+			if(isdir || !ext || mystrncasecmp(ext, ".jpg", 4))
+				return;
+			char file[1024];
+			snprintf(file, sizeof(file), "%s/%s", root, name);
+			jobs.push_back({ file, CARD_IMG_WIDTH, CARD_IMG_HEIGHT });
+			char thumb[1024];
+			snprintf(thumb, sizeof(thumb), "%s/thumbnail/%s", root, name);
+			if(!FileSystem::IsFileExists(thumb))
+				jobs.push_back({ file, CARD_THUMB_WIDTH, CARD_THUMB_HEIGHT });
+		});
+		snprintf(dir, sizeof(dir), "%s/thumbnail", root);
+		FileSystem::TraversalDir(dir, [&jobs, &dir](const char* name, bool isdir) {
+			const char* ext = strrchr(name, '.');
+			if(isdir || !ext || mystrncasecmp(ext, ".jpg", 4))
+				return;
+			char file[1024];
+			snprintf(file, sizeof(file), "%s/%s", dir, name);
+			jobs.push_back({ file, CARD_THUMB_WIDTH, CARD_THUMB_HEIGHT });
+		});
+		snprintf(dir, sizeof(dir), "%s/field", root);
+		FileSystem::TraversalDir(dir, [&jobs, &dir](const char* name, bool isdir) {
+			const char* ext = strrchr(name, '.');
+			if(isdir || !ext || (mystrncasecmp(ext, ".jpg", 4) && mystrncasecmp(ext, ".png", 4)))
+				return;
+			char file[1024];
+			snprintf(file, sizeof(file), "%s/%s", dir, name);
+			jobs.push_back({ file, 512, 512 });
+		});
+	}
+	if(!workers)
+		workers = std::thread::hardware_concurrency();
+	if(!workers)
+		workers = 1;
+	if(workers > jobs.size())
+		workers = jobs.size();
+	irr::IrrlichtDevice* device = irr::createDevice(irr::video::EDT_NULL);
+	if(!device) {
+		fprintf(stderr, "Failed to create the image device\n");
+		return false;
+	}
+	irr::video::IVideoDriver* driver = device->getVideoDriver();
+	auto start = std::chrono::steady_clock::now();
+	std::atomic<size_t> next(0);
+	std::atomic<int> scaled(0), fresh(0), unscaled(0), failed(0), skipped(0);
+	std::mutex decode_mutex;
+	std::vector<std::thread> threads;
+	for(unsigned int i = 0; i < workers; ++i) {
+		threads.emplace_back([&]() {
+			size_t index;
+			while((index = next++) < jobs.size()) {
+				const PrewarmJob& job = jobs[index];
+				ImageCacheHeader header;
+				FILE* fp = OpenEntry(job.file.c_str(), job.width, job.height, header);
+				if(fp) {
+					fclose(fp);
+					fresh++;
+					continue;
+				}
+				// a full cache would only drop the pictures prewarmed before
+				if(IsFull()) {
+					skipped++;
+					continue;
+				}
+				fp = fopen(job.file.c_str(), "rb");
+				if(!fp) {
+					failed++;
+					continue;
+				}
+				std::vector<char> buffer;
+				char block[0x4000];
+				size_t len;
+				while((len = fread(block, 1, sizeof(block), fp)) > 0)
+					buffer.insert(buffer.end(), block, block + len);
+				fclose(fp);
+				irr::video::IImage* srcimg = NULL;
+				if(!buffer.empty()) {
+					// the irrlicht jpeg loader keeps the file name in a static member
+					std::lock_guard<std::mutex> lock(decode_mutex);
+					IReadFile* reader = device->getFileSystem()->createMemoryReadFile(buffer.data(), buffer.size(), job.file.c_str(), false);
+					srcimg = driver->createImageFromFile(reader);
+					reader->drop();
+				}
+				if(!srcimg) {
+					failed++;
+					continue;
+				}
+				if(srcimg->getDimension() == irr::core::dimension2d<u32>(job.width, job.height)) {
+					srcimg->drop();
+					unscaled++;
+					continue;
+				}
+				irr::video::IImage* destimg = driver->createImage(srcimg->getColorFormat(), irr::core::dimension2d<u32>(job.width, job.height));
+				imageScaleNNAA(srcimg, destimg);
+				Write(job.file.c_str(), job.width, job.height, destimg);
+				destimg->drop();
+				srcimg->drop();
+				scaled++;
+			}
+		});
+	}
+	for(auto& thread : threads)
+		thread.join();
+	device->drop();
+	double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	fprintf(stderr, "%d images in %.1f s on %u threads: %d scaled, %d up to date, %d already at size, %d unreadable, %d over image_cache_size\n",
+	        (int)jobs.size(), total, workers, (int)scaled, (int)fresh, (int)unscaled, (int)failed, (int)skipped);
+	fprintf(stderr, "%s holds %llu MB\n", IMAGE_CACHE_DIR, entries_size >> 20);
+	return failed == 0;
+}
+// files that are not on disk, like those inside an archive, are not cached
+bool ImageCache::GetEntry(const char* file, s32 width, s32 height, ImageCacheHeader& header, char* path) {
+	struct stat fileStat;
+	if(stat(file, &fileStat) != 0)
+		return false;
+	header.magic = IMAGE_CACHE_MAGIC;
+	header.width = width;
+	header.height = height;
+	header.format = 0;
+	header.source_time = fileStat.st_mtime;
+	header.source_size = fileStat.st_size;
+	// 64-bit FNV-1a of the path and the size
+	unsigned long long hash = 0xcbf29ce484222325ULL;
+	for(const char* p = file; *p; ++p) {
+		hash ^= (unsigned char)*p;
+		hash *= 0x100000001b3ULL;
+	}
+	unsigned int size[2] = { (unsigned int)width, (unsigned int)height };
+	for(unsigned int i = 0; i < sizeof(size); ++i) {
+		hash ^= ((unsigned char*)size)[i];
+		hash *= 0x100000001b3ULL;
+	}
+	sprintf(path, IMAGE_CACHE_DIR "/%016llx.bin", hash);
+	return true;
+}
+// the entry positioned at its pixels, when it was made from the file as it is now
+FILE* ImageCache::OpenEntry(const char* file, s32 width, s32 height, ImageCacheHeader& header) {
+	char path[256];
+	ImageCacheHeader expected;
+	if(!GetEntry(file, width, height, expected, path))
+		return NULL;
+	FILE* fp = fopen(path, "rb");
+	if(!fp)
+		return NULL;
+	if(fread(&header, sizeof(header), 1, fp) != 1 || header.magic != expected.magic || header.width != expected.width
+	        || header.height != expected.height || header.format > irr::video::ECF_A8R8G8B8
+	        || header.source_time != expected.source_time || header.source_size != expected.source_size) {
+		fclose(fp);
+		return NULL;
+	}
+	return fp;
+}
+unsigned long long ImageCache::GetLimit() {
+	return mainGame->gameConf.image_cache_size > 0 ? (unsigned long long)mainGame->gameConf.image_cache_size << 20 : 0;
+}
+// the entries left by earlier runs, ordered by the time they were written; called with entries_mutex held
+void ImageCache::ScanEntries() {
+	entries_scanned = true;
+	std::vector<std::pair<long long, std::pair<std::string, unsigned long long>>> found;
+	FileSystem::TraversalDir(IMAGE_CACHE_DIR, [&found](const char* name, bool isdir) {
+		size_t len = strlen(name);
+		if(isdir || len < 4 || strcmp(name + len - 4, ".bin"))
+			return;
+		std::string path = std::string(IMAGE_CACHE_DIR "/") + name;
+		struct stat fileStat;
+		if(stat(path.c_str(), &fileStat) != 0)
+			return;
+		found.push_back(std::make_pair((long long)fileStat.st_mtime, std::make_pair(path, (unsigned long long)fileStat.st_size)));
+	});
+	std::sort(found.begin(), found.end());
+	for(auto& entry : found) {
+		entries.push_back(entry.second);
+		entry_index[entry.second.first] = --entries.end();
+		entries_size += entry.second.second;
+	}
+}
+bool ImageCache::IsFull() {
+	unsigned long long limit = GetLimit();
+	std::lock_guard<std::mutex> lock(entries_mutex);
+	if(!entries_scanned)
+		ScanEntries();
+	return limit && entries_size >= limit;
+}
+// the oldest entries are removed until the directory is within image_cache_size again
+void ImageCache::AddEntry(const char* path, unsigned long long size) {
+	unsigned long long limit = GetLimit();
+	std::lock_guard<std::mutex> lock(entries_mutex);
+	if(!entries_scanned)
+		ScanEntries();
+	auto eit = entry_index.find(path);
+	if(eit != entry_index.end()) {
+		entries_size -= eit->second->second;
+		entries.erase(eit->second);
+		entry_index.erase(eit);
+	}
+	entries.push_back(std::make_pair(std::string(path), size));
+	entry_index[path] = --entries.end();
+	entries_size += size;
+	while(limit && entries_size > limit && entries.size() > 1) {
+		remove(entries.front().first.c_str());
+		entries_size -= entries.front().second;
+		entry_index.erase(entries.front().first);
+		entries.pop_front();
+	}
+}
+
+}
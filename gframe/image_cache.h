@@ -0,0 +1,53 @@
+#ifndef IMAGE_CACHE_H
+#define IMAGE_CACHE_H
+
+#include "config.h"
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace ygo {
+
+#define IMAGE_CACHE_DIR		"textures/scaled"
+#define IMAGE_CACHE_MAGIC	0x31435359 // "YSC1"
+
+// a scaled image is stored as its raw pixels behind this header, so loading it is a single read
+struct ImageCacheHeader {
+	unsigned int magic;
+	unsigned int width;
+	unsigned int height;
+	unsigned int format;
+	long long source_time;
+	long long source_size;
+};
+
+// images scaled by use_image_scale, kept on disk by source path and target size.
+// an entry is only used while the source file keeps its size and modification time.
+// the directory is bounded by image_cache_size, the entries written first are removed first
+class ImageCache {
+public:
+	static irr::video::IImage* Read(irr::video::IVideoDriver* driver, const char* file, s32 width, s32 height);
+	static void Write(const char* file, s32 width, s32 height, irr::video::IImage* image);
+	static bool Prewarm(unsigned int workers = 0);
+
+private:
+	static bool GetEntry(const char* file, s32 width, s32 height, ImageCacheHeader& header, char* path);
+	static FILE* OpenEntry(const char* file, s32 width, s32 height, ImageCacheHeader& header);
+	static unsigned long long GetLimit();
+	static void ScanEntries();
+	static bool IsFull();
+	static void AddEntry(const char* path, unsigned long long size);
+
+	typedef std::list<std::pair<std::string, unsigned long long>> EntryList;
+	static std::mutex entries_mutex;
+	static bool entries_scanned;
+	static unsigned long long entries_size;
+	// oldest first, with the index by path for entries that are written again
+	static EntryList entries;
+	static std::unordered_map<std::string, EntryList::iterator> entry_index;
+};
+
+}
+
+#endif //IMAGE_CACHE_H
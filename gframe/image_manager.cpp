@@ -1,6 +1,6 @@
 #include "image_manager.h"
+#include "image_cache.h"
 #include "game.h"
-#include <SFML/Network.hpp>
 
 namespace ygo {
 
@@ -48,30 +48,92 @@ bool ImageManager::Initial() {
 		tRank[i] = NULL;
 		tBorder[i] = NULL;
 	}
+	textureBytes = 0;
+	textureBudget = mainGame->gameConf.texture_cache_size > 0 ? (size_t)mainGame->gameConf.texture_cache_size << 20 : 0;
+	textureHits = 0;
+	textureMisses = 0;
+	textureEvictions = 0;
+	textureFrame = 0;
+	nextFetchId = 0;
+	downloadCount = 0;
+	textureFetcher.SetCacheDir("textures/cache");
+	StartLoaders();
 	return true;
 }
 void ImageManager::SetDevice(irr::IrrlichtDevice* dev) {
 	device = dev;
 	driver = dev->getVideoDriver();
+	thumbAtlas.SetDriver(driver);
 }
 void ImageManager::ClearTexture() {
-	for(auto tit = tMap.begin(); tit != tMap.end(); ++tit) {
-		if(tit->second)
-			driver->removeTexture(tit->second);
-	}
-	for(auto tit = tThumb.begin(); tit != tThumb.end(); ++tit) {
-		if(tit->second)
-			driver->removeTexture(tit->second);
-	}
-	tMap.clear();
-	tThumb.clear();
+	for(auto tit = tMap.begin(); tit != tMap.end();)
+		RemoveCachedTexture(tMap, tit++);
+	for(auto tit = tThumb.begin(); tit != tThumb.end();)
+		RemoveCachedTexture(tThumb, tit++);
+	thumbAtlas.Clear();
+	// loads still in flight belong to the old maps
+	std::lock_guard<std::mutex> lock(loadMutex);
+	loadGeneration++;
+	loadQueue.clear();
+	loadingImages[0].clear();
+	loadingImages[1].clear();
 }
 void ImageManager::RemoveTexture(int code) {
 	auto tit = tMap.find(code);
-	if(tit != tMap.end()) {
-		if(tit->second)
-			driver->removeTexture(tit->second);
-		tMap.erase(tit);
+	if(tit != tMap.end())
+		RemoveCachedTexture(tMap, tit);
+}
+TextureMap& ImageManager::GetTextureMap(int kind) {
+	if(kind == TEXTURE_MAP_THUMB)
+		return tThumb;
+	if(kind == TEXTURE_MAP_FIELD)
+		return tFields;
+	return tMap;
+}
+// every texture that was loaded goes through here; missing pictures are kept as NULL
+// outside of the LRU list, since they cost nothing
+irr::video::ITexture* ImageManager::StoreTexture(int kind, int code, irr::video::ITexture* texture) {
+	CachedTexture& entry = GetTextureMap(kind)[code];
+	entry.texture = texture;
+	entry.size = 0;
+	entry.frame = textureFrame;
+	textureMisses++;
+	if(texture) {
+		irr::core::dimension2d<u32> size = texture->getSize();
+		entry.size = size.Width * size.Height * 4;
+		textureLru.push_front(std::make_pair(kind, code));
+		entry.lru = textureLru.begin();
+		textureBytes += entry.size;
+		TrimTextures();
+	}
+	return texture;
+}
+irr::video::ITexture* ImageManager::UseTexture(CachedTexture& entry) {
+	textureHits++;
+	if(entry.texture) {
+		entry.frame = textureFrame;
+		textureLru.splice(textureLru.begin(), textureLru, entry.lru);
+	}
+	return entry.texture;
+}
+void ImageManager::RemoveCachedTexture(TextureMap& textures, TextureMap::iterator tit) {
+	if(tit->second.texture) {
+		driver->removeTexture(tit->second.texture);
+		textureBytes -= tit->second.size;
+		textureLru.erase(tit->second.lru);
+	}
+	textures.erase(tit);
+}
+// evict the least recently drawn textures until the cache fits in texture_cache_size;
+// the ones drawn in the current frame stay even when they alone go over it
+void ImageManager::TrimTextures() {
+	while(textureBudget && textureBytes > textureBudget && !textureLru.empty()) {
+		TextureMap& textures = GetTextureMap(textureLru.back().first);
+		auto tit = textures.find(textureLru.back().second);
+		if(tit->second.frame == textureFrame)
+			break;
+		RemoveCachedTexture(textures, tit);
+		textureEvictions++;
 	}
 }
 // function by Warr1024, from https://github.com/minetest/minetest/issues/2419 , modified
@@ -149,8 +211,15 @@ void imageScaleNNAA(irr::video::IImage *src, irr::video::IImage *dest)
 		}
 }
 irr::video::ITexture* ImageManager::GetTextureFromFile(char* file, s32 width, s32 height) {
+	std::lock_guard<std::mutex> lock(decodeMutex);
 	if(mainGame->gameConf.use_image_scale) {
 		irr::video::ITexture* texture;
+		irr::video::IImage* cached = ImageCache::Read(driver, file, width, height);
+		if(cached) {
+			texture = driver->addTexture(file, cached);
+			cached->drop();
+			return texture;
+		}
 		irr::video::IImage* srcimg = driver->createImageFromFile(file);
 		if(srcimg == NULL)
 			return NULL;
@@ -159,6 +228,7 @@ irr::video::ITexture* ImageManager::GetTextureFromFile(char* file, s32 width, s3
 		} else {
 			video::IImage *destimg = driver->createImage(srcimg->getColorFormat(), irr::core::dimension2d<u32>(width, height));
 			imageScaleNNAA(srcimg, destimg);
+			ImageCache::Write(file, width, height, destimg);
 			texture = driver->addTexture(file, destimg);
 			destimg->drop();
 		}
@@ -168,11 +238,18 @@ irr::video::ITexture* ImageManager::GetTextureFromFile(char* file, s32 width, s3
 		return driver->getTexture(file);
 	}
 }
-irr::video::ITexture* ImageManager::GetTexture(int code) {
+// with async a missing image is queued for the loader threads, and the thumbnail or tUnknown
+// stands in for it until UploadLoadedImages brings it in
+irr::video::ITexture* ImageManager::GetTexture(int code, bool async) {
 	if(code == 0)
 		return tUnknown;
 	auto tit = tMap.find(code);
 	if(tit == tMap.end()) {
+		if(async) {
+			RequestImage(code, false);
+			auto thumb = tThumb.find(code);
+			return (thumb != tThumb.end() && thumb->second.texture) ? thumb->second.texture : tUnknown;
+		}
 		char file[256];
 		sprintf(file, "expansions/pics/%d.jpg", code);
 		irr::video::ITexture* img = GetTextureFromFile(file, CARD_IMG_WIDTH, CARD_IMG_HEIGHT);
@@ -181,22 +258,27 @@ irr::video::ITexture* ImageManager::GetTexture(int code) {
 			img = GetTextureFromFile(file, CARD_IMG_WIDTH, CARD_IMG_HEIGHT);
 		}
 		if(img == NULL && !mainGame->gameConf.use_image_scale) {
-			tMap[code] = NULL;
+			StoreTexture(TEXTURE_MAP_CARD, code, NULL);
 			return GetTextureThumb(code);
 		}
-		tMap[code] = img;
+		StoreTexture(TEXTURE_MAP_CARD, code, img);
 		return (img == NULL) ? tUnknown : img;
 	}
-	if(tit->second)
-		return tit->second;
+	irr::video::ITexture* img = UseTexture(tit->second);
+	if(img)
+		return img;
 	else
-		return mainGame->gameConf.use_image_scale ? tUnknown : GetTextureThumb(code);
+		return mainGame->gameConf.use_image_scale ? tUnknown : GetTextureThumb(code, async);
 }
-irr::video::ITexture* ImageManager::GetTextureThumb(int code) {
+irr::video::ITexture* ImageManager::GetTextureThumb(int code, bool async) {
 	if(code == 0)
 		return tUnknown;
 	auto tit = tThumb.find(code);
 	if(tit == tThumb.end()) {
+		if(async) {
+			RequestImage(code, true);
+			return tUnknown;
+		}
 		char file[256];
 		sprintf(file, "expansions/pics/thumbnail/%d.jpg", code);
 		irr::video::ITexture* img = GetTextureFromFile(file, CARD_THUMB_WIDTH, CARD_THUMB_HEIGHT);
@@ -212,14 +294,171 @@ irr::video::ITexture* ImageManager::GetTextureThumb(int code) {
 				img = GetTextureFromFile(file, CARD_THUMB_WIDTH, CARD_THUMB_HEIGHT);
 			}
 		}
-		tThumb[code] = img;
+		StoreTexture(TEXTURE_MAP_THUMB, code, img);
 		return (img == NULL) ? tUnknown : img;
 	}
-	if(tit->second)
-		return tit->second;
+	irr::video::ITexture* img = UseTexture(tit->second);
+	if(img)
+		return img;
 	else
 		return tUnknown;
 }
+void ImageManager::StartLoaders() {
+	loadGeneration = 0;
+	stopLoading = false;
+	for(int i = 0; i < IMAGE_LOAD_THREADS; ++i)
+		loaders.emplace_back(&ImageManager::LoaderThread, this);
+}
+void ImageManager::StopLoaders() {
+	{
+		std::lock_guard<std::mutex> lock(loadMutex);
+		stopLoading = true;
+	}
+	loadCond.notify_all();
+	for(auto& loader : loaders)
+		loader.join();
+	loaders.clear();
+	for(auto& load : loadedImages) {
+		if(load.image)
+			load.image->drop();
+	}
+	loadedImages.clear();
+	loadQueue.clear();
+	textureFetcher.Stop();
+	for(auto& fetching : fetchingTextures)
+		delete fetching.second;
+	fetchingTextures.clear();
+}
+// turn at most IMAGE_UPLOADS_PER_FRAME decoded images into textures; called once per frame
+void ImageManager::UploadLoadedImages() {
+	textureFrame++;
+	TrimTextures();
+	std::vector<ImageLoad> uploads;
+	{
+		std::lock_guard<std::mutex> lock(loadMutex);
+		size_t count = std::min(loadedImages.size(), (size_t)IMAGE_UPLOADS_PER_FRAME);
+		uploads.assign(loadedImages.begin(), loadedImages.begin() + count);
+		loadedImages.erase(loadedImages.begin(), loadedImages.begin() + count);
+	}
+	for(auto& load : uploads) {
+		auto& textures = load.thumb ? tThumb : tMap;
+		if(load.generation != loadGeneration) {
+			if(load.image)
+				load.image->drop();
+			continue;
+		}
+		loadingImages[load.thumb].erase(load.code);
+		// a synchronous call got there first
+		if(textures.count(load.code)) {
+			if(load.image)
+				load.image->drop();
+			continue;
+		}
+		irr::video::ITexture* texture = NULL;
+		if(load.image) {
+			texture = driver->addTexture(load.file, load.image);
+			load.image->drop();
+		}
+		StoreTexture(load.thumb ? TEXTURE_MAP_THUMB : TEXTURE_MAP_CARD, load.code, texture);
+	}
+}
+void ImageManager::RequestImage(int code, bool thumb) {
+	if(!loadingImages[thumb].insert(code).second)
+		return;
+	ImageLoad load;
+	load.code = code;
+	load.thumb = thumb;
+	load.generation = loadGeneration;
+	load.file[0] = 0;
+	load.image = NULL;
+	{
+		std::lock_guard<std::mutex> lock(loadMutex);
+		loadQueue.push_back(load);
+	}
+	loadCond.notify_one();
+}
+// the newest request goes first: it is the card that is on screen right now
+void ImageManager::LoaderThread() {
+	while(true) {
+		ImageLoad load;
+		{
+			std::unique_lock<std::mutex> lock(loadMutex);
+			loadCond.wait(lock, [this]() { return stopLoading || !loadQueue.empty(); });
+			if(stopLoading)
+				return;
+			load = loadQueue.back();
+			loadQueue.pop_back();
+		}
+		load.image = LoadCardImage(load.code, load.thumb, load.file);
+		std::lock_guard<std::mutex> lock(loadMutex);
+		loadedImages.push_back(load);
+	}
+}
+// the same search order as GetTexture and GetTextureThumb
+irr::video::IImage* ImageManager::LoadCardImage(int code, bool thumb, char* file) {
+	irr::video::IImage* img;
+	if(!thumb) {
+		sprintf(file, "expansions/pics/%d.jpg", code);
+		img = LoadImage(file, CARD_IMG_WIDTH, CARD_IMG_HEIGHT);
+		if(img == NULL) {
+			sprintf(file, "pics/%d.jpg", code);
+			img = LoadImage(file, CARD_IMG_WIDTH, CARD_IMG_HEIGHT);
+		}
+		return img;
+	}
+	sprintf(file, "expansions/pics/thumbnail/%d.jpg", code);
+	img = LoadImage(file, CARD_THUMB_WIDTH, CARD_THUMB_HEIGHT);
+	if(img == NULL) {
+		sprintf(file, "pics/thumbnail/%d.jpg", code);
+		img = LoadImage(file, CARD_THUMB_WIDTH, CARD_THUMB_HEIGHT);
+	}
+	if(img == NULL && mainGame->gameConf.use_image_scale) {
+		sprintf(file, "expansions/pics/%d.jpg", code);
+		img = LoadImage(file, CARD_THUMB_WIDTH, CARD_THUMB_HEIGHT);
+		if(img == NULL) {
+			sprintf(file, "pics/%d.jpg", code);
+			img = LoadImage(file, CARD_THUMB_WIDTH, CARD_THUMB_HEIGHT);
+		}
+	}
+	return img;
+}
+// runs on a loader thread: the file is read with stdio and decoded from memory,
+// so that the irrlicht file archives are never read off the main thread
+irr::video::IImage* ImageManager::LoadImage(const char* file, s32 width, s32 height) {
+	if(mainGame->gameConf.use_image_scale) {
+		irr::video::IImage* cached = ImageCache::Read(driver, file, width, height);
+		if(cached)
+			return cached;
+	}
+	FILE* fp = fopen(file, "rb");
+	if(!fp)
+		return NULL;
+	std::vector<char> buffer;
+	char block[0x4000];
+	size_t len;
+	while((len = fread(block, 1, sizeof(block), fp)) > 0)
+		buffer.insert(buffer.end(), block, block + len);
+	fclose(fp);
+	if(buffer.empty())
+		return NULL;
+	IReadFile* reader = device->getFileSystem()->createMemoryReadFile(buffer.data(), buffer.size(), file, false);
+	irr::video::IImage* srcimg;
+	{
+		// the irrlicht jpeg loader keeps the file name in a static member
+		std::lock_guard<std::mutex> lock(decodeMutex);
+		srcimg = driver->createImageFromFile(reader);
+	}
+	reader->drop();
+	if(srcimg == NULL)
+		return NULL;
+	if(!mainGame->gameConf.use_image_scale || srcimg->getDimension() == irr::core::dimension2d<u32>(width, height))
+		return srcimg;
+	irr::video::IImage* destimg = driver->createImage(srcimg->getColorFormat(), irr::core::dimension2d<u32>(width, height));
+	imageScaleNNAA(srcimg, destimg);
+	ImageCache::Write(file, width, height, destimg);
+	srcimg->drop();
+	return destimg;
+}
 irr::video::ITexture* ImageManager::GetTextureField(int code) {
 	if(code == 0)
 		return NULL;
@@ -240,21 +479,18 @@ irr::video::ITexture* ImageManager::GetTextureField(int code) {
 			sprintf(file, "pics/field/%d.jpg", code);
 			img = GetTextureFromFile(file, 512, 512);
 			if(img == NULL) {
-				tFields[code] = NULL;
+				StoreTexture(TEXTURE_MAP_FIELD, code, NULL);
 				return NULL;
 			} else {
-				tFields[code] = img;
+				StoreTexture(TEXTURE_MAP_FIELD, code, img);
 				return img;
 			}
 		} else {
-			tFields[code] = img;
+			StoreTexture(TEXTURE_MAP_FIELD, code, img);
 			return img;
 		}
 	}
-	if(tit->second)
-		return tit->second;
-	else
-		return NULL;
+	return UseTexture(tit->second);
 }
 void ImageManager::LoadTexture(TextureType type, int textureId, int player, wchar_t* site, wchar_t* dir)
 {
@@ -266,7 +502,12 @@ void ImageManager::LoadTexture(TextureType type, int textureId, int player, wcha
 	std::wcstombs(sleeve->filename, dir, 256);
 	char *ext = type == SLEEVE ? "jpg" : "png";
 	sprintf(sleeve->fakename, "dl%d%d.%s", type, player, ext);
-	pendingTextures.push_back(sleeve);
+	if(type == SLEEVE || type == AVATAR) {
+		int id = nextFetchId++;
+		fetchingTextures[id] = sleeve;
+		textureFetcher.Fetch(id, sleeve->hostname, sleeve->filename);
+	} else
+		pendingTextures.push_back(sleeve);
 }
 void ImageManager::LoadPendingTextures()
 {
@@ -274,19 +515,35 @@ void ImageManager::LoadPendingTextures()
 	{
 		TextureData *textureData(pendingTextures.back());
 		pendingTextures.pop_back();
+		std::unique_lock<std::mutex> lock(decodeMutex);
 		ITexture *texture = ReadTexture(textureData);
+		lock.unlock();
 		if (texture)
 			ApplyTexture(textureData, texture);
 		delete textureData;
 	}
+	FetchResult result;
+	while (textureFetcher.Poll(result))
+	{
+		auto fit = fetchingTextures.find(result.id);
+		if (fit == fetchingTextures.end())
+			continue;
+		std::unique_lock<std::mutex> lock(decodeMutex);
+		ITexture *texture = DownloadTexture(fit->second, result.body);
+		lock.unlock();
+		if (texture)
+			ApplyTexture(fit->second, texture);
+		if (result.last)
+		{
+			delete fit->second;
+			fetchingTextures.erase(fit);
+		}
+	}
 }
 ITexture* ImageManager::ReadTexture(TextureData *textureData)
 {
 	switch (textureData->type)
 	{
-	case SLEEVE:
-	case AVATAR:
-		return DownloadTexture(textureData);
 	case RANK:
 		return GetRankTexture(textureData->textureId);
 	case BORDER:
@@ -295,21 +552,18 @@ ITexture* ImageManager::ReadTexture(TextureData *textureData)
 		return NULL;
 	}
 }
-ITexture* ImageManager::DownloadTexture(TextureData *textureData)
+// the driver caches textures by name, so every download gets its own
+ITexture* ImageManager::DownloadTexture(TextureData *textureData, const std::vector<char>& body)
 {
-	sf::Http::Request request(textureData->filename, sf::Http::Request::Get);
-	sf::Http http(textureData->hostname);
-	sf::Http::Response response = http.sendRequest(request);
-
-	if (response.getStatus() == sf::Http::Response::Ok)
-	{
-		std::string *body = new std::string(response.getBody());
-		void *memory = (void *)body->c_str();
-		IReadFile *f = device->getFileSystem()->createMemoryReadFile(memory, body->size(), textureData->fakename, false);
-		ITexture *texture = driver->getTexture(f);
-		return texture;
-	}
-	return NULL;
+	if (body.empty())
+		return NULL;
+	char name[64];
+	const char *ext = strrchr(textureData->fakename, '.');
+	sprintf(name, "dl%d%d_%d%s", textureData->type, textureData->player, downloadCount++, ext ? ext : "");
+	IReadFile *f = device->getFileSystem()->createMemoryReadFile((void *)body.data(), body.size(), name, false);
+	ITexture *texture = driver->getTexture(f);
+	f->drop();
+	return texture;
 }
 irr::video::ITexture* ImageManager::GetRankTexture(int rank) {
 	if (rank == 0)
@@ -344,11 +598,15 @@ void ImageManager::ApplyTexture(TextureData *textureData, ITexture *texture)
 	{
 	case SLEEVE:
 		if (textureData->player >= 0 && textureData->player < 2)
-			tCover[textureData->player] = texture;
+			ReplaceDownloadedTexture(tCover[textureData->player], texture);
+		else
+			driver->removeTexture(texture);
 		break;
 	case AVATAR:
 		if (textureData->player >= 0 && textureData->player < 4)
-			tAvatar[textureData->player] = texture;
+			ReplaceDownloadedTexture(tAvatar[textureData->player], texture);
+		else
+			driver->removeTexture(texture);
 		break;
 	case RANK:
 		if (textureData->player >= 0 && textureData->player < 4)
@@ -360,4 +618,16 @@ void ImageManager::ApplyTexture(TextureData *textureData, ITexture *texture)
 		break;
 	}
 }
+// every download is a texture of its own, so the one it replaces is dropped from the driver
+void ImageManager::ReplaceDownloadedTexture(irr::video::ITexture*& slot, ITexture *texture)
+{
+	auto dit = downloadedTextures.find(slot);
+	if (dit != downloadedTextures.end())
+	{
+		downloadedTextures.erase(dit);
+		driver->removeTexture(slot);
+	}
+	slot = texture;
+	downloadedTextures.insert(texture);
+}
 }
\ No newline at end of file
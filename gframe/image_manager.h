@@ -3,10 +3,25 @@
 
 #include "config.h"
 #include "data_manager.h"
+#include "thumb_atlas.h"
+#include "texture_fetcher.h"
 #include <unordered_map>
+#include <unordered_set>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 
 namespace ygo {
-	
+
+#define IMAGE_LOAD_THREADS			2
+#define IMAGE_UPLOADS_PER_FRAME		8
+
+#define TEXTURE_MAP_CARD	0
+#define TEXTURE_MAP_THUMB	1
+#define TEXTURE_MAP_FIELD	2
+
 enum TextureType
 {
 	SLEEVE = 0,
@@ -25,6 +40,24 @@ struct TextureData
 	char fakename[32];
 };
 
+struct CachedTexture
+{
+	irr::video::ITexture* texture;
+	unsigned int size;
+	unsigned int frame;
+	std::list<std::pair<int, int>>::iterator lru;
+};
+typedef std::unordered_map<int, CachedTexture> TextureMap;
+
+struct ImageLoad
+{
+	int code;
+	bool thumb;
+	unsigned int generation;
+	char file[256];
+	irr::video::IImage* image;
+};
+
 class ImageManager {
 public:
 	bool Initial();
@@ -35,14 +68,24 @@ public:
 	void LoadTexture(TextureType type, int textureId, int player, wchar_t* site, wchar_t* dir);
 	void LoadPendingTextures();
 	
+	void StartLoaders();
+	void StopLoaders();
+	void UploadLoadedImages();
+
 	irr::video::ITexture* GetTextureFromFile(char* file, s32 width, s32 height);
-	irr::video::ITexture* GetTexture(int code);
-	irr::video::ITexture* GetTextureThumb(int code);
+	irr::video::ITexture* GetTexture(int code, bool async = false);
+	irr::video::ITexture* GetTextureThumb(int code, bool async = false);
 	irr::video::ITexture* GetTextureField(int code);
 
-	std::unordered_map<int, irr::video::ITexture*> tMap;
-	std::unordered_map<int, irr::video::ITexture*> tThumb;
-	std::unordered_map<int, irr::video::ITexture*> tFields;
+	TextureMap tMap;
+	TextureMap tThumb;
+	TextureMap tFields;
+	ThumbAtlas thumbAtlas;
+	size_t textureBytes;
+	size_t textureBudget;
+	unsigned int textureHits;
+	unsigned int textureMisses;
+	unsigned int textureEvictions;
 	irr::IrrlichtDevice* device;
 	irr::video::IVideoDriver* driver;
 	irr::video::ITexture* tCover[2];
@@ -75,15 +118,47 @@ public:
 
 private:
 	ITexture* ReadTexture(TextureData *textureData);
-	ITexture* DownloadTexture(TextureData *textureData);
+	ITexture* DownloadTexture(TextureData *textureData, const std::vector<char>& body);
 	irr::video::ITexture* GetRankTexture(int rank);
 	irr::video::ITexture* GetBorderTexture(TextureData *textureData);
 	void ApplyTexture(TextureData *textureData, ITexture *texture);
+	void ReplaceDownloadedTexture(irr::video::ITexture*& slot, ITexture *texture);
 	std::vector<TextureData *> pendingTextures;
+	// sleeves and avatars being downloaded, by fetch id; kept until the last result, so that a revalidated copy is applied again
+	std::unordered_map<int, TextureData *> fetchingTextures;
+	// downloaded textures in tCover and tAvatar, removed from the driver when they are replaced
+	std::unordered_set<irr::video::ITexture *> downloadedTextures;
+	TextureFetcher textureFetcher;
+	int nextFetchId;
+	int downloadCount;
+
+	TextureMap& GetTextureMap(int kind);
+	irr::video::ITexture* StoreTexture(int kind, int code, irr::video::ITexture* texture);
+	irr::video::ITexture* UseTexture(CachedTexture& entry);
+	void RemoveCachedTexture(TextureMap& textures, TextureMap::iterator tit);
+	void TrimTextures();
+	std::list<std::pair<int, int>> textureLru;
+	unsigned int textureFrame;
+
+	void RequestImage(int code, bool thumb);
+	void LoaderThread();
+	irr::video::IImage* LoadCardImage(int code, bool thumb, char* file);
+	irr::video::IImage* LoadImage(const char* file, s32 width, s32 height);
+	std::unordered_set<int> loadingImages[2];
+	std::deque<ImageLoad> loadQueue;
+	std::vector<ImageLoad> loadedImages;
+	std::vector<std::thread> loaders;
+	std::mutex loadMutex;
+	std::mutex decodeMutex;
+	std::condition_variable loadCond;
+	unsigned int loadGeneration;
+	bool stopLoading;
 };
 
 extern ImageManager imageManager;
 
+void imageScaleNNAA(irr::video::IImage *src, irr::video::IImage *dest);
+
 }
 
 #endif // IMAGEMANAGER_H
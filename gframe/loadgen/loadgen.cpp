@@ -0,0 +1,819 @@
+#include "../config.h"
+#include "../network.h"
+#include <signal.h>
+#ifndef _WIN32
+#include <netinet/tcp.h>
+#endif
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+const unsigned short PRO_VERSION = 0x133D; // the version of netserver.cpp
+
+namespace ygo {
+
+#define LOADGEN_RETRY_MAX	8 // answers the engine refused in a row before the client surrenders
+#define LOADGEN_RESTART_DELAY	1 // seconds before a failed room is tried again
+
+struct LoadRoom;
+
+struct LoadClient {
+	LoadRoom* room;
+	bufferevent* bev;
+	int index; // 0 creates the room, 1 joins it
+	int player; // in the duel, from MSG_START
+	std::vector<char> prompt; // answered again after MSG_RETRY
+	int retries;
+};
+
+struct LoadRoom {
+	LoadClient clients[2];
+	unsigned int id;
+	unsigned int gameid;
+	bool ready[2];
+	bool starting;
+	bool dueling;
+	unsigned long long response_time; // when the last response was sent, 0 once a prompt followed it
+	const std::vector<int>* decks[2];
+};
+
+// synthetic duelists for a NetServer in multi-room mode: every room is created and joined
+// by two clients, which submit stock decks and answer every prompt of the engine at random
+class LoadGen {
+public:
+	static int LoadDecks(const char* path);
+	static bool Run(const char* host, unsigned short port, unsigned int rooms, unsigned int seconds, unsigned int interval, int pid);
+
+private:
+	static bool LoadDeck(const char* file);
+	static void StartRoom(LoadRoom* room);
+	static bool Connect(LoadClient* client);
+	static void CloseRoom(LoadRoom* room, bool failed);
+	static void OnRestart(evutil_socket_t fd, short events, void* arg);
+	static void ClientRead(bufferevent* bev, void* ctx);
+	static void ClientEvent(bufferevent* bev, short events, void* ctx);
+	static bool HandlePacket(LoadClient* client, char* data, unsigned int len);
+	static void HandleMessage(LoadClient* client, char* msg, unsigned int len);
+	static bool Answer(LoadClient* client, char* msg, std::vector<unsigned char>& resp);
+	static void SendPacket(LoadClient* client, unsigned char proto, const void* data, unsigned int len);
+	static void SendDeck(LoadClient* client);
+	static void OnReport(evutil_socket_t fd, short events, void* arg);
+	static void OnStop(evutil_socket_t fd, short events, void* arg);
+	static void Report(FILE* fp);
+	static double Percentile(std::vector<unsigned int>& values, unsigned int percent);
+	static int Random(int count) {
+		return std::uniform_int_distribution<int>(0, count - 1)(rnd);
+	}
+	static unsigned long long Micros() {
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+	static unsigned int ReadRSS(int pid);
+
+	static event_base* base;
+	static sockaddr_in server_addr;
+	static std::vector<std::vector<int>> decks;
+	static std::vector<LoadRoom*> load_rooms;
+	static std::mt19937 rnd;
+	static std::vector<unsigned int> latencies; // response to next prompt, microseconds
+	static size_t interval_start;
+	static unsigned int duels;
+	static unsigned int interval_duels;
+	static unsigned int failures;
+	static unsigned int surrenders;
+	static unsigned long long start_time;
+	static unsigned long long report_time;
+	static unsigned int peak_rss;
+	static int server_pid;
+};
+
+event_base* LoadGen::base = 0;
+sockaddr_in LoadGen::server_addr;
+std::vector<std::vector<int>> LoadGen::decks;
+std::vector<LoadRoom*> LoadGen::load_rooms;
+std::mt19937 LoadGen::rnd;
+std::vector<unsigned int> LoadGen::latencies;
+size_t LoadGen::interval_start = 0;
+unsigned int LoadGen::duels = 0;
+unsigned int LoadGen::interval_duels = 0;
+unsigned int LoadGen::failures = 0;
+unsigned int LoadGen::surrenders = 0;
+unsigned long long LoadGen::start_time = 0;
+unsigned long long LoadGen::report_time = 0;
+unsigned int LoadGen::peak_rss = 0;
+int LoadGen::server_pid = 0;
+
+// a .ydk file, or every .ydk in a directory
+int LoadGen::LoadDecks(const char* path) {
+	if(!LoadDeck(path)) {
+		std::string dir = path;
+		FileSystem::TraversalDir(path, [&dir](const char* name, bool isdir) {
+			const char* ext = strrchr(name, '.');
+			if(!isdir && ext && !mystrncasecmp(ext, ".ydk", 4))
+				LoadDeck((dir + "/" + name).c_str());
+		});
+	}
+	return decks.size();
+}
+// the main and extra deck come first, then the side deck after a 0
+bool LoadGen::LoadDeck(const char* file) {
+	const char* ext = strrchr(file, '.');
+	if(!ext || mystrncasecmp(ext, ".ydk", 4))
+		return false;
+	FILE* fp = fopen(file, "r");
+	if(!fp)
+		return false;
+	std::vector<int> main, side;
+	bool is_side = false;
+	char linebuf[256];
+	while(fgets(linebuf, sizeof(linebuf), fp)) {
+		if(linebuf[0] == '!') {
+			is_side = true;
+			continue;
+		}
+		if(linebuf[0] < '0' || linebuf[0] > '9')
+			continue;
+		int code = atoi(linebuf);
+		if(code)
+			(is_side ? side : main).push_back(code);
+	}
+	fclose(fp);
+	if(main.empty())
+		return false;
+	main.push_back(0);
+	main.insert(main.end(), side.begin(), side.end());
+	decks.push_back(main);
+	return true;
+}
+bool LoadGen::Run(const char* host, unsigned short port, unsigned int rooms, unsigned int seconds, unsigned int interval, int pid) {
+	memset(&server_addr, 0, sizeof(server_addr));
+	server_addr.sin_family = AF_INET;
+	server_addr.sin_port = htons(port);
+	if(inet_pton(AF_INET, host, &server_addr.sin_addr) != 1) {
+		addrinfo hints, *result;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+		if(getaddrinfo(host, NULL, &hints, &result) != 0)
+			return false;
+		server_addr.sin_addr = ((sockaddr_in*)result->ai_addr)->sin_addr;
+		freeaddrinfo(result);
+	}
+	rnd.seed((unsigned int)time(0));
+	server_pid = pid;
+	base = event_base_new();
+	event* report_ev = event_new(base, -1, EV_PERSIST, OnReport, 0);
+	timeval report_tv = { (long)interval, 0 };
+	event_add(report_ev, &report_tv);
+	event* stop_ev = event_new(base, -1, EV_TIMEOUT, OnStop, 0);
+	timeval stop_tv = { (long)seconds, 0 };
+	if(seconds)
+		event_add(stop_ev, &stop_tv);
+	event* signal_ev = evsignal_new(base, SIGINT, OnStop, 0);
+	event_add(signal_ev, 0);
+	printf("%6s %6s %6s %10s %9s %9s %8s %8s\n", "time", "rooms", "duels", "duels/min", "p50 ms", "p99 ms", "failed", "rss MB");
+	start_time = report_time = Micros();
+	for(unsigned int i = 0; i < rooms; ++i) {
+		LoadRoom* room = new LoadRoom;
+		room->id = i;
+		for(int j = 0; j < 2; ++j) {
+			room->clients[j].room = room;
+			room->clients[j].bev = 0;
+			room->clients[j].index = j;
+		}
+		load_rooms.push_back(room);
+		StartRoom(room);
+	}
+	event_base_dispatch(base);
+	for(auto room : load_rooms) {
+		for(int j = 0; j < 2; ++j) {
+			if(room->clients[j].bev)
+				bufferevent_free(room->clients[j].bev);
+		}
+		delete room;
+	}
+	load_rooms.clear();
+	event_free(report_ev);
+	event_free(stop_ev);
+	event_free(signal_ev);
+	event_base_free(base);
+	double total = (Micros() - start_time) / 1e6;
+	printf("\n%u duels in %.0f s, %.1f duels/min\n", duels, total, total > 0 ? duels * 60 / total : 0);
+	printf("response to next prompt over %u prompts: p50 %.2f ms, p99 %.2f ms\n", (unsigned int)latencies.size(), Percentile(latencies, 50), Percentile(latencies, 99));
+	printf("%u rooms failed, %u duels surrendered", failures, surrenders);
+	if(peak_rss)
+		printf(", peak server rss %.1f MB", peak_rss / 1024.0);
+	printf("\n");
+	return true;
+}
+// the host connects first; the guest follows when STOC_CREATE_GAME names the room
+void LoadGen::StartRoom(LoadRoom* room) {
+	room->gameid = 0;
+	room->ready[0] = room->ready[1] = false;
+	room->starting = false;
+	room->dueling = false;
+	room->response_time = 0;
+	for(int j = 0; j < 2; ++j) {
+		room->decks[j] = &decks[Random(decks.size())];
+		room->clients[j].player = j;
+		room->clients[j].prompt.clear();
+		room->clients[j].retries = 0;
+	}
+	LoadClient* host = &room->clients[0];
+	if(!Connect(host)) {
+		CloseRoom(room, true);
+		return;
+	}
+	CTOS_PlayerInfo cspi;
+	wchar_t name[20];
+	myswprintf(name, L"load%u", room->id);
+	BufferIO::CopyWStr(name, cspi.name, 20);
+	SendPacket(host, CTOS_PLAYER_INFO, &cspi, sizeof(cspi));
+	CTOS_CreateGame cscg;
+	memset(&cscg, 0, sizeof(cscg));
+	cscg.info.rule = 2;
+	cscg.info.mode = MODE_SINGLE;
+	cscg.info.duel_rule = DEFAULT_DUEL_RULE;
+	cscg.info.no_check_deck = true;
+	cscg.info.no_shuffle_deck = false;
+	cscg.info.start_lp = 8000;
+	cscg.info.start_hand = 5;
+	cscg.info.draw_count = 1;
+	cscg.info.time_limit = 180;
+	myswprintf(name, L"load%u", room->id);
+	BufferIO::CopyWStr(name, cscg.name, 20);
+	myswprintf(name, L"pass%u", room->id);
+	BufferIO::CopyWStr(name, cscg.pass, 20);
+	SendPacket(host, CTOS_CREATE_GAME, &cscg, sizeof(cscg));
+}
+bool LoadGen::Connect(LoadClient* client) {
+	client->bev = bufferevent_socket_new(base, -1, BEV_OPT_CLOSE_ON_FREE);
+	bufferevent_setcb(client->bev, ClientRead, NULL, ClientEvent, client);
+	bufferevent_enable(client->bev, EV_READ);
+	if(bufferevent_socket_connect(client->bev, (sockaddr*)&server_addr, sizeof(server_addr)) < 0)
+		return false;
+	// a response goes out at once, so that the latency measured is the server's and not Nagle's
+	int nodelay = 1;
+	setsockopt(bufferevent_getfd(client->bev), IPPROTO_TCP, TCP_NODELAY, (const char*)&nodelay, sizeof(nodelay));
+	return true;
+}
+// a finished room starts over at once, a failed one after a pause
+void LoadGen::CloseRoom(LoadRoom* room, bool failed) {
+	for(int j = 0; j < 2; ++j) {
+		if(room->clients[j].bev) {
+			bufferevent_free(room->clients[j].bev);
+			room->clients[j].bev = 0;
+		}
+	}
+	if(failed)
+		failures++;
+	timeval timeout = { failed ? LOADGEN_RESTART_DELAY : 0, 0 };
+	event_base_once(base, -1, EV_TIMEOUT, OnRestart, room, &timeout);
+}
+void LoadGen::OnRestart(evutil_socket_t fd, short events, void* arg) {
+	StartRoom((LoadRoom*)arg);
+}
+void LoadGen::ClientRead(bufferevent* bev, void* ctx) {
+	LoadClient* client = (LoadClient*)ctx;
+	evbuffer* input = bufferevent_get_input(bev);
+	char data[0x10000];
+	while(true) {
+		size_t len = evbuffer_get_length(input);
+		if(len < 2)
+			return;
+		unsigned short packet_len;
+		evbuffer_copyout(input, &packet_len, 2);
+		if(len < (size_t)packet_len + 2)
+			return;
+		evbuffer_remove(input, data, packet_len + 2);
+		if(packet_len && !HandlePacket(client, data + 2, packet_len))
+			return;
+	}
+}
+void LoadGen::ClientEvent(bufferevent* bev, short events, void* ctx) {
+	LoadClient* client = (LoadClient*)ctx;
+	if(events & (BEV_EVENT_EOF | BEV_EVENT_ERROR))
+		CloseRoom(client->room, true);
+}
+// false once the room is closed and the connection is gone
+bool LoadGen::HandlePacket(LoadClient* client, char* data, unsigned int len) {
+	LoadRoom* room = client->room;
+	unsigned char proto = data[0];
+	char* pdata = data + 1;
+	switch(proto) {
+	case STOC_GAME_MSG: {
+		HandleMessage(client, pdata, len - 1);
+		break;
+	}
+	case STOC_ERROR_MSG: {
+		STOC_ErrorMsg* pkt = (STOC_ErrorMsg*)pdata;
+		fprintf(stderr, "room %u: error %d, code %x\n", room->id, pkt->msg, pkt->code);
+		CloseRoom(room, true);
+		return false;
+	}
+	case STOC_CREATE_GAME: {
+		STOC_CreateGame* pkt = (STOC_CreateGame*)pdata;
+		room->gameid = pkt->gameid;
+		LoadClient* guest = &room->clients[1];
+		if(!Connect(guest)) {
+			CloseRoom(room, true);
+			return false;
+		}
+		CTOS_PlayerInfo cspi;
+		wchar_t name[20];
+		myswprintf(name, L"guest%u", room->id);
+		BufferIO::CopyWStr(name, cspi.name, 20);
+		SendPacket(guest, CTOS_PLAYER_INFO, &cspi, sizeof(cspi));
+		CTOS_JoinGame csjg;
+		csjg.version = PRO_VERSION;
+		csjg.gameid = room->gameid;
+		myswprintf(name, L"pass%u", room->id);
+		BufferIO::CopyWStr(name, csjg.pass, 20);
+		SendPacket(guest, CTOS_JOIN_GAME, &csjg, sizeof(csjg));
+		break;
+	}
+	case STOC_JOIN_GAME: {
+		SendDeck(client);
+		SendPacket(client, CTOS_HS_READY, 0, 0);
+		break;
+	}
+	case STOC_HS_PLAYER_CHANGE: {
+		STOC_HS_PlayerChange* pkt = (STOC_HS_PlayerChange*)pdata;
+		int pos = (pkt->status >> 4) & 0xf;
+		int state = pkt->status & 0xf;
+		if(pos < 2 && (state == PLAYERCHANGE_READY || state == PLAYERCHANGE_NOTREADY))
+			room->ready[pos] = state == PLAYERCHANGE_READY;
+		if(client->index == 0 && room->ready[0] && room->ready[1] && !room->starting) {
+			room->starting = true;
+			SendPacket(client, CTOS_HS_START, 0, 0);
+		}
+		break;
+	}
+	case STOC_SELECT_HAND: {
+		CTOS_HandResult cshr;
+		cshr.res = Random(3) + 1;
+		SendPacket(client, CTOS_HAND_RESULT, &cshr, sizeof(cshr));
+		break;
+	}
+	case STOC_SELECT_TP: {
+		CTOS_TPResult cstr;
+		cstr.res = Random(2);
+		SendPacket(client, CTOS_TP_RESULT, &cstr, sizeof(cstr));
+		break;
+	}
+	case STOC_DUEL_START: {
+		room->dueling = true;
+		break;
+	}
+	case STOC_TIME_LIMIT: {
+		STOC_TimeLimit* pkt = (STOC_TimeLimit*)pdata;
+		if(pkt->player == client->player)
+			SendPacket(client, CTOS_TIME_CONFIRM, 0, 0);
+		break;
+	}
+	case STOC_DUEL_END: {
+		duels++;
+		interval_duels++;
+		CloseRoom(room, false);
+		return false;
+	}
+	}
+	return true;
+}
+void LoadGen::HandleMessage(LoadClient* client, char* msg, unsigned int len) {
+	LoadRoom* room = client->room;
+	unsigned char type = msg[0];
+	if(type == MSG_START) {
+		client->player = msg[1] & 0xf;
+		return;
+	}
+	if(type == MSG_RETRY) {
+		if(client->prompt.empty())
+			return;
+		if(++client->retries > LOADGEN_RETRY_MAX) {
+			// nothing legal was found at random, the duel is given up
+			surrenders++;
+			client->prompt.clear();
+			SendPacket(client, CTOS_SURRENDER, 0, 0);
+			return;
+		}
+	} else {
+		client->prompt.assign(msg, msg + len);
+		client->retries = 0;
+	}
+	std::vector<unsigned char> resp;
+	if(!Answer(client, client->prompt.data(), resp)) {
+		client->prompt.clear();
+		return;
+	}
+	unsigned long long now = Micros();
+	if(type != MSG_RETRY && room->response_time)
+		latencies.push_back(now - room->response_time);
+	if(resp.size() > 64)
+		resp.resize(64);
+	SendPacket(client, CTOS_RESPONSE, resp.data(), resp.size());
+	room->response_time = now;
+}
+// a random response that the engine accepts, if the prompt asks for one. the engine checks
+// every answer, so the rare choice that breaks a rule not followed here ends in MSG_RETRY
+bool LoadGen::Answer(LoadClient* client, char* msg, std::vector<unsigned char>& resp) {
+	char* pbuf = msg;
+	unsigned char type = BufferIO::ReadUInt8(pbuf);
+	std::vector<int> options;
+	int value = -1;
+	bool respond_int = true;
+	switch(type) {
+	case MSG_SELECT_BATTLECMD: {
+		BufferIO::ReadInt8(pbuf);
+		int count = BufferIO::ReadUInt8(pbuf);
+		for(int i = 0; i < count; ++i)
+			options.push_back(i << 16);
+		pbuf += count * 11;
+		count = BufferIO::ReadUInt8(pbuf);
+		for(int i = 0; i < count; ++i)
+			options.push_back((i << 16) + 1);
+		pbuf += count * 8;
+		if(BufferIO::ReadInt8(pbuf))
+			options.push_back(2);
+		if(BufferIO::ReadInt8(pbuf))
+			options.push_back(3);
+		if(!options.empty())
+			value = options[Random(options.size())];
+		break;
+	}
+	case MSG_SELECT_IDLECMD: {
+		BufferIO::ReadInt8(pbuf);
+		// summon, special summon, reposition, monster set and spell set
+		for(int command = 0; command < 5; ++command) {
+			int count = BufferIO::ReadUInt8(pbuf);
+			for(int i = 0; i < count; ++i)
+				options.push_back((i << 16) + command);
+			pbuf += count * 7;
+		}
+		int count = BufferIO::ReadUInt8(pbuf);
+		for(int i = 0; i < count; ++i)
+			options.push_back((i << 16) + 5);
+		pbuf += count * 11;
+		if(BufferIO::ReadInt8(pbuf))
+			options.push_back(6);
+		if(BufferIO::ReadInt8(pbuf))
+			options.push_back(7);
+		// shuffling the hand is left out, it never moves the duel on
+		if(!options.empty())
+			value = options[Random(options.size())];
+		break;
+	}
+	case MSG_SELECT_EFFECTYN:
+	case MSG_SELECT_YESNO: {
+		value = Random(2);
+		break;
+	}
+	case MSG_SELECT_OPTION: {
+		BufferIO::ReadInt8(pbuf);
+		int count = BufferIO::ReadUInt8(pbuf);
+		value = count ? Random(count) : 0;
+		break;
+	}
+	case MSG_SELECT_CARD: {
+		BufferIO::ReadInt8(pbuf);
+		BufferIO::ReadInt8(pbuf);
+		int min = BufferIO::ReadUInt8(pbuf);
+		int max = BufferIO::ReadUInt8(pbuf);
+		int count = BufferIO::ReadUInt8(pbuf);
+		if(max > count)
+			max = count;
+		if(min > max)
+			min = max;
+		for(int i = 0; i < count; ++i)
+			options.push_back(i);
+		std::shuffle(options.begin(), options.end(), rnd);
+		int select = min + Random(max - min + 1);
+		resp.push_back(select);
+		for(int i = 0; i < select; ++i)
+			resp.push_back(options[i]);
+		respond_int = false;
+		break;
+	}
+	case MSG_SELECT_UNSELECT_CARD: {
+		BufferIO::ReadInt8(pbuf);
+		bool finishable = BufferIO::ReadInt8(pbuf) != 0;
+		bool cancelable = BufferIO::ReadInt8(pbuf) != 0;
+		pbuf += 2;
+		int count = BufferIO::ReadUInt8(pbuf);
+		if(count && !((finishable || cancelable) && Random(2))) {
+			resp.push_back(1);
+			resp.push_back(Random(count));
+			respond_int = false;
+		}
+		break;
+	}
+	case MSG_SELECT_CHAIN: {
+		BufferIO::ReadInt8(pbuf);
+		int count = BufferIO::ReadUInt8(pbuf);
+		BufferIO::ReadInt8(pbuf);
+		bool forced = BufferIO::ReadInt8(pbuf) != 0;
+		if(count && (forced || Random(2)))
+			value = Random(count);
+		break;
+	}
+	case MSG_SELECT_PLACE:
+	case MSG_SELECT_DISFIELD: {
+		int player = BufferIO::ReadInt8(pbuf);
+		int count = BufferIO::ReadUInt8(pbuf);
+		unsigned int selectable = ~(unsigned int)BufferIO::ReadInt32(pbuf);
+		if(count == 0)
+			count = 1;
+		for(int i = 0; i < 32; ++i) {
+			// the low bits of each half are the monster zones, the high ones the spell zones; the upper half is the opponent's
+			if(selectable & (1U << i))
+				options.push_back(i);
+		}
+		std::shuffle(options.begin(), options.end(), rnd);
+		for(int i = 0; i < count && i < (int)options.size(); ++i) {
+			int zone = options[i];
+			resp.push_back(zone < 16 ? player : 1 - player);
+			resp.push_back((zone & 0xf) < 8 ? LOCATION_MZONE : LOCATION_SZONE);
+			resp.push_back(zone & 0x7);
+		}
+		respond_int = false;
+		break;
+	}
+	case MSG_SELECT_POSITION: {
+		BufferIO::ReadInt8(pbuf);
+		BufferIO::ReadInt32(pbuf);
+		int positions = BufferIO::ReadUInt8(pbuf);
+		for(int i = 0; i < 4; ++i) {
+			if(positions & (1 << i))
+				options.push_back(1 << i);
+		}
+		value = options.empty() ? POS_FACEUP_ATTACK : options[Random(options.size())];
+		break;
+	}
+	case MSG_SELECT_TRIBUTE: {
+		BufferIO::ReadInt8(pbuf);
+		BufferIO::ReadInt8(pbuf);
+		int min = BufferIO::ReadUInt8(pbuf);
+		BufferIO::ReadUInt8(pbuf);
+		int count = BufferIO::ReadUInt8(pbuf);
+		std::vector<int> release(count);
+		for(int i = 0; i < count; ++i) {
+			pbuf += 7;
+			release[i] = BufferIO::ReadUInt8(pbuf);
+			options.push_back(i);
+		}
+		std::shuffle(options.begin(), options.end(), rnd);
+		resp.push_back(0);
+		int sum = 0;
+		for(int i = 0; i < count && sum < min; ++i) {
+			sum += release[options[i]];
+			resp.push_back(options[i]);
+		}
+		resp[0] = resp.size() - 1;
+		respond_int = false;
+		break;
+	}
+	case MSG_SELECT_COUNTER: {
+		BufferIO::ReadInt8(pbuf);
+		BufferIO::ReadInt16(pbuf);
+		int needed = BufferIO::ReadInt16(pbuf);
+		int count = BufferIO::ReadUInt8(pbuf);
+		std::vector<unsigned short> remove(count);
+		std::vector<int> counters(count);
+		for(int i = 0; i < count; ++i) {
+			pbuf += 7;
+			counters[i] = BufferIO::ReadInt16(pbuf);
+			options.push_back(i);
+		}
+		std::shuffle(options.begin(), options.end(), rnd);
+		for(int i = 0; i < count && needed > 0; ++i) {
+			int take = std::min(needed, counters[options[i]]);
+			remove[options[i]] = take;
+			needed -= take;
+		}
+		resp.resize(count * 2);
+		if(count)
+			memcpy(resp.data(), remove.data(), count * 2);
+		respond_int = false;
+		break;
+	}
+	case MSG_SELECT_SUM: {
+		int mode = BufferIO::ReadInt8(pbuf);
+		BufferIO::ReadInt8(pbuf);
+		int target = BufferIO::ReadInt32(pbuf);
+		int min = BufferIO::ReadUInt8(pbuf);
+		int max = BufferIO::ReadUInt8(pbuf);
+		int must_count = BufferIO::ReadUInt8(pbuf);
+		int must_sum = 0;
+		for(int i = 0; i < must_count; ++i) {
+			pbuf += 7;
+			must_sum += BufferIO::ReadInt32(pbuf) & 0xffff;
+		}
+		int count = BufferIO::ReadUInt8(pbuf);
+		std::vector<int> values(count);
+		for(int i = 0; i < count; ++i) {
+			pbuf += 7;
+			values[i] = BufferIO::ReadInt32(pbuf);
+			options.push_back(i);
+		}
+		// mode 0 wants the sum exactly, mode 1 at least the sum without a card to spare;
+		// a card counts with either of its two values
+		std::vector<int> best;
+		for(int attempt = 0; attempt < 64 && best.empty(); ++attempt) {
+			std::shuffle(options.begin(), options.end(), rnd);
+			std::vector<int> selected;
+			int sum = must_sum;
+			for(int i = 0; i < count && (int)selected.size() < max && sum < target; ++i) {
+				int v1 = values[options[i]] & 0xffff, v2 = values[options[i]] >> 16;
+				int v = (v2 && sum + v2 <= target && (sum + v1 > target || Random(2))) ? v2 : v1;
+				if(mode == 0 && sum + v > target)
+					continue;
+				selected.push_back(options[i]);
+				sum += v;
+			}
+			if((int)selected.size() >= min && (mode == 0 ? sum == target : sum >= target))
+				best.swap(selected);
+		}
+		resp.push_back(must_count + best.size());
+		resp.insert(resp.end(), must_count, 0);
+		resp.insert(resp.end(), best.begin(), best.end());
+		respond_int = false;
+		break;
+	}
+	case MSG_SORT_CARD: {
+		// the order as it is
+		break;
+	}
+	case MSG_ANNOUNCE_RACE:
+	case MSG_ANNOUNCE_ATTRIB: {
+		BufferIO::ReadInt8(pbuf);
+		int count = BufferIO::ReadUInt8(pbuf);
+		unsigned int available = BufferIO::ReadInt32(pbuf);
+		for(int i = 0; i < 32; ++i) {
+			if(available & (1U << i))
+				options.push_back(1 << i);
+		}
+		std::shuffle(options.begin(), options.end(), rnd);
+		value = 0;
+		for(int i = 0; i < count && i < (int)options.size(); ++i)
+			value |= options[i];
+		break;
+	}
+	case MSG_ANNOUNCE_CARD: {
+		// the opcodes are not evaluated here; a card of the own deck is tried, until one fits
+		const std::vector<int>& deck = *client->room->decks[client->index];
+		do {
+			value = deck[Random(deck.size())];
+		} while(!value);
+		break;
+	}
+	case MSG_ANNOUNCE_NUMBER: {
+		BufferIO::ReadInt8(pbuf);
+		int count = BufferIO::ReadUInt8(pbuf);
+		value = count ? Random(count) : 0;
+		break;
+	}
+	case MSG_ROCK_PAPER_SCISSORS: {
+		value = Random(3) + 1;
+		break;
+	}
+	default:
+		return false;
+	}
+	if(respond_int) {
+		resp.resize(4);
+		memcpy(resp.data(), &value, 4);
+	}
+	return true;
+}
+void LoadGen::SendPacket(LoadClient* client, unsigned char proto, const void* data, unsigned int len) {
+	char buffer[0x10000];
+	unsigned short packet_len = len + 1;
+	memcpy(buffer, &packet_len, 2);
+	buffer[2] = proto;
+	if(len)
+		memcpy(buffer + 3, data, len);
+	bufferevent_write(client->bev, buffer, len + 3);
+}
+// main and extra deck count, side deck count, then the codes
+void LoadGen::SendDeck(LoadClient* client) {
+	const std::vector<int>& deck = *client->room->decks[client->index];
+	std::vector<int> packet;
+	auto side = std::find(deck.begin(), deck.end(), 0);
+	packet.push_back(side - deck.begin());
+	packet.push_back(deck.end() - side - 1);
+	packet.insert(packet.end(), deck.begin(), side);
+	packet.insert(packet.end(), side + 1, deck.end());
+	SendPacket(client, CTOS_UPDATE_DECK, packet.data(), packet.size() * sizeof(int));
+}
+void LoadGen::OnReport(evutil_socket_t fd, short events, void* arg) {
+	Report(stdout);
+}
+void LoadGen::OnStop(evutil_socket_t fd, short events, void* arg) {
+	event_base_loopexit(base, 0);
+}
+// one line per interval: throughput, the latency of the prompts seen in it and the server's memory
+void LoadGen::Report(FILE* fp) {
+	unsigned long long now = Micros();
+	double elapsed = (now - report_time) / 1e6;
+	int active = 0;
+	for(auto room : load_rooms) {
+		if(room->dueling)
+			active++;
+	}
+	std::vector<unsigned int> recent(latencies.begin() + interval_start, latencies.end());
+	unsigned int rss = ReadRSS(server_pid);
+	if(rss > peak_rss)
+		peak_rss = rss;
+	fprintf(fp, "%6.0f %6d %6u %10.1f %9.2f %9.2f %8u ", (now - start_time) / 1e6, active, duels,
+	        elapsed > 0 ? interval_duels * 60 / elapsed : 0, Percentile(recent, 50), Percentile(recent, 99), failures);
+	if(rss)
+		fprintf(fp, "%8.1f\n", rss / 1024.0);
+	else
+		fprintf(fp, "%8s\n", "-");
+	fflush(fp);
+	interval_start = latencies.size();
+	interval_duels = 0;
+	report_time = now;
+}
+// milliseconds
+double LoadGen::Percentile(std::vector<unsigned int>& values, unsigned int percent) {
+	if(values.empty())
+		return 0;
+	size_t index = (values.size() - 1) * percent / 100;
+	std::nth_element(values.begin(), values.begin() + index, values.end());
+	return values[index] / 1000.0;
+}
+// kilobytes, 0 when unknown
+unsigned int LoadGen::ReadRSS(int pid) {
+	unsigned int rss = 0;
+#ifndef _WIN32
+	if(!pid)
+		return 0;
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/status", pid);
+	FILE* fp = fopen(path, "r");
+	if(!fp)
+		return 0;
+	char linebuf[256];
+	while(fgets(linebuf, sizeof(linebuf), fp)) {
+		if(sscanf(linebuf, "VmRSS: %u", &rss) == 1)
+			break;
+	}
+	fclose(fp);
+#endif
+	return rss;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+#ifdef _WIN32
+	WORD wVersionRequested;
+	WSADATA wsaData;
+	wVersionRequested = MAKEWORD(2, 2);
+	WSAStartup(wVersionRequested, &wsaData);
+#else
+	signal(SIGPIPE, SIG_IGN);
+#endif //_WIN32
+	const char* host = "127.0.0.1";
+	unsigned short port = 7911;
+	unsigned int rooms = 10;
+	unsigned int seconds = 60;
+	unsigned int interval = 10;
+	const char* deck_path = "deck";
+	int pid = 0;
+	for(int i = 1; i < argc; ++i) {
+		if(!strcmp(argv[i], "-h") && i + 1 < argc) {
+			host = argv[++i];
+		} else if(!strcmp(argv[i], "-p") && i + 1 < argc) {
+			port = atoi(argv[++i]);
+		} else if(!strcmp(argv[i], "-n") && i + 1 < argc) {
+			rooms = atoi(argv[++i]);
+		} else if(!strcmp(argv[i], "-t") && i + 1 < argc) {
+			seconds = atoi(argv[++i]);
+		} else if(!strcmp(argv[i], "-i") && i + 1 < argc) {
+			interval = atoi(argv[++i]);
+		} else if(!strcmp(argv[i], "-d") && i + 1 < argc) {
+			deck_path = argv[++i];
+		} else if(!strcmp(argv[i], "--pid") && i + 1 < argc) {
+			pid = atoi(argv[++i]);
+		} else {
+			fprintf(stderr, "usage: %s [-h host] [-p port] [-n rooms] [-t seconds] [-i interval] [-d deck file or dir] [--pid server pid]\n", argv[0]);
+			return 1;
+		}
+	}
+	if(!interval)
+		interval = 10;
+	if(!ygo::LoadGen::LoadDecks(deck_path)) {
+		fprintf(stderr, "No deck found in %s\n", deck_path);
+		return 1;
+	}
+	if(!ygo::LoadGen::Run(host, port, rooms, seconds, interval, pid)) {
+		fprintf(stderr, "Unknown host %s\n", host);
+		return 1;
+	}
+#ifdef _WIN32
+	WSACleanup();
+#endif //_WIN32
+	return 0;
+}
@@ -0,0 +1,13 @@
+project "ygoloadgen"
+    kind "ConsoleApp"
+
+    defines { "YGOPRO_SERVER_MODE" }
+    files { "*.cpp" }
+    includedirs { "../../ocgcore" }
+    links { "event" }
+
+    configuration "windows"
+        includedirs { "../../event/include", "../../sqlite3" }
+        links { "ws2_32" }
+    configuration "not vs*"
+        buildoptions { "-std=c++14", "-fno-rtti" }
@@ -2192,6 +2192,20 @@ SRes LzmaEnc_Encode(CLzmaEncHandle pp, ISeqOutStream *outStream, ISeqInStream *i
   return LzmaEnc_Encode2((CLzmaEnc *)pp, progress);
 }
 
+SRes LzmaEnc_PrepareStream(CLzmaEncHandle pp, ISeqOutStream *outStream, ISeqInStream *inStream,
+    ISzAlloc *alloc, ISzAlloc *allocBig)
+{
+  return LzmaEnc_Prepare(pp, outStream, inStream, alloc, allocBig);
+}
+
+SRes LzmaEnc_CodeStreamBlock(CLzmaEncHandle pp, int *finished)
+{
+  CLzmaEnc *p = (CLzmaEnc *)pp;
+  SRes res = LzmaEnc_CodeOneBlock(p, False, 0, 0);
+  *finished = p->finished;
+  return res;
+}
+
 SRes LzmaEnc_WriteProperties(CLzmaEncHandle pp, Byte *props, SizeT *size)
 {
   CLzmaEnc *p = (CLzmaEnc *)pp;
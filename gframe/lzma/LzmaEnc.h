@@ -58,6 +58,15 @@ SRes LzmaEnc_Encode(CLzmaEncHandle p, ISeqOutStream *outStream, ISeqInStream *in
 SRes LzmaEnc_MemEncode(CLzmaEncHandle p, Byte *dest, SizeT *destLen, const Byte *src, SizeT srcLen,
     int writeEndMark, ICompressProgress *progress, ISzAlloc *alloc, ISzAlloc *allocBig);
 
+/* Incremental interface: LzmaEnc_CodeStreamBlock encodes at least 32 KB of input per call,
+   or everything that is left once inStream reports its end (*finished is set then).
+   inStream must not run dry before that, so keep enough input buffered between calls.
+   Call LzmaEnc_Finish when done. */
+SRes LzmaEnc_PrepareStream(CLzmaEncHandle p, ISeqOutStream *outStream, ISeqInStream *inStream,
+    ISzAlloc *alloc, ISzAlloc *allocBig);
+SRes LzmaEnc_CodeStreamBlock(CLzmaEncHandle p, int *finished);
+void LzmaEnc_Finish(CLzmaEncHandle p);
+
 /* ---------- One Call Interface ---------- */
 
 /* LzmaEncode
@@ -2,6 +2,8 @@
 #include "single_duel.h"
 #include "tag_duel.h"
 
+const unsigned short PRO_VERSION = 0x133D;
+
 namespace ygo {
 std::unordered_map<bufferevent*, DuelPlayer> NetServer::users;
 unsigned short NetServer::server_port = 0;
@@ -9,16 +11,110 @@ event_base* NetServer::net_evbase = 0;
 event* NetServer::broadcast_ev = 0;
 evconnlistener* NetServer::listener = 0;
 DuelMode* NetServer::duel_mode = 0;
-char NetServer::net_server_read[0x2000];
-char NetServer::net_server_write[0x2000];
-unsigned short NetServer::last_sent = 0;
+std::unordered_map<unsigned int, DuelMode*> NetServer::rooms;
+std::set<DuelMode*> NetServer::closed_rooms;
+unsigned int NetServer::next_room_id = 0;
+bool NetServer::multi_room = false;
+std::vector<event_base*> NetServer::worker_bases;
+std::unordered_map<event_base*, TimerWheel*> NetServer::timer_wheels;
+unsigned int NetServer::next_worker = 0;
+std::mutex NetServer::server_mutex;
+Signal NetServer::exit_signal;
+unsigned int NetServer::observer_delay = 0;
+std::mutex NetServer::engine_mutex;
+thread_local char NetServer::net_server_read[0x2000];
+thread_local NetPacket* NetServer::last_packet = 0;
+const size_t NetPacket::class_sizes[NET_PACKET_CLASSES] = { 0x100, 0x400, NET_PACKET_MAX };
+thread_local NetPacket* NetPacket::free_packets[NET_PACKET_CLASSES] = {};
+thread_local unsigned int NetPacket::free_count[NET_PACKET_CLASSES] = {};
+
+// a packet longer than the read buffer of the client would overflow it, so it is not sent
+NetPacket* NetPacket::Create(unsigned char proto, const void* buffer, size_t len) {
+	if(len + 3 > NET_PACKET_MAX)
+		return 0;
+	size_t size = len + 3;
+	int size_class = 0;
+	while(class_sizes[size_class] < size)
+		size_class++;
+	NetPacket* packet;
+	if(free_packets[size_class]) {
+		packet = free_packets[size_class];
+		free_packets[size_class] = packet->next_free;
+		free_count[size_class]--;
+	} else {
+		void* block = ::operator new(sizeof(NetPacket) + class_sizes[size_class]);
+		packet = new(block) NetPacket;
+		packet->size_class = size_class;
+	}
+	packet->ref_count = 1;
+	packet->size = size;
+	char* p = (char*)(packet + 1);
+	BufferIO::WriteInt16(p, 1 + len);
+	BufferIO::WriteInt8(p, proto);
+	if(len)
+		memcpy(p, buffer, len);
+	return packet;
+}
+// frees the pools of the calling thread
+void NetPacket::ClearPool() {
+	for(int i = 0; i < NET_PACKET_CLASSES; ++i) {
+		while(free_packets[i]) {
+			NetPacket* packet = free_packets[i];
+			free_packets[i] = packet->next_free;
+			packet->~NetPacket();
+			::operator delete(packet);
+		}
+		free_count[i] = 0;
+	}
+}
+// short packets are cheaper to copy than to reference
+void NetPacket::Write(bufferevent* bev) {
+	ServerStats::AddPacket(Data()[2], size);
+	if(size < SHARED_PACKET_MIN) {
+		bufferevent_write(bev, Data(), size);
+		return;
+	}
+	ref_count++;
+	evbuffer_add_reference(bufferevent_get_output(bev), Data(), size, ReleaseReference, this);
+}
+// the last reference may be dropped on another thread than the one that built the packet;
+// the buffer then goes to that thread's pool
+void NetPacket::Release() {
+	if(--ref_count)
+		return;
+	if(free_count[size_class] < NET_PACKET_POOL_MAX) {
+		next_free = free_packets[size_class];
+		free_packets[size_class] = this;
+		free_count[size_class]++;
+		return;
+	}
+	this->~NetPacket();
+	::operator delete(this);
+}
+void NetPacket::ReleaseReference(const void* data, size_t len, void* arg) {
+	((NetPacket*)arg)->Release();
+}
 
-bool NetServer::StartServer(unsigned short port) {
+bool NetServer::StartServer(unsigned short port, bool multi, unsigned int workers) {
 	if(net_evbase)
 		return false;
+	multi_room = multi;
+	exit_signal.Reset();
 	net_evbase = event_base_new();
 	if(!net_evbase)
 		return false;
+	// rooms are pinned to the worker of their creator, so workers need multi-room
+	if(multi_room) {
+		for(unsigned int i = 0; i < workers; ++i) {
+			event_base* base = event_base_new();
+			if(!base)
+				break;
+			worker_bases.push_back(base);
+		}
+	}
+	timer_wheels[net_evbase] = new TimerWheel(net_evbase);
+	for(auto wit = worker_bases.begin(); wit != worker_bases.end(); ++wit)
+		timer_wheels[*wit] = new TimerWheel(*wit);
 	sockaddr_in sin;
 	memset(&sin, 0, sizeof(sin));
 	server_port = port;
@@ -28,6 +124,12 @@ bool NetServer::StartServer(unsigned short port) {
 	listener = evconnlistener_new_bind(net_evbase, ServerAccept, NULL,
 	                                   LEV_OPT_CLOSE_ON_FREE | LEV_OPT_REUSEABLE, -1, (sockaddr*)&sin, sizeof(sin));
 	if(!listener) {
+		for(auto tit = timer_wheels.begin(); tit != timer_wheels.end(); ++tit)
+			delete tit->second;
+		timer_wheels.clear();
+		for(auto wit = worker_bases.begin(); wit != worker_bases.end(); ++wit)
+			event_base_free(*wit);
+		worker_bases.clear();
 		event_base_free(net_evbase);
 		net_evbase = 0;
 		return false;
@@ -73,6 +175,9 @@ void NetServer::StopBroadcast() {
 	broadcast_ev = 0;
 }
 void NetServer::StopListen() {
+	// a multi-room server keeps accepting; started rooms refuse joins instead
+	if(multi_room)
+		return;
 	evconnlistener_disable(listener);
 	StopBroadcast();
 }
@@ -99,19 +204,29 @@ void NetServer::BroadcastEvent(evutil_socket_t fd, short events, void* arg) {
 	}
 }
 void NetServer::ServerAccept(evconnlistener* listener, evutil_socket_t fd, sockaddr* address, int socklen, void* ctx) {
-	bufferevent* bev = bufferevent_socket_new(net_evbase, fd, BEV_OPT_CLOSE_ON_FREE);
-	DuelPlayer dp;
-	dp.name[0] = 0;
-	dp.type = 0xff;
-	dp.bev = bev;
-	users[bev] = dp;
-	bufferevent_setcb(bev, ServerEchoRead, NULL, ServerEchoEvent, NULL);
+	event_base* base = net_evbase;
+	int options = BEV_OPT_CLOSE_ON_FREE;
+	if(worker_bases.size()) {
+		base = worker_bases[next_worker++ % worker_bases.size()];
+		options |= BEV_OPT_THREADSAFE;
+	}
+	bufferevent* bev = bufferevent_socket_new(base, fd, options);
+	DuelPlayer* dp;
+	{
+		std::lock_guard<std::mutex> lock(server_mutex);
+		dp = &users[bev];
+		dp->name[0] = 0;
+		dp->type = 0xff;
+		dp->bev = bev;
+	}
+	bufferevent_setcb(bev, ServerEchoRead, NULL, ServerEchoEvent, dp);
 	bufferevent_enable(bev, EV_READ);
 }
 void NetServer::ServerAcceptError(evconnlistener* listener, void* ctx) {
 	event_base_loopexit(net_evbase, 0);
 }
 void NetServer::ServerEchoRead(bufferevent *bev, void *ctx) {
+	DuelPlayer* dp = (DuelPlayer*)ctx;
 	evbuffer* input = bufferevent_get_input(bev);
 	size_t len = evbuffer_get_length(input);
 	unsigned short packet_len = 0;
@@ -122,14 +237,22 @@ void NetServer::ServerEchoRead(bufferevent *bev, void *ctx) {
 		if(len < (size_t)packet_len + 2)
 			return;
 		evbuffer_remove(input, net_server_read, packet_len + 2);
-		if(packet_len)
-			HandleCTOSPacket(&users[bev], &net_server_read[2], packet_len);
+		if(packet_len) {
+			if(worker_bases.size() && MigratePlayer(dp, net_server_read, packet_len + 2))
+				return;
+			HandleCTOSPacket(dp, &net_server_read[2], packet_len);
+		}
+		{
+			std::lock_guard<std::mutex> lock(server_mutex);
+			if(users.find(bev) == users.end())
+				return;
+		}
 		len -= packet_len + 2;
 	}
 }
 void NetServer::ServerEchoEvent(bufferevent* bev, short events, void* ctx) {
 	if (events & (BEV_EVENT_EOF | BEV_EVENT_ERROR)) {
-		DuelPlayer* dp = &users[bev];
+		DuelPlayer* dp = (DuelPlayer*)ctx;
 		DuelMode* dm = dp->game;
 		if(dm)
 			dm->LeaveGame(dp);
@@ -137,7 +260,26 @@ void NetServer::ServerEchoEvent(bufferevent* bev, short events, void* ctx) {
 	}
 }
 int NetServer::ServerThread() {
+	std::vector<std::thread> workers;
+	for(auto wit = worker_bases.begin(); wit != worker_bases.end(); ++wit)
+		workers.push_back(std::thread(WorkerThread, *wit));
 	event_base_dispatch(net_evbase);
+	for(auto wit = worker_bases.begin(); wit != worker_bases.end(); ++wit)
+		event_base_loopexit(*wit, 0);
+	for(auto tit = workers.begin(); tit != workers.end(); ++tit)
+		tit->join();
+	// rooms end first, EndDuel still writes to their players
+	if(duel_mode)
+		FreeRoom(0, 0, duel_mode);
+	duel_mode = 0;
+	for(auto rit = rooms.begin(); rit != rooms.end(); ++rit) {
+		rit->second->EndDuel();
+		FreeRoom(0, 0, rit->second);
+	}
+	rooms.clear();
+	// a FreeRoom queued with event_base_once never runs once the loops have stopped
+	while(closed_rooms.size())
+		FreeRoom(0, 0, *closed_rooms.begin());
 	for(auto bit = users.begin(); bit != users.end(); ++bit) {
 		bufferevent_disable(bit->first, EV_READ);
 		bufferevent_free(bit->first);
@@ -152,23 +294,211 @@ int NetServer::ServerThread() {
 		event_free(broadcast_ev);
 		broadcast_ev = 0;
 	}
-	if(duel_mode) {
-		event_free(duel_mode->etimer);
-		delete duel_mode;
-	}
-	duel_mode = 0;
+	next_room_id = 0;
+	for(auto tit = timer_wheels.begin(); tit != timer_wheels.end(); ++tit)
+		delete tit->second;
+	timer_wheels.clear();
+	for(auto wit = worker_bases.begin(); wit != worker_bases.end(); ++wit)
+		event_base_free(*wit);
+	worker_bases.clear();
+	next_worker = 0;
 	event_base_free(net_evbase);
 	net_evbase = 0;
+	SetLastPacket(0);
+	NetPacket::ClearPool();
+	exit_signal.Set();
 	return 0;
 }
+void NetServer::WorkerThread(event_base* base) {
+	event_base_loop(base, EVLOOP_NO_EXIT_ON_EMPTY);
+	SetLastPacket(0);
+	NetPacket::ClearPool();
+}
+bool NetServer::MigratePlayer(DuelPlayer* dp, char* packet, unsigned int len) {
+	// joining a room on another worker: move the connection there and let that
+	// worker read CTOS_JOIN_GAME again, so a room is only touched by one thread
+	if(dp->game || (unsigned char)packet[2] != CTOS_JOIN_GAME)
+		return false;
+	event_base* base = 0;
+	if(!FindRoom((CTOS_JoinGame*)&packet[3], &base))
+		return false;
+	if(base == bufferevent_get_base(dp->bev))
+		return false;
+	evbuffer_prepend(bufferevent_get_input(dp->bev), packet, len);
+	bufferevent_disable(dp->bev, EV_READ | EV_WRITE);
+	bufferevent_base_set(base, dp->bev);
+	bufferevent_enable(dp->bev, EV_READ | EV_WRITE);
+	bufferevent_trigger(dp->bev, EV_READ, BEV_TRIG_IGNORE_WATERMARKS | BEV_TRIG_DEFER_CALLBACKS);
+	return true;
+}
 void NetServer::DisconnectPlayer(DuelPlayer* dp) {
-	auto bit = users.find(dp->bev);
-	if(bit != users.end()) {
-		bufferevent_flush(dp->bev, EV_WRITE, BEV_FLUSH);
-		bufferevent_disable(dp->bev, EV_READ);
-		bufferevent_free(dp->bev);
+	bufferevent* bev = dp->bev;
+	{
+		std::lock_guard<std::mutex> lock(server_mutex);
+		auto bit = users.find(bev);
+		if(bit == users.end())
+			return;
 		users.erase(bit);
 	}
+	bufferevent_flush(bev, EV_WRITE, BEV_FLUSH);
+	bufferevent_disable(bev, EV_READ);
+	bufferevent_free(bev);
+}
+DuelMode* NetServer::CreateRoom(CTOS_CreateGame* pkt, event_base* base) {
+	DuelMode* dm = 0;
+	if(pkt->info.mode == MODE_SINGLE) {
+		dm = new SingleDuel(false);
+		dm->timer.callback = SingleDuel::SingleTimer;
+	} else if(pkt->info.mode == MODE_MATCH) {
+		dm = new SingleDuel(true);
+		dm->timer.callback = SingleDuel::SingleTimer;
+	} else if(pkt->info.mode == MODE_TAG) {
+		dm = new TagDuel();
+		dm->timer.callback = TagDuel::TagTimer;
+	}
+	if(!dm)
+		return 0;
+	dm->timer.arg = dm;
+	dm->timer_wheel = timer_wheels[base];
+	dm->observer_buffer = evbuffer_new();
+	dm->observer_ev = event_new(base, -1, EV_TIMEOUT, ObserverTimer, dm);
+	if(pkt->info.rule > 3)
+		pkt->info.rule = 0;
+	if(pkt->info.mode > 2)
+		pkt->info.mode = 0;
+	unsigned int hash = 1;
+	for(auto lfit = deckManager._lfList.begin(); lfit != deckManager._lfList.end(); ++lfit) {
+		if(pkt->info.lflist == lfit->hash) {
+			hash = pkt->info.lflist;
+			break;
+		}
+	}
+	if(hash == 1)
+		pkt->info.lflist = deckManager._lfList[0].hash;
+	dm->host_info = pkt->info;
+	BufferIO::CopyWStr(pkt->name, dm->name, 20);
+	BufferIO::CopyWStr(pkt->pass, dm->pass, 20);
+	if(multi_room) {
+		std::lock_guard<std::mutex> lock(server_mutex);
+		do {
+			next_room_id++;
+		} while(!next_room_id || rooms.find(next_room_id) != rooms.end());
+		dm->room_id = next_room_id;
+		rooms[dm->room_id] = dm;
+	}
+	return dm;
+}
+DuelMode* NetServer::FindRoom(CTOS_JoinGame* pkt, event_base** base) {
+	if(!multi_room)
+		return duel_mode;
+	std::lock_guard<std::mutex> lock(server_mutex);
+	DuelMode* dm = 0;
+	if(pkt->gameid) {
+		auto rit = rooms.find(pkt->gameid);
+		if(rit != rooms.end() && rit->second->duel_stage == DUEL_STAGE_BEGIN)
+			dm = rit->second;
+	} else {
+		// clients without a room list send gameid 0; the password names the room
+		wchar_t jpass[20];
+		BufferIO::CopyWStr(pkt->pass, jpass, 20);
+		for(auto rit = rooms.begin(); rit != rooms.end(); ++rit) {
+			if(rit->second->duel_stage == DUEL_STAGE_BEGIN && !wcscmp(rit->second->pass, jpass)) {
+				dm = rit->second;
+				break;
+			}
+		}
+	}
+	if(dm && base)
+		*base = event_get_base(dm->observer_ev);
+	return dm;
+}
+void NetServer::CloseRoom(DuelMode* dm) {
+	if(!multi_room) {
+		StopServer();
+		return;
+	}
+	std::vector<DuelPlayer*> members;
+	{
+		std::lock_guard<std::mutex> lock(server_mutex);
+		auto rit = rooms.find(dm->room_id);
+		if(rit == rooms.end() || rit->second != dm)
+			return;
+		rooms.erase(rit);
+		closed_rooms.insert(dm);
+		for(auto bit = users.begin(); bit != users.end(); ++bit) {
+			if(bit->second.game == dm)
+				members.push_back(&bit->second);
+		}
+	}
+	dm->EndDuel();
+	dm->timer_wheel->Remove(&dm->timer);
+	FlushObservers(dm);
+	for(auto mit = members.begin(); mit != members.end(); ++mit)
+		DisconnectPlayer(*mit);
+	// the room is still on the call stack of the packet that closed it
+	event_base_once(event_get_base(dm->observer_ev), -1, EV_TIMEOUT, FreeRoom, dm, 0);
+}
+void NetServer::FreeRoom(evutil_socket_t fd, short events, void* arg) {
+	DuelMode* dm = (DuelMode*)arg;
+	{
+		std::lock_guard<std::mutex> lock(server_mutex);
+		closed_rooms.erase(dm);
+	}
+	dm->timer_wheel->Remove(&dm->timer);
+	event_free(dm->observer_ev);
+	evbuffer_free(dm->observer_buffer);
+	delete dm;
+}
+// a packet NetPacket::Create refused; the client misses it, so it is at least reported
+void NetServer::DropPacket(DuelPlayer* dp, unsigned char proto, size_t len) {
+	unsigned int room_id = (dp && dp->game) ? dp->game->room_id : 0;
+	fprintf(stderr, "Dropped STOC 0x%02x of %d bytes in room %u, longer than %d bytes\n", proto, (int)len, room_id, NET_PACKET_MAX - 3);
+}
+void NetServer::ReSendToObservers(DuelMode* dm) {
+	// observers get the packets of one Process() call as a single batched write
+	if(dm->observers.empty())
+		return;
+	if(!last_packet)
+		return;
+	evbuffer_add(dm->observer_buffer, last_packet->Data(), last_packet->Size());
+	ServerStats::AddPacket(last_packet->Data()[2], last_packet->Size(), dm->observers.size());
+	if(!event_pending(dm->observer_ev, EV_TIMEOUT, 0)) {
+		timeval delay = {(long)(observer_delay / 1000), (long)(observer_delay % 1000) * 1000};
+		event_add(dm->observer_ev, &delay);
+	}
+}
+void NetServer::FlushObservers(DuelMode* dm) {
+	event_del(dm->observer_ev);
+	size_t len = evbuffer_get_length(dm->observer_buffer);
+	if(!len)
+		return;
+	for(auto oit = dm->observers.begin(); oit != dm->observers.end(); ++oit)
+		evbuffer_add_buffer_reference(bufferevent_get_output((*oit)->bev), dm->observer_buffer);
+	evbuffer_drain(dm->observer_buffer, len);
+}
+// one line per room, the rooms that spent the most time in the engine first
+void NetServer::WriteRoomStats(FILE* fp) {
+	std::vector<std::pair<unsigned long long, DuelMode*>> list;
+	std::lock_guard<std::mutex> lock(server_mutex);
+	for(auto rit = rooms.begin(); rit != rooms.end(); ++rit)
+		list.push_back(std::make_pair(rit->second->stats.process_time.load(std::memory_order_relaxed), rit->second));
+	size_t count = std::min<size_t>(list.size(), STATS_ROOMS);
+	std::partial_sort(list.begin(), list.begin() + count, list.end(), [](const std::pair<unsigned long long, DuelMode*>& a, const std::pair<unsigned long long, DuelMode*>& b) {
+		return a.first > b.first;
+	});
+	fprintf(fp, "rooms %d\n", (int)list.size());
+	for(size_t i = 0; i < count; ++i) {
+		DuelMode* dm = list[i].second;
+		RoomStats& stats = dm->stats;
+		unsigned long long responses = stats.responses.load(std::memory_order_relaxed);
+		fprintf(fp, "room %u mode %d stage %d process_calls %llu process_ms %llu process_max_us %llu messages %llu responses %llu response_avg_ms %llu\n",
+		        dm->room_id, dm->host_info.mode, dm->duel_stage, stats.process_calls.load(std::memory_order_relaxed),
+		        list[i].first / 1000, stats.process_max.load(std::memory_order_relaxed), stats.messages.load(std::memory_order_relaxed),
+		        responses, responses ? stats.response_time.load(std::memory_order_relaxed) / responses : 0);
+	}
+}
+void NetServer::ObserverTimer(evutil_socket_t fd, short events, void* arg) {
+	FlushObservers((DuelMode*)arg);
 }
 void NetServer::HandleCTOSPacket(DuelPlayer* dp, char* data, unsigned int len) {
 	char* pdata = data;
@@ -177,27 +507,27 @@ void NetServer::HandleCTOSPacket(DuelPlayer* dp, char* data, unsigned int len) {
 		return;
 	switch(pktType) {
 	case CTOS_RESPONSE: {
-		if(!dp->game || !duel_mode->pduel)
+		if(!dp->game || !dp->game->pduel)
 			return;
-		duel_mode->GetResponse(dp, pdata, len > 64 ? 64 : len - 1);
+		dp->game->GetResponse(dp, pdata, len > 64 ? 64 : len - 1);
 		break;
 	}
 	case CTOS_TIME_CONFIRM: {
-		if(!dp->game || !duel_mode->pduel)
+		if(!dp->game || !dp->game->pduel)
 			return;
-		duel_mode->TimeConfirm(dp);
+		dp->game->TimeConfirm(dp);
 		break;
 	}
 	case CTOS_CHAT: {
 		if(!dp->game)
 			return;
-		duel_mode->Chat(dp, pdata, len - 1);
+		dp->game->Chat(dp, pdata, len - 1);
 		break;
 	}
 	case CTOS_UPDATE_DECK: {
 		if(!dp->game)
 			return;
-		duel_mode->UpdateDeck(dp, pdata, len - 1);
+		dp->game->UpdateDeck(dp, pdata, len - 1);
 		break;
 	}
 	case CTOS_HAND_RESULT: {
@@ -220,87 +550,83 @@ void NetServer::HandleCTOSPacket(DuelPlayer* dp, char* data, unsigned int len) {
 		break;
 	}
 	case CTOS_CREATE_GAME: {
-		if(dp->game || duel_mode)
+		if(dp->game || (!multi_room && duel_mode))
 			return;
-		CTOS_CreateGame* pkt = (CTOS_CreateGame*)pdata;
-		if(pkt->info.mode == MODE_SINGLE) {
-			duel_mode = new SingleDuel(false);
-			duel_mode->etimer = event_new(net_evbase, 0, EV_TIMEOUT | EV_PERSIST, SingleDuel::SingleTimer, duel_mode);
-		} else if(pkt->info.mode == MODE_MATCH) {
-			duel_mode = new SingleDuel(true);
-			duel_mode->etimer = event_new(net_evbase, 0, EV_TIMEOUT | EV_PERSIST, SingleDuel::SingleTimer, duel_mode);
-		} else if(pkt->info.mode == MODE_TAG) {
-			duel_mode = new TagDuel();
-			duel_mode->etimer = event_new(net_evbase, 0, EV_TIMEOUT | EV_PERSIST, TagDuel::TagTimer, duel_mode);
-		}
-		if(pkt->info.rule > 3)
-			pkt->info.rule = 0;
-		if(pkt->info.mode > 2)
-			pkt->info.mode = 0;
-		unsigned int hash = 1;
-		for(auto lfit = deckManager._lfList.begin(); lfit != deckManager._lfList.end(); ++lfit) {
-			if(pkt->info.lflist == lfit->hash) {
-				hash = pkt->info.lflist;
-				break;
-			}
+		DuelMode* dm = CreateRoom((CTOS_CreateGame*)pdata, bufferevent_get_base(dp->bev));
+		if(!dm)
+			return;
+		dm->JoinGame(dp, 0, true);
+		if(multi_room) {
+			STOC_CreateGame sccg;
+			sccg.gameid = dm->room_id;
+			SendPacketToPlayer(dp, STOC_CREATE_GAME, sccg);
+		} else {
+			duel_mode = dm;
+			StartBroadcast();
 		}
-		if(hash == 1)
-			pkt->info.lflist = deckManager._lfList[0].hash;
-		duel_mode->host_info = pkt->info;
-		BufferIO::CopyWStr(pkt->name, duel_mode->name, 20);
-		BufferIO::CopyWStr(pkt->pass, duel_mode->pass, 20);
-		duel_mode->JoinGame(dp, 0, true);
-		StartBroadcast();
 		break;
 	}
 	case CTOS_JOIN_GAME: {
-		if(!duel_mode)
+		event_base* base = 0;
+		DuelMode* dm = FindRoom((CTOS_JoinGame*)pdata, &base);
+		// MigratePlayer looked the room up before; a room created on another worker since
+		// then belongs to that worker and is refused here
+		if(dm && multi_room && base != bufferevent_get_base(dp->bev))
+			dm = 0;
+		if(!dm) {
+			if(!multi_room)
+				break;
+			STOC_ErrorMsg scem;
+			scem.msg = ERRMSG_JOINERROR;
+			scem.code = 0;
+			SendPacketToPlayer(dp, STOC_ERROR_MSG, scem);
 			break;
-		duel_mode->JoinGame(dp, pdata, false);
+		}
+		dm->JoinGame(dp, pdata, false);
 		break;
 	}
 	case CTOS_LEAVE_GAME: {
-		if(!duel_mode)
+		if(!dp->game)
 			break;
-		duel_mode->LeaveGame(dp);
+		dp->game->LeaveGame(dp);
 		break;
 	}
 	case CTOS_SURRENDER: {
-		if(!duel_mode)
+		if(!dp->game)
 			break;
-		duel_mode->Surrender(dp);
+		dp->game->Surrender(dp);
 		break;
 	}
 	case CTOS_HS_TODUELIST: {
-		if(!duel_mode || duel_mode->pduel)
+		if(!dp->game || dp->game->pduel)
 			break;
-		duel_mode->ToDuelist(dp);
+		dp->game->ToDuelist(dp);
 		break;
 	}
 	case CTOS_HS_TOOBSERVER: {
-		if(!duel_mode || duel_mode->pduel)
+		if(!dp->game || dp->game->pduel)
 			break;
-		duel_mode->ToObserver(dp);
+		dp->game->ToObserver(dp);
 		break;
 	}
 	case CTOS_HS_READY:
 	case CTOS_HS_NOTREADY: {
-		if(!duel_mode || duel_mode->pduel)
+		if(!dp->game || dp->game->pduel)
 			break;
-		duel_mode->PlayerReady(dp, (CTOS_HS_NOTREADY - pktType) != 0);
+		dp->game->PlayerReady(dp, (CTOS_HS_NOTREADY - pktType) != 0);
 		break;
 	}
 	case CTOS_HS_KICK: {
-		if(!duel_mode || duel_mode->pduel)
+		if(!dp->game || dp->game->pduel)
 			break;
 		CTOS_Kick* pkt = (CTOS_Kick*)pdata;
-		duel_mode->PlayerKick(dp, pkt->pos);
+		dp->game->PlayerKick(dp, pkt->pos);
 		break;
 	}
 	case CTOS_HS_START: {
-		if(!duel_mode || duel_mode->pduel)
+		if(!dp->game || dp->game->pduel)
 			break;
-		duel_mode->StartDuel(dp);
+		dp->game->StartDuel(dp);
 		break;
 	}
 	}
@@ -7,9 +7,47 @@
 #include "deck_manager.h"
 #include <set>
 #include <unordered_map>
+#include <vector>
+#include <atomic>
 
 namespace ygo {
 
+// packets at least this long are re-sent by reference instead of being copied
+#define SHARED_PACKET_MIN	0x100
+// the longest packet, length and type included; DuelClient reads a packet into a buffer of this size
+#define NET_PACKET_MAX			0x2000
+// packet buffers are recycled through per-thread pools, one per size class of 0x100, 0x400 and
+// NET_PACKET_MAX bytes, so that a short packet held by a slow receiver does not pin a large block
+#define NET_PACKET_CLASSES		3
+#define NET_PACKET_POOL_MAX		64
+
+// one STOC packet, length and type included, in a reference counted buffer. it is built once and
+// every receiver holds a reference, so sending it to a room never copies it and never touches shared state
+class NetPacket {
+public:
+	static NetPacket* Create(unsigned char proto, const void* buffer, size_t len);
+	static void ClearPool();
+	void Write(bufferevent* bev);
+	void Release();
+	const char* Data() const {
+		return (const char*)(this + 1);
+	}
+	size_t Size() const {
+		return size;
+	}
+
+private:
+	static void ReleaseReference(const void* data, size_t len, void* arg);
+	static const size_t class_sizes[NET_PACKET_CLASSES];
+	static thread_local NetPacket* free_packets[NET_PACKET_CLASSES];
+	static thread_local unsigned int free_count[NET_PACKET_CLASSES];
+
+	std::atomic<int> ref_count;
+	size_t size;
+	int size_class;
+	NetPacket* next_free;
+};
+
 class NetServer {
 private:
 	static std::unordered_map<bufferevent*, DuelPlayer> users;
@@ -18,12 +56,32 @@ private:
 	static event* broadcast_ev;
 	static evconnlistener* listener;
 	static DuelMode* duel_mode;
-	static char net_server_read[0x2000];
-	static char net_server_write[0x2000];
-	static unsigned short last_sent;
+	static std::unordered_map<unsigned int, DuelMode*> rooms;
+	// closed rooms whose FreeRoom is still queued on their worker
+	static std::set<DuelMode*> closed_rooms;
+	static unsigned int next_room_id;
+	static bool multi_room;
+	static std::vector<event_base*> worker_bases;
+	static std::unordered_map<event_base*, TimerWheel*> timer_wheels;
+	static unsigned int next_worker;
+	static std::mutex server_mutex;
+	static Signal exit_signal;
+	static unsigned int observer_delay;
+	static thread_local char net_server_read[0x2000];
+	// the packet sent last on this thread, for ReSendToPlayer and ReSendToObservers
+	static thread_local NetPacket* last_packet;
+
+	static void DropPacket(DuelPlayer* dp, unsigned char proto, size_t len);
+	static void SetLastPacket(NetPacket* packet) {
+		if(last_packet)
+			last_packet->Release();
+		last_packet = packet;
+	}
 
 public:
-	static bool StartServer(unsigned short port);
+	static std::mutex engine_mutex;
+
+	static bool StartServer(unsigned short port, bool multi = false, unsigned int workers = 0);
 	static bool StartBroadcast();
 	static void StopServer();
 	static void StopBroadcast();
@@ -34,39 +92,48 @@ public:
 	static void ServerEchoRead(bufferevent* bev, void* ctx);
 	static void ServerEchoEvent(bufferevent* bev, short events, void* ctx);
 	static int ServerThread();
+	static void WorkerThread(event_base* base);
+	static bool MigratePlayer(DuelPlayer* dp, char* packet, unsigned int len);
 	static void DisconnectPlayer(DuelPlayer* dp);
+	static void SetObserverDelay(unsigned int milliseconds) {
+		observer_delay = milliseconds;
+	}
+	static void ReSendToObservers(DuelMode* dm);
+	static void FlushObservers(DuelMode* dm);
+	static void ObserverTimer(evutil_socket_t fd, short events, void* arg);
+	static void WriteRoomStats(FILE* fp);
+	static bool WaitForExit(long milliseconds) {
+		return exit_signal.Wait(milliseconds);
+	}
+	static bool IsMultiRoom() {
+		return multi_room;
+	}
+	static DuelMode* CreateRoom(CTOS_CreateGame* pkt, event_base* base);
+	static DuelMode* FindRoom(CTOS_JoinGame* pkt, event_base** base = 0);
+	static void CloseRoom(DuelMode* dm);
+	static void FreeRoom(evutil_socket_t fd, short events, void* arg);
 	static void HandleCTOSPacket(DuelPlayer* dp, char* data, unsigned int len);
 	static void SendPacketToPlayer(DuelPlayer* dp, unsigned char proto) {
-		char* p = net_server_write;
-		BufferIO::WriteInt16(p, 1);
-		BufferIO::WriteInt8(p, proto);
-		last_sent = 3;
-		if(!dp)
-			return;
-		bufferevent_write(dp->bev, net_server_write, last_sent);
+		SetLastPacket(NetPacket::Create(proto, 0, 0));
+		if(dp && last_packet)
+			last_packet->Write(dp->bev);
 	}
 	template<typename ST>
 	static void SendPacketToPlayer(DuelPlayer* dp, unsigned char proto, ST& st) {
-		char* p = net_server_write;
-		BufferIO::WriteInt16(p, 1 + sizeof(ST));
-		BufferIO::WriteInt8(p, proto);
-		memcpy(p, &st, sizeof(ST));
-		last_sent = sizeof(ST) + 3;
-		if(dp)
-			bufferevent_write(dp->bev, net_server_write, last_sent);
+		SetLastPacket(NetPacket::Create(proto, &st, sizeof(ST)));
+		if(dp && last_packet)
+			last_packet->Write(dp->bev);
 	}
 	static void SendBufferToPlayer(DuelPlayer* dp, unsigned char proto, void* buffer, size_t len) {
-		char* p = net_server_write;
-		BufferIO::WriteInt16(p, 1 + len);
-		BufferIO::WriteInt8(p, proto);
-		memcpy(p, buffer, len);
-		last_sent = len + 3;
-		if(dp)
-			bufferevent_write(dp->bev, net_server_write, last_sent);
+		SetLastPacket(NetPacket::Create(proto, buffer, len));
+		if(!last_packet)
+			DropPacket(dp, proto, len);
+		else if(dp)
+			last_packet->Write(dp->bev);
 	}
 	static void ReSendToPlayer(DuelPlayer* dp) {
-		if(dp)
-			bufferevent_write(dp->bev, net_server_write, last_sent);
+		if(dp && last_packet)
+			last_packet->Write(dp->bev);
 	}
 };
 
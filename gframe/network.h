@@ -3,6 +3,9 @@
 
 #include "config.h"
 #include "deck_manager.h"
+#include "timer_wheel.h"
+#include "server_stats.h"
+#include <set>
 #include <event2/event.h>
 #include <event2/listener.h>
 #include <event2/bufferevent.h>
@@ -119,9 +122,20 @@ struct DuelPlayer {
 	}
 };
 
+#define QUERY_VIEWER_OBSERVER	4
+#define QUERY_VIEWERS			5
+
+// the query fields of one card a viewer's client currently holds
+struct QueryCard {
+	unsigned int flag;
+	int value[24];
+	int link_marker;
+	std::vector<int> list[3];
+};
+
 class DuelMode {
 public:
-	DuelMode(): host_player(0), pduel(0), duel_stage(0) {}
+	DuelMode(): room_id(0), timer_wheel(0), analyzed_messages(0), response_start(0), observer_buffer(0), observer_ev(0), host_player(0), pduel(0), duel_stage(0) {}
 	virtual ~DuelMode() {}
 	virtual void Chat(DuelPlayer* dp, void* pdata, int len) {}
 	virtual void JoinGame(DuelPlayer* dp, void* pdata, bool is_creater) {}
@@ -143,8 +157,33 @@ public:
 	virtual void TimeConfirm(DuelPlayer* dp) {}
 	virtual void EndDuel() {};
 
+	void RefreshLocation(int player, int location, int flag, int use_cache);
+	void RefreshField(int location, int flag = 0, int use_cache = 1);
+
+protected:
+	// send the MSG_UPDATE_DATA of one location; masked is null when nothing is hidden from anyone
+	virtual void SendLocationQuery(int player, int location, char* query, char* masked, int len) {}
+	static int DefaultQueryFlag(int location);
+	static void MaskLocationQuery(char* dst, char* src, int len);
+	bool SendQueryUpdate(DuelPlayer* dp, int viewer, char* query, int len);
+	int DiffLocationQuery(char* dst, char* src, int len, std::vector<QueryCard>& cache);
+	void InvalidateQueryCache();
+	void InvalidateQueryCache(int player, int location);
+	void TrackQueryCache(unsigned char msg, char* pbuf);
+
+	std::vector<QueryCard> query_cache[QUERY_VIEWERS][2][5];
+
 public:
-	event* etimer;
+	unsigned int room_id;
+	// the turn timer, on the wheel of the room's event loop
+	TimerEntry timer;
+	TimerWheel* timer_wheel;
+	RoomStats stats;
+	unsigned int analyzed_messages; // by the last Analyze call
+	unsigned long long response_start; // ServerStats::Micros() at the last WaitforResponse
+	std::set<DuelPlayer*> observers;
+	evbuffer* observer_buffer;
+	event* observer_ev;
 	DuelPlayer* host_player;
 	HostInfo host_info;
 	int duel_stage;
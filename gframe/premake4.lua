@@ -1,10 +1,12 @@
 include "lzma/."
+include "server/."
+include "loadgen/."
 
 project "ygopro"
     kind "WindowedApp"
 
     files { "**.cpp", "**.cc", "**.c", "**.h" }
-    excludes "lzma/**"
+    excludes { "lzma/**", "server/**", "loadgen/**" }
     includedirs { "../ocgcore" }
     links { "ocgcore", "clzma", "Irrlicht", "freetype", "sqlite3", "lua" , "event" }
 
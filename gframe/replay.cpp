@@ -2,18 +2,67 @@
 #include "../ocgcore/ocgapi.h"
 #include "../ocgcore/common.h"
 #include "lzma/LzmaLib.h"
+#include "lzma/LzmaEnc.h"
+#include <stddef.h>
 
 namespace ygo {
 
+// compresses the replay while it is being recorded, so that EndRecord only encodes the tail
+struct ReplayEncoder {
+	ISeqInStream in;
+	ISeqOutStream out;
+	Replay* replay;
+	CLzmaEncHandle handle;
+	size_t fed;
+	bool ended;
+	bool failed;
+};
+
+static void* LzmaAlloc(void* p, size_t size) {
+	return size ? malloc(size) : 0;
+}
+static void LzmaFree(void* p, void* address) {
+	free(address);
+}
+static ISzAlloc lzma_alloc = { LzmaAlloc, LzmaFree };
+
+// the encoder takes everything recorded so far; running out of data means the end of the replay,
+// so EncodeStep only runs it while more than one block is waiting
+static SRes ReplayEncoderRead(void* p, void* buf, size_t* size) {
+	ReplayEncoder* encoder = (ReplayEncoder*)((char*)p - offsetof(ReplayEncoder, in));
+	std::vector<unsigned char>& data = encoder->replay->replay_data;
+	size_t len = data.size() - encoder->fed;
+	if(len > *size)
+		len = *size;
+	memcpy(buf, data.data() + encoder->fed, len);
+	encoder->fed += len;
+	*size = len;
+	return SZ_OK;
+}
+static size_t ReplayEncoderWrite(void* p, const void* buf, size_t size) {
+	ReplayEncoder* encoder = (ReplayEncoder*)((char*)p - offsetof(ReplayEncoder, out));
+	std::vector<unsigned char>& comp_data = encoder->replay->comp_data;
+	comp_data.insert(comp_data.end(), (const unsigned char*)buf, (const unsigned char*)buf + size);
+	return size;
+}
+static void DestroyEncoder(ReplayEncoder* encoder) {
+	if(!encoder)
+		return;
+	if(encoder->handle)
+		LzmaEnc_Destroy(encoder->handle, &lzma_alloc, &lzma_alloc);
+	delete encoder;
+}
+
 Replay::Replay() {
 	is_recording = false;
 	is_replaying = false;
-	replay_data = new unsigned char[0x20000];
-	comp_data = new unsigned char[0x2000];
+	pdata = 0;
+	replay_size = 0;
+	comp_size = 0;
+	encoder = 0;
 }
 Replay::~Replay() {
-	delete[] replay_data;
-	delete[] comp_data;
+	DestroyEncoder(encoder);
 }
 void Replay::BeginRecord() {
 	if(!FileSystem::IsDirExists(L"./replay") && !FileSystem::MakeDir(L"./replay"))
@@ -31,7 +80,27 @@ void Replay::BeginRecord() {
 	if(!fp)
 		return;
 #endif
-	pdata = replay_data;
+	replay_data.clear();
+	comp_data.clear();
+	DestroyEncoder(encoder);
+	encoder = new ReplayEncoder();
+	encoder->in.Read = ReplayEncoderRead;
+	encoder->out.Write = ReplayEncoderWrite;
+	encoder->replay = this;
+	encoder->handle = LzmaEnc_Create(&lzma_alloc);
+	CLzmaEncProps props;
+	LzmaEncProps_Init(&props);
+	props.level = 5;
+	props.dictSize = REPLAY_DICT_SIZE;
+	props.lc = 3;
+	props.lp = 0;
+	props.pb = 2;
+	props.fb = 32;
+	props.numThreads = 1;
+	if(!encoder->handle || LzmaEnc_SetProps(encoder->handle, &props) != SZ_OK)
+		encoder->failed = true;
+	else if(LzmaEnc_PrepareStream(encoder->handle, &encoder->out, &encoder->in, &lzma_alloc, &lzma_alloc) != SZ_OK)
+		encoder->failed = true;
 	is_recording = true;
 }
 void Replay::WriteHeader(ReplayHeader& header) {
@@ -47,8 +116,8 @@ void Replay::WriteHeader(ReplayHeader& header) {
 void Replay::WriteData(const void* data, unsigned int length, bool flush) {
 	if(!is_recording)
 		return;
-	memcpy(pdata, data, length);
-	pdata += length;
+	replay_data.insert(replay_data.end(), (const unsigned char*)data, (const unsigned char*)data + length);
+	EncodeStep();
 #ifdef _WIN32
 	DWORD size;
 	WriteFile(recording_fp, data, length, &size, NULL);
@@ -61,8 +130,8 @@ void Replay::WriteData(const void* data, unsigned int length, bool flush) {
 void Replay::WriteInt32(int data, bool flush) {
 	if(!is_recording)
 		return;
-	*((int*)(pdata)) = data;
-	pdata += 4;
+	replay_data.insert(replay_data.end(), (unsigned char*)&data, (unsigned char*)&data + sizeof(int));
+	EncodeStep();
 #ifdef _WIN32
 	DWORD size;
 	WriteFile(recording_fp, &data, sizeof(int), &size, NULL);
@@ -75,8 +144,8 @@ void Replay::WriteInt32(int data, bool flush) {
 void Replay::WriteInt16(short data, bool flush) {
 	if(!is_recording)
 		return;
-	*((short*)(pdata)) = data;
-	pdata += 2;
+	replay_data.insert(replay_data.end(), (unsigned char*)&data, (unsigned char*)&data + sizeof(short));
+	EncodeStep();
 #ifdef _WIN32
 	DWORD size;
 	WriteFile(recording_fp, &data, sizeof(short), &size, NULL);
@@ -89,8 +158,8 @@ void Replay::WriteInt16(short data, bool flush) {
 void Replay::WriteInt8(char data, bool flush) {
 	if(!is_recording)
 		return;
-	*pdata = data;
-	pdata++;
+	replay_data.push_back(data);
+	EncodeStep();
 #ifdef _WIN32
 	DWORD size;
 	WriteFile(recording_fp, &data, sizeof(char), &size, NULL);
@@ -116,13 +185,39 @@ void Replay::EndRecord() {
 #else
 	fclose(fp);
 #endif
-	pheader.datasize = pdata - replay_data;
+	pheader.datasize = replay_data.size();
 	pheader.flag |= REPLAY_COMPRESSED;
 	size_t propsize = 5;
-	comp_size = 0x1000;
-	LzmaCompress(comp_data, &comp_size, replay_data, pdata - replay_data, pheader.props, &propsize, 5, 1 << 24, 3, 0, 2, 32, 1);
+	if(!encoder->failed) {
+		encoder->ended = true;
+		int finished = 0;
+		SRes res = SZ_OK;
+		while(res == SZ_OK && !finished)
+			res = LzmaEnc_CodeStreamBlock(encoder->handle, &finished);
+		LzmaEnc_Finish(encoder->handle);
+		if(res != SZ_OK || LzmaEnc_WriteProperties(encoder->handle, pheader.props, &propsize) != SZ_OK)
+			encoder->failed = true;
+	}
+	if(encoder->failed) {
+		comp_size = replay_data.size() + replay_data.size() / 3 + 0x100;
+		comp_data.resize(comp_size);
+		if(LzmaCompress(comp_data.data(), &comp_size, replay_data.data(), replay_data.size(), pheader.props, &propsize, 5, REPLAY_DICT_SIZE, 3, 0, 2, 32, 1) != SZ_OK)
+			comp_size = 0;
+		comp_data.resize(comp_size);
+	}
+	comp_size = comp_data.size();
+	DestroyEncoder(encoder);
+	encoder = 0;
 	is_recording = false;
 }
+// hand the encoder another block once enough data is buffered that it cannot mistake a pause for the end
+void Replay::EncodeStep() {
+	if(encoder->failed || replay_data.size() - encoder->fed < REPLAY_ENCODE_STEP)
+		return;
+	int finished = 0;
+	if(LzmaEnc_CodeStreamBlock(encoder->handle, &finished) != SZ_OK || finished)
+		encoder->failed = true;
+}
 void Replay::SaveReplay(const wchar_t* name) {
 	if(!FileSystem::IsDirExists(L"./replay") && !FileSystem::MakeDir(L"./replay"))
 		return;
@@ -138,7 +233,7 @@ void Replay::SaveReplay(const wchar_t* name) {
 	if(!fp)
 		return;
 	fwrite(&pheader, sizeof(pheader), 1, fp);
-	fwrite(comp_data, comp_size, 1, fp);
+	fwrite(comp_data.data(), comp_size, 1, fp);
 	fclose(fp);
 }
 bool Replay::OpenReplay(const wchar_t* name) {
@@ -166,18 +261,26 @@ bool Replay::OpenReplay(const wchar_t* name) {
 		fclose(fp);
 		return false;
 	}
+	std::vector<unsigned char>& file_data = (pheader.flag & REPLAY_COMPRESSED) ? comp_data : replay_data;
+	file_data.clear();
+	unsigned char buffer[0x1000];
+	size_t read_size;
+	while((read_size = fread(buffer, 1, sizeof(buffer), fp)) > 0 && file_data.size() < REPLAY_MAX_SIZE)
+		file_data.insert(file_data.end(), buffer, buffer + read_size);
+	fclose(fp);
 	if(pheader.flag & REPLAY_COMPRESSED) {
-		comp_size = fread(comp_data, 1, 0x1000, fp);
-		fclose(fp);
+		if(pheader.datasize > REPLAY_MAX_SIZE)
+			return false;
+		comp_size = comp_data.size();
 		replay_size = pheader.datasize;
-		if(LzmaUncompress(replay_data, &replay_size, comp_data, &comp_size, pheader.props, 5) != SZ_OK)
+		replay_data.resize(replay_size);
+		if(LzmaUncompress(replay_data.data(), &replay_size, comp_data.data(), &comp_size, pheader.props, 5) != SZ_OK)
 			return false;
 	} else {
-		comp_size = fread(replay_data, 1, 0x20000, fp);
-		fclose(fp);
+		comp_size = replay_data.size();
 		replay_size = comp_size;
 	}
-	pdata = replay_data;
+	pdata = replay_data.data();
 	is_replaying = true;
 	return true;
 }
@@ -229,7 +332,7 @@ bool Replay::RenameReplay(const wchar_t* oldname, const wchar_t* newname) {
 #endif
 }
 bool Replay::ReadNextResponse(unsigned char resp[64]) {
-	if(pdata - replay_data >= (int)replay_size)
+	if(pdata - replay_data.data() >= (int)replay_size)
 		return false;
 	int len = *pdata++;
 	if(len > 64)
@@ -271,7 +374,7 @@ char Replay::ReadInt8() {
 	return *pdata++;
 }
 void Replay::Rewind() {
-	pdata = replay_data;
+	pdata = replay_data.data();
 }
 
 }
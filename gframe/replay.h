@@ -3,14 +3,21 @@
 
 #include "config.h"
 #include <time.h>
+#include <vector>
 
 namespace ygo {
 
+struct ReplayEncoder;
+
 #define REPLAY_COMPRESSED	0x1
 #define REPLAY_TAG			0x2
 #define REPLAY_DECODED		0x4
 #define REPLAY_SINGLE_MODE	0x8
 
+#define REPLAY_ENCODE_STEP	0x10000
+#define REPLAY_DICT_SIZE	0x10000
+#define REPLAY_MAX_SIZE		0x1000000
+
 struct ReplayHeader {
 	unsigned int id;
 	unsigned int version;
@@ -47,16 +54,22 @@ public:
 	char ReadInt8();
 	void Rewind();
 
+private:
+	void EncodeStep();
+
+public:
+
 	FILE* fp;
 	ReplayHeader pheader;
 #ifdef _WIN32
 	HANDLE recording_fp;
 #endif
-	unsigned char* replay_data;
-	unsigned char* comp_data;
+	std::vector<unsigned char> replay_data;
+	std::vector<unsigned char> comp_data;
 	unsigned char* pdata;
 	size_t replay_size;
 	size_t comp_size;
+	ReplayEncoder* encoder;
 	bool is_recording;
 	bool is_replaying;
 };
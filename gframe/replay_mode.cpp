@@ -19,11 +19,14 @@ bool ReplayMode::exit_pending = false;
 int ReplayMode::skip_turn = 0;
 int ReplayMode::current_step = 0;
 int ReplayMode::skip_step = 0;
+size_t ReplayMode::response_count = 0;
+std::vector<ReplayCheckpoint> ReplayMode::seek_index;
 
 bool ReplayMode::StartReplay(int skipturn) {
 	skip_turn = skipturn;
 	if(skip_turn < 0)
 		skip_turn = 0;
+	seek_index.clear();
 	std::thread(ReplayThread).detach();
 	return true;
 }
@@ -52,8 +55,22 @@ void ReplayMode::Pause(bool is_pause, bool is_step) {
 bool ReplayMode::ReadReplayResponse() {
 	unsigned char resp[64];
 	bool result = cur_replay.ReadNextResponse(resp);
-	if(result)
+	if(result) {
+		if(response_count == seek_index.size()) {
+			ReplayCheckpoint cp;
+			// one entry per response, so that the index stays the response count
+			cp.valid = mainGame->dField.chains.empty();
+			cp.step = current_step;
+			cp.turn = mainGame->dInfo.turn;
+			cp.tag_player[0] = mainGame->dInfo.tag_player[0];
+			cp.tag_player[1] = mainGame->dInfo.tag_player[1];
+			unsigned int disabled = mainGame->dField.disabled_field;
+			cp.disabled_field = mainGame->dInfo.isFirst ? disabled : (disabled >> 16) | (disabled << 16);
+			seek_index.push_back(cp);
+		}
+		response_count++;
 		set_responseb(pduel, resp);
+	}
 	return result;
 }
 int ReplayMode::ReplayThread() {
@@ -89,6 +106,7 @@ int ReplayMode::ReplayThread() {
 	}
 	exit_pending = false;
 	current_step = 0;
+	response_count = 0;
 	if(mainGame->dInfo.isReplaySkiping)
 		mainGame->gMutex.lock();
 	while (is_continuing && !exit_pending) {
@@ -106,7 +124,12 @@ int ReplayMode::ReplayThread() {
 				int step = current_step - 1;
 				if(step < 0)
 					step = 0;
-				if(mainGame->dInfo.isSingleMode) {
+				int base = RestoreCheckpoint(step);
+				if(base >= 0) {
+					is_continuing = true;
+					step -= base;
+				} else if(mainGame->dInfo.isSingleMode) {
+					base = 0;
 					is_continuing = true;
 					skip_step = 0;
 					int len = get_message(pduel, (byte*)engineBuffer);
@@ -114,6 +137,7 @@ int ReplayMode::ReplayThread() {
 						is_continuing = ReplayAnalyze(engineBuffer, len);
 					}
 				} else {
+					base = 0;
 					ReplayRefreshDeck(0);
 					ReplayRefreshDeck(1);
 					ReplayRefreshExtra(0);
@@ -128,7 +152,7 @@ int ReplayMode::ReplayThread() {
 					mainGame->gMutex.unlock();
 				}
 				skip_step = step;
-				current_step = 0;
+				current_step = base;
 			}
 		}
 	}
@@ -260,6 +284,7 @@ void ReplayMode::Restart(bool refresh) {
 	mainGame->dField.Clear();
 	//mainGame->device->setEventReceiver(&mainGame->dField);
 	cur_replay.Rewind();
+	response_count = 0;
 	//mainGame->dInfo.isFirst = true;
 	mainGame->dInfo.tag_player[0] = false;
 	mainGame->dInfo.tag_player[1] = false;
@@ -280,6 +305,47 @@ void ReplayMode::Undo() {
 	is_restarting = true;
 	Pause(false, false);
 }
+// bring a freshly restarted duel to the last response read outside a chain before the target step.
+// the engine can not be snapshotted, so it is driven alone through the recorded responses,
+// which skips every client side message, and the field is then reloaded from it.
+// returns the step the client is at, or -1 when no checkpoint precedes the target
+int ReplayMode::RestoreCheckpoint(int step) {
+	int index = -1;
+	for(size_t i = 0; i < seek_index.size() && seek_index[i].step < step; ++i) {
+		if(seek_index[i].valid)
+			index = (int)i;
+	}
+	if(index < 0)
+		return -1;
+	char engineBuffer[0x1000];
+	if(mainGame->dInfo.isSingleMode)
+		get_message(pduel, (byte*)engineBuffer);
+	while(response_count <= (size_t)index) {
+		int result = process(pduel);
+		if(result & 0xffff)
+			get_message(pduel, (byte*)engineBuffer);
+		int flag = result >> 16;
+		if(flag == 1 && ReadReplayResponse())
+			continue;
+		if(flag != 0) {
+			Restart(false);
+			return -1;
+		}
+	}
+	const ReplayCheckpoint& cp = seek_index[index];
+	unsigned char fieldBuffer[0x2000];
+	int len = query_field_info(pduel, fieldBuffer);
+	mainGame->gMutex.unlock();
+	DuelClient::ClientAnalyze((char*)fieldBuffer, len);
+	mainGame->gMutex.lock();
+	ReplayReload();
+	mainGame->dInfo.turn = cp.turn;
+	mainGame->dInfo.tag_player[0] = cp.tag_player[0];
+	mainGame->dInfo.tag_player[1] = cp.tag_player[1];
+	unsigned int disabled = cp.disabled_field;
+	mainGame->dField.disabled_field = mainGame->dInfo.isFirst ? disabled : (disabled >> 16) | (disabled << 16);
+	return cp.step;
+}
 bool ReplayMode::ReplayAnalyze(char* msg, unsigned int len) {
 	char* pbuf = msg;
 	int player, count;
@@ -9,6 +9,15 @@
 
 namespace ygo {
 
+// client state at the moment a response was read, which the engine can not report back
+struct ReplayCheckpoint {
+	bool valid; // false inside a chain, which MSG_RELOAD_FIELD does not restore
+	int step;
+	int turn;
+	bool tag_player[2];
+	unsigned int disabled_field;
+};
+
 class ReplayMode {
 private:
 	static long pduel;
@@ -22,6 +31,8 @@ private:
 	static int skip_turn;
 	static int current_step;
 	static int skip_step;
+	static size_t response_count;
+	static std::vector<ReplayCheckpoint> seek_index;
 
 public:
 	static Replay cur_replay;
@@ -37,6 +48,7 @@ public:
 	static void EndDuel();
 	static void Restart(bool refresh);
 	static void Undo();
+	static int RestoreCheckpoint(int step);
 	static bool ReplayAnalyze(char* msg, unsigned int len);
 	
 	static void ReplayRefresh(int flag = 0xf81fff);
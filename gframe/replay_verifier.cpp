@@ -0,0 +1,208 @@
+#include "replay_verifier.h"
+#include "data_manager.h"
+#include "netserver.h"
+#include "../ocgcore/ocgapi.h"
+#include "../ocgcore/common.h"
+#include "../ocgcore/mtrandom.h"
+#include <atomic>
+#include <chrono>
+
+namespace ygo {
+
+static const char* status_name[] = { "ok", "leftover", "missing", "rejected", "unreadable" };
+
+// run every .yrp in path through the engine on a pool of threads and print one line per replay.
+// returns false when any replay did not end cleanly; surrendered or timed out duels show up as missing
+bool ReplayVerifier::VerifyDirectory(const char* path, unsigned int workers) {
+	std::vector<VerifyResult> results;
+	FileSystem::TraversalDir(path, [&results](const char* name, bool isdir) {
+		if(!isdir && strrchr(name, '.') && !mystrncasecmp(strrchr(name, '.'), ".yrp", 4)) {
+			VerifyResult result;
+			result.name = name;
+			results.push_back(result);
+		}
+	});
+	if(!workers)
+		workers = std::thread::hardware_concurrency();
+	if(!workers)
+		workers = 1;
+	if(workers > results.size())
+		workers = results.size();
+	set_script_reader((script_reader)DataManager::ScriptReaderEx);
+	set_card_reader((card_reader)DataManager::CardReader);
+	set_message_handler((message_handler)MessageHandler);
+	auto start = std::chrono::steady_clock::now();
+	std::atomic<size_t> next(0);
+	std::vector<std::thread> threads;
+	for(unsigned int i = 0; i < workers; ++i) {
+		threads.emplace_back([path, &results, &next]() {
+			size_t index;
+			while((index = next++) < results.size()) {
+				char fpath[1024];
+				snprintf(fpath, sizeof(fpath), "%s/%s", path, results[index].name.c_str());
+				VerifyReplay(fpath, results[index]);
+			}
+		});
+	}
+	for(auto& thread : threads)
+		thread.join();
+	double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	int count[5] = { 0 };
+	for(auto& result : results) {
+		count[result.status]++;
+		printf("%s\t%s\twinner %d\treason %d\tresponses %d\tleftover %d\t%.1f ms\n", result.name.c_str(), status_name[result.status],
+		       result.winner, result.reason, result.responses, result.leftover, result.time);
+	}
+	fprintf(stderr, "%d replays in %.1f s on %u threads: %d ok, %d leftover, %d missing, %d rejected, %d unreadable\n",
+	        (int)results.size(), total, workers, count[VERIFY_OK], count[VERIFY_LEFTOVER], count[VERIFY_MISSING],
+	        count[VERIFY_REJECTED], count[VERIFY_UNREADABLE]);
+	return count[VERIFY_OK] == (int)results.size();
+}
+void ReplayVerifier::VerifyReplay(const char* path, VerifyResult& result) {
+	auto start = std::chrono::steady_clock::now();
+	result.status = VERIFY_UNREADABLE;
+	result.winner = -1;
+	result.reason = 0;
+	result.responses = 0;
+	result.leftover = 0;
+	result.time = 0;
+	Replay replay;
+	wchar_t wpath[1024];
+	BufferIO::DecodeUTF8(path, wpath);
+	if(!replay.OpenReplay(wpath))
+		return;
+	long pduel = LoadDuel(replay);
+	if(!pduel)
+		return;
+	char engineBuffer[0x1000];
+	unsigned char resp[64];
+	if(replay.pheader.flag & REPLAY_SINGLE_MODE)
+		get_message(pduel, (byte*)engineBuffer);
+	int status = VERIFY_OK;
+	while(true) {
+		int ret = process(pduel);
+		int len = ret & 0xffff;
+		int flag = ret >> 16;
+		if(len > 0) {
+			get_message(pduel, (byte*)engineBuffer);
+			// the engine returns right after writing either message, so it always leads its batch
+			if(engineBuffer[0] == MSG_WIN) {
+				result.winner = engineBuffer[1];
+				result.reason = engineBuffer[2];
+				break;
+			}
+			if(engineBuffer[0] == MSG_RETRY) {
+				status = VERIFY_REJECTED;
+				break;
+			}
+		}
+		if(flag == 2)
+			break;
+		if(flag == 1) {
+			if(!replay.ReadNextResponse(resp)) {
+				status = VERIFY_MISSING;
+				break;
+			}
+			set_responseb(pduel, resp);
+			result.responses++;
+		}
+	}
+	if(status == VERIFY_OK) {
+		while(replay.ReadNextResponse(resp))
+			result.leftover++;
+		if(result.leftover)
+			status = VERIFY_LEFTOVER;
+	}
+	{
+		std::lock_guard<std::mutex> lock(NetServer::engine_mutex);
+		end_duel(pduel);
+	}
+	result.status = status;
+	result.time = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+// the engine half of ReplayMode::StartDuel
+long ReplayVerifier::LoadDuel(Replay& replay) {
+	const ReplayHeader& rh = replay.pheader;
+	mtrandom rnd;
+	int seed = rh.seed;
+	rnd.reset(seed);
+	wchar_t name[20];
+	int names = (rh.flag & REPLAY_TAG) ? 4 : 2;
+	if(!HasData(replay, names * 40 + 16))
+		return 0;
+	for(int i = 0; i < names; ++i)
+		replay.ReadName(name);
+	long pduel;
+	{
+		std::lock_guard<std::mutex> lock(NetServer::engine_mutex);
+		pduel = create_duel(rnd.rand());
+	}
+	int start_lp = replay.ReadInt32();
+	int start_hand = replay.ReadInt32();
+	int draw_count = replay.ReadInt32();
+	int opt = replay.ReadInt32();
+	set_player_info(pduel, 0, start_lp, start_hand, draw_count);
+	set_player_info(pduel, 1, start_lp, start_hand, draw_count);
+	bool loaded = true;
+	if(!(rh.flag & REPLAY_SINGLE_MODE)) {
+		loaded = LoadDeck(pduel, replay, 0, false);
+		if(loaded && (opt & DUEL_TAG_MODE))
+			loaded = LoadDeck(pduel, replay, 0, true);
+		if(loaded)
+			loaded = LoadDeck(pduel, replay, 1, false);
+		if(loaded && (opt & DUEL_TAG_MODE))
+			loaded = LoadDeck(pduel, replay, 1, true);
+	} else {
+		char filename[256];
+		size_t slen = HasData(replay, 2) ? replay.ReadInt16() : 0;
+		if(slen >= sizeof(filename) || !HasData(replay, slen))
+			slen = 0;
+		replay.ReadData(filename, slen);
+		filename[slen] = 0;
+		loaded = slen && preload_script(pduel, filename, 0);
+	}
+	if(!loaded) {
+		std::lock_guard<std::mutex> lock(NetServer::engine_mutex);
+		end_duel(pduel);
+		return 0;
+	}
+	start_duel(pduel, opt);
+	return pduel;
+}
+bool ReplayVerifier::LoadDeck(long pduel, Replay& replay, int player, bool tag) {
+	if(!HasData(replay, 4))
+		return false;
+	int main = replay.ReadInt32();
+	if(main < 0 || !HasData(replay, main * 4 + 4))
+		return false;
+	for(int i = 0; i < main; ++i) {
+		if(tag)
+			new_tag_card(pduel, replay.ReadInt32(), player, LOCATION_DECK);
+		else
+			new_card(pduel, replay.ReadInt32(), player, player, LOCATION_DECK, 0, POS_FACEDOWN_DEFENSE);
+	}
+	int extra = replay.ReadInt32();
+	if(extra < 0 || !HasData(replay, extra * 4))
+		return false;
+	for(int i = 0; i < extra; ++i) {
+		if(tag)
+			new_tag_card(pduel, replay.ReadInt32(), player, LOCATION_EXTRA);
+		else
+			new_card(pduel, replay.ReadInt32(), player, player, LOCATION_EXTRA, 0, POS_FACEDOWN_DEFENSE);
+	}
+	return true;
+}
+// archived files may be truncated, and the Replay readers do not check for the end of the data
+bool ReplayVerifier::HasData(Replay& replay, size_t length) {
+	return replay.replay_size - (replay.pdata - replay.replay_data.data()) >= length;
+}
+int ReplayVerifier::MessageHandler(long fduel, int type) {
+	if(!enable_log)
+		return 0;
+	char msgbuf[1024];
+	get_log_message(fduel, (byte*)msgbuf);
+	fprintf(stderr, "%s\n", msgbuf);
+	return 0;
+}
+
+}
@@ -0,0 +1,41 @@
+#ifndef REPLAY_VERIFIER_H
+#define REPLAY_VERIFIER_H
+
+#include "config.h"
+#include "replay.h"
+#include <string>
+#include <vector>
+
+namespace ygo {
+
+#define VERIFY_OK			0 // the duel ended and every response was used
+#define VERIFY_LEFTOVER		1 // the duel ended before the last response
+#define VERIFY_MISSING		2 // the engine waits for a response the replay does not have
+#define VERIFY_REJECTED		3 // the engine refused a response (MSG_RETRY)
+#define VERIFY_UNREADABLE	4 // the file or its single mode script could not be loaded
+
+struct VerifyResult {
+	std::string name;
+	int status;
+	int winner;
+	int reason;
+	int responses;
+	int leftover;
+	double time;
+};
+
+class ReplayVerifier {
+public:
+	static bool VerifyDirectory(const char* path, unsigned int workers = 0);
+	static void VerifyReplay(const char* path, VerifyResult& result);
+
+private:
+	static long LoadDuel(Replay& replay);
+	static bool LoadDeck(long pduel, Replay& replay, int player, bool tag);
+	static bool HasData(Replay& replay, size_t length);
+	static int MessageHandler(long fduel, int type);
+};
+
+}
+
+#endif //REPLAY_VERIFIER_H
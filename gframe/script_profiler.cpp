@@ -0,0 +1,188 @@
+#include "script_profiler.h"
+#include "data_manager.h"
+#include <algorithm>
+#include <chrono>
+
+namespace ygo {
+
+std::string ScriptProfiler::report_file;
+std::unordered_map<std::string, ScriptTotals> ScriptProfiler::totals;
+unsigned long long ScriptProfiler::duels = 0;
+std::mutex ScriptProfiler::totals_mutex;
+
+// must be called before the first duel, every Lua state created from then on is profiled
+void ScriptProfiler::Enable(const char* report) {
+	report_file = report;
+	lua_userstateopen = StateOpen;
+	lua_userstateclose = StateClose;
+}
+// the reader to give to set_script_reader, so that loads are counted as well
+unsigned char* ScriptProfiler::ScriptReader(const char* script_name, int* slen) {
+	unsigned long long start = Nanos();
+	unsigned char* buffer = (unsigned char*)DataManager::ScriptReaderEx(script_name, slen);
+	unsigned long long elapsed = Nanos() - start;
+	std::lock_guard<std::mutex> lock(totals_mutex);
+	ScriptTotals& script = totals[ScriptName(script_name)];
+	script.loads++;
+	script.load_time += elapsed;
+	return buffer;
+}
+// the totals of the duels that have ended; reset starts a new measurement
+void ScriptProfiler::Dump(bool reset) {
+	std::lock_guard<std::mutex> lock(totals_mutex);
+	WriteReport();
+	if(reset) {
+		totals.clear();
+		duels = 0;
+	}
+}
+void ScriptProfiler::StateOpen(lua_State* L) {
+	StateProfile* profile = new StateProfile;
+	profile->alloc = lua_getallocf(L, &profile->alloc_ud);
+	profile->self = -1;
+	profile->owner = -1;
+	profile->last_time = 0;
+	// the hook finds the profile as the userdata of the allocator
+	lua_setallocf(L, Alloc, profile);
+	lua_sethook(L, Hook, LUA_MASKCALL | LUA_MASKRET, 0);
+}
+void ScriptProfiler::StateClose(lua_State* L) {
+	void* ud;
+	if(lua_getallocf(L, &ud) != Alloc)
+		return;
+	StateProfile* profile = (StateProfile*)ud;
+	lua_sethook(L, NULL, 0, 0);
+	lua_setallocf(L, profile->alloc, profile->alloc_ud);
+	{
+		std::lock_guard<std::mutex> lock(totals_mutex);
+		for(auto& script : profile->scripts) {
+			ScriptTotals& total = totals[script.name];
+			total.calls += script.totals.calls;
+			total.self_time += script.totals.self_time;
+			total.card_time += script.totals.card_time;
+			total.alloc_bytes += script.totals.alloc_bytes;
+		}
+		duels++;
+		WriteReport();
+	}
+	delete profile;
+}
+// the time since the last event goes to the innermost Lua function, and to the innermost card
+// script on the stack; a C function like Duel.SelectMatchingCard counts for its caller
+void ScriptProfiler::Hook(lua_State* L, lua_Debug* ar) {
+	void* ud;
+	lua_getallocf(L, &ud);
+	StateProfile* profile = (StateProfile*)ud;
+	lua_Debug frame;
+	Charge(profile);
+	// a tail call takes over the frame of its caller, at level 1 until the hook returns;
+	// the card of the caller is kept for that frame
+	if(ar->event == LUA_HOOKTAILCALL && lua_getstack(L, 1, &frame))
+		profile->tail_owners[frame.i_ci] = profile->owner;
+	profile->self = -1;
+	profile->owner = -1;
+	// while a function returns, level 0 is still the returning one
+	int level = (ar->event == LUA_HOOKRET) ? 1 : 0;
+	for(; lua_getstack(L, level, &frame); ++level) {
+		lua_getinfo(L, "St", &frame);
+		if(frame.what[0] == 'C')
+			continue;
+		int script = GetScript(profile, frame.source);
+		if(level == 0)
+			profile->scripts[script].totals.calls++;
+		if(profile->self < 0)
+			profile->self = script;
+		if(profile->scripts[script].card) {
+			profile->owner = script;
+			break;
+		}
+		if(frame.istailcall) {
+			auto it = profile->tail_owners.find(frame.i_ci);
+			if(it != profile->tail_owners.end() && it->second >= 0) {
+				profile->owner = it->second;
+				break;
+			}
+		}
+	}
+	if(profile->owner < 0)
+		profile->owner = profile->self;
+	// the hook itself is not charged
+	profile->last_time = Nanos();
+}
+void* ScriptProfiler::Alloc(void* ud, void* ptr, size_t osize, size_t nsize) {
+	StateProfile* profile = (StateProfile*)ud;
+	// without a block, osize is the type of the new object
+	size_t old = ptr ? osize : 0;
+	if(nsize > old && profile->owner >= 0)
+		profile->scripts[profile->owner].totals.alloc_bytes += nsize - old;
+	return profile->alloc(profile->alloc_ud, ptr, osize, nsize);
+}
+// sources are looked up by address, which stays valid as long as a function of the chunk is alive
+int ScriptProfiler::GetScript(StateProfile* profile, const char* source) {
+	auto it = profile->sources.find(source);
+	if(it != profile->sources.end() && profile->scripts[it->second].source == source)
+		return it->second;
+	int index = 0;
+	while(index < (int)profile->scripts.size() && profile->scripts[index].source != source)
+		index++;
+	if(index == (int)profile->scripts.size()) {
+		ScriptEntry entry;
+		entry.source = source;
+		entry.name = ScriptName(source);
+		const char* name = entry.name.c_str();
+		size_t len = entry.name.length();
+		entry.card = name[0] == 'c' && name[1] >= '0' && name[1] <= '9' && len > 4 && !strcmp(name + len - 4, ".lua");
+		profile->scripts.push_back(entry);
+	}
+	profile->sources[source] = index;
+	return index;
+}
+void ScriptProfiler::Charge(StateProfile* profile) {
+	if(profile->self < 0)
+		return;
+	unsigned long long elapsed = Nanos() - profile->last_time;
+	profile->scripts[profile->self].totals.self_time += elapsed;
+	profile->scripts[profile->owner].totals.card_time += elapsed;
+}
+// "./script/c12345.lua" and "@script/c12345.lua" are both c12345.lua
+const char* ScriptProfiler::ScriptName(const char* source) {
+	if(strchr(source, '\n'))
+		return "(string)";
+	if(source[0] == '@' || source[0] == '=')
+		source++;
+	const char* name = source;
+	for(const char* p = source; *p; ++p) {
+		if(*p == '/' || *p == '\\')
+			name = p + 1;
+	}
+	return name;
+}
+// written to a temporary file first, so that a reader never sees half of it
+void ScriptProfiler::WriteReport() {
+	std::vector<std::pair<std::string, ScriptTotals>> rows(totals.begin(), totals.end());
+	std::sort(rows.begin(), rows.end(), [](const std::pair<std::string, ScriptTotals>& a, const std::pair<std::string, ScriptTotals>& b) {
+		return a.second.card_time > b.second.card_time;
+	});
+	std::string temp = report_file + ".tmp";
+	FILE* fp = fopen(temp.c_str(), "w");
+	if(!fp)
+		return;
+	fprintf(fp, "script profile of %llu duels, %d scripts\n", duels, (int)rows.size());
+	fprintf(fp, "card ms: time with the card on the Lua stack, self ms: time in its own functions\n\n");
+	fprintf(fp, "%-24s %10s %12s %12s %12s %8s %10s\n", "script", "calls", "card ms", "self ms", "alloc KB", "loads", "load ms");
+	if(rows.size() > PROFILE_ROWS)
+		rows.resize(PROFILE_ROWS);
+	for(auto& row : rows) {
+		const ScriptTotals& script = row.second;
+		fprintf(fp, "%-24s %10llu %12.1f %12.1f %12llu %8llu %10.1f\n", row.first.c_str(), script.calls,
+		        script.card_time / 1e6, script.self_time / 1e6, script.alloc_bytes / 1024, script.loads, script.load_time / 1e6);
+	}
+	fclose(fp);
+	remove(report_file.c_str());
+	rename(temp.c_str(), report_file.c_str());
+}
+unsigned long long ScriptProfiler::Nanos() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}
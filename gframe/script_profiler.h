@@ -0,0 +1,72 @@
+#ifndef SCRIPT_PROFILER_H
+#define SCRIPT_PROFILER_H
+
+#include "../lua/lua.h"
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ygo {
+
+#define PROFILE_ROWS	200 // scripts listed in the report, the slowest first
+
+struct ScriptTotals {
+	ScriptTotals(): calls(0), self_time(0), card_time(0), alloc_bytes(0), loads(0), load_time(0) {}
+	unsigned long long calls;
+	unsigned long long self_time; // nanoseconds in the functions of the script
+	unsigned long long card_time; // nanoseconds on behalf of the card, shared helpers included
+	unsigned long long alloc_bytes;
+	unsigned long long loads;
+	unsigned long long load_time;
+};
+
+struct ScriptEntry {
+	std::string source;
+	std::string name;
+	bool card;
+	ScriptTotals totals;
+};
+
+// the counters of one Lua state; only touched by the thread running its duel
+struct StateProfile {
+	lua_Alloc alloc;
+	void* alloc_ud;
+	std::vector<ScriptEntry> scripts;
+	std::unordered_map<const char*, int> sources;
+	std::unordered_map<const void*, int> tail_owners;
+	int self;
+	int owner;
+	unsigned long long last_time;
+};
+
+// opt-in attribution of engine time and Lua allocations to the card scripts.
+// every Lua state gets a call hook and a counting allocator; the totals are merged when
+// the duel ends and written as a ranked report then, and on request
+class ScriptProfiler {
+public:
+	static void Enable(const char* report);
+	static bool IsEnabled() { return !report_file.empty(); }
+	static unsigned char* ScriptReader(const char* script_name, int* slen);
+	static void Dump(bool reset = false);
+
+private:
+	static void StateOpen(lua_State* L);
+	static void StateClose(lua_State* L);
+	static void Hook(lua_State* L, lua_Debug* ar);
+	static void* Alloc(void* ud, void* ptr, size_t osize, size_t nsize);
+	static int GetScript(StateProfile* profile, const char* source);
+	static void Charge(StateProfile* profile);
+	static const char* ScriptName(const char* source);
+	static void WriteReport();
+	static unsigned long long Nanos();
+
+	static std::string report_file;
+	static std::unordered_map<std::string, ScriptTotals> totals;
+	static unsigned long long duels;
+	static std::mutex totals_mutex;
+};
+
+}
+
+#endif //SCRIPT_PROFILER_H
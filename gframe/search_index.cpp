@@ -0,0 +1,211 @@
+#include "search_index.h"
+#include "data_manager.h"
+
+namespace ygo {
+
+void SearchIndex::Build() {
+	cards.clear();
+	strings.clear();
+	type_cards.clear();
+	race_cards.clear();
+	attribute_cards.clear();
+	attack.clear();
+	defense.clear();
+	level.clear();
+	lscale.clear();
+	name_grams.clear();
+	text_grams.clear();
+	set_cards.clear();
+	data_count = dataManager._datas.size();
+	pool_count = dataManager._stringPool.size();
+	for(code_pointer ptr = dataManager._datas.begin(); ptr != dataManager._datas.end(); ++ptr) {
+		const CardString* text = dataManager.GetCardString(ptr->first);
+		if(!text)
+			continue;
+		cards.push_back(ptr);
+		strings.push_back(text);
+	}
+	for(unsigned int index = 0; index < cards.size(); ++index) {
+		const CardDataC& data = cards[index]->second;
+		for(unsigned int type = 1; type; type <<= 1) {
+			if(data.type & type)
+				SetBit(type_cards, type, index);
+		}
+		SetBit(race_cards, data.race, index);
+		SetBit(attribute_cards, data.attribute, index);
+		attack.push_back(data.attack);
+		defense.push_back(data.defense);
+		level.push_back(data.level);
+		lscale.push_back(data.lscale);
+		AddGrams(name_grams, strings[index]->name, index, true);
+		AddGrams(text_grams, strings[index]->text, index, false);
+		// same set code resolution as the deck builder filter
+		unsigned long long sc = data.setcode;
+		if(data.alias) {
+			auto aptr = dataManager._datas.find(data.alias);
+			if(aptr != dataManager._datas.end())
+				sc = aptr->second.setcode;
+		}
+		for(; sc; sc >>= 16) {
+			std::vector<unsigned int>& list = set_cards[sc & 0xfff];
+			if(list.empty() || list.back() != index)
+				list.push_back(index);
+		}
+	}
+}
+// every database load adds cards or replaces their strings with a new pool
+bool SearchIndex::IsStale() const {
+	return data_count != dataManager._datas.size() || pool_count != dataManager._stringPool.size();
+}
+void SearchIndex::All(CardMask& mask) const {
+	mask.assign((cards.size() + 63) / 64, ~0ULL);
+	if(cards.size() % 64)
+		mask.back() = (1ULL << (cards.size() % 64)) - 1;
+}
+void SearchIndex::Add(CardMask& mask, const CardMask& other) const {
+	for(size_t i = 0; i < mask.size(); ++i)
+		mask[i] |= other[i];
+}
+void SearchIndex::Intersect(CardMask& mask, const CardMask& other) const {
+	for(size_t i = 0; i < mask.size(); ++i)
+		mask[i] &= other[i];
+}
+void SearchIndex::Intersect(CardMask& mask, const std::unordered_map<unsigned int, CardMask>& table, unsigned int key) const {
+	auto it = table.find(key);
+	if(it == table.end())
+		mask.assign(mask.size(), 0);
+	else
+		Intersect(mask, it->second);
+}
+void SearchIndex::Exclude(CardMask& mask, const std::unordered_map<unsigned int, CardMask>& table, unsigned int key) const {
+	auto it = table.find(key);
+	if(it == table.end())
+		return;
+	for(size_t i = 0; i < mask.size(); ++i)
+		mask[i] &= ~it->second[i];
+}
+// the deck builder filter types: 1 equal, 2 at least, 3 greater, 4 at most, 5 less, 6 "?"
+// ATK and DEF filters 4 and 5 skip "?" (negative values); DEF never matches link monsters
+void SearchIndex::MatchAttack(CardMask& mask, unsigned int filter_type, int value) const {
+	if(filter_type == 4 || filter_type == 5)
+		FilterColumn(mask, attack, [](int v) { return v >= 0; });
+	if(filter_type == 6)
+		FilterColumn(mask, attack, [](int v) { return v == -2; });
+	else
+		FilterRange(mask, attack, filter_type, value);
+}
+void SearchIndex::MatchDefense(CardMask& mask, unsigned int filter_type, int value) const {
+	if(!filter_type)
+		return;
+	Exclude(mask, type_cards, TYPE_LINK);
+	if(filter_type == 4 || filter_type == 5)
+		FilterColumn(mask, defense, [](int v) { return v >= 0; });
+	if(filter_type == 6)
+		FilterColumn(mask, defense, [](int v) { return v == -2; });
+	else
+		FilterRange(mask, defense, filter_type, value);
+}
+void SearchIndex::MatchLevel(CardMask& mask, unsigned int filter_type, unsigned int value) const {
+	if(filter_type == 6)
+		mask.assign(mask.size(), 0);
+	else
+		FilterRange(mask, level, filter_type, value);
+}
+void SearchIndex::MatchScale(CardMask& mask, unsigned int filter_type, unsigned int value) const {
+	if(!filter_type)
+		return;
+	Intersect(mask, type_cards, TYPE_PENDULUM);
+	if(filter_type == 6)
+		mask.assign(mask.size(), 0);
+	else
+		FilterRange(mask, lscale, filter_type, value);
+}
+template<typename T>
+void SearchIndex::FilterRange(CardMask& mask, const std::vector<T>& column, unsigned int filter_type, T value) {
+	switch(filter_type) {
+	case 1:
+		FilterColumn(mask, column, [value](T v) { return v == value; });
+		break;
+	case 2:
+		FilterColumn(mask, column, [value](T v) { return v >= value; });
+		break;
+	case 3:
+		FilterColumn(mask, column, [value](T v) { return v > value; });
+		break;
+	case 4:
+		FilterColumn(mask, column, [value](T v) { return v <= value; });
+		break;
+	case 5:
+		FilterColumn(mask, column, [value](T v) { return v < value; });
+		break;
+	}
+}
+// cards whose normalized name holds every trigram of the normalized keyword
+void SearchIndex::MatchName(CardMask& mask, const wchar_t* keyword) const {
+	MatchGrams(mask, name_grams, keyword, true);
+}
+// cards whose text holds every trigram of the keyword, case sensitive like the text filter
+void SearchIndex::MatchText(CardMask& mask, const wchar_t* keyword) const {
+	MatchGrams(mask, text_grams, keyword, false);
+}
+void SearchIndex::MatchSetCode(CardMask& mask, unsigned int setcode) const {
+	mask.assign((cards.size() + 63) / 64, 0);
+	auto it = set_cards.find(setcode & 0xfff);
+	if(it == set_cards.end())
+		return;
+	for(unsigned int index : it->second)
+		mask[index / 64] |= 1ULL << (index % 64);
+}
+void SearchIndex::Collect(const CardMask& mask, std::vector<unsigned int>& result) const {
+	result.clear();
+	for(size_t i = 0; i < mask.size(); ++i) {
+		for(unsigned long long bits = mask[i]; bits; bits &= bits - 1) {
+			unsigned int bit = 0;
+			while(!(bits & (1ULL << bit)))
+				bit++;
+			result.push_back(i * 64 + bit);
+		}
+	}
+}
+unsigned long long SearchIndex::GramKey(wchar_t a, wchar_t b, wchar_t c) {
+	return ((unsigned long long)(a & 0x1fffff) << 42) | ((unsigned long long)(b & 0x1fffff) << 21) | (c & 0x1fffff);
+}
+void SearchIndex::AddGrams(GramTable& table, const wchar_t* str, unsigned int index, bool normalize) {
+	size_t len = wcslen(str);
+	for(size_t i = 0; i + 2 < len; ++i) {
+		unsigned long long key = normalize ? GramKey(NormalizeChar(str[i]), NormalizeChar(str[i + 1]), NormalizeChar(str[i + 2]))
+		                                   : GramKey(str[i], str[i + 1], str[i + 2]);
+		std::vector<unsigned int>& list = table[key];
+		if(list.empty() || list.back() != index)
+			list.push_back(index);
+	}
+}
+// keywords shorter than a trigram can not be narrowed and match every card
+void SearchIndex::MatchGrams(CardMask& mask, const GramTable& table, const wchar_t* keyword, bool normalize) const {
+	All(mask);
+	size_t len = wcslen(keyword);
+	if(len < 3)
+		return;
+	CardMask gram_mask(mask.size());
+	for(size_t i = 0; i + 2 < len; ++i) {
+		unsigned long long key = normalize ? GramKey(NormalizeChar(keyword[i]), NormalizeChar(keyword[i + 1]), NormalizeChar(keyword[i + 2]))
+		                                   : GramKey(keyword[i], keyword[i + 1], keyword[i + 2]);
+		auto it = table.find(key);
+		if(it == table.end()) {
+			mask.assign(mask.size(), 0);
+			return;
+		}
+		gram_mask.assign(mask.size(), 0);
+		for(unsigned int index : it->second)
+			gram_mask[index / 64] |= 1ULL << (index % 64);
+		Intersect(mask, gram_mask);
+	}
+}
+void SearchIndex::SetBit(std::unordered_map<unsigned int, CardMask>& table, unsigned int key, unsigned int index) {
+	CardMask& mask = table[key];
+	if(mask.empty())
+		mask.resize((cards.size() + 63) / 64);
+	mask[index / 64] |= 1ULL << (index % 64);
+}
+
+}
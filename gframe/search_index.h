@@ -0,0 +1,101 @@
+#ifndef SEARCH_INDEX_H
+#define SEARCH_INDEX_H
+
+#include "config.h"
+#include "client_card.h"
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+namespace ygo {
+
+static inline wchar_t NormalizeChar(wchar_t c) {
+	/*
+	// Convert all symbols and punctuations to space.
+	if (c != 0 && c < 128 && !isalnum(c)) {
+		return ' ';
+	}
+	*/
+	// Convert latin chararacters to uppercase to ignore case.
+	if (c < 128 && isalpha(c)) {
+		return toupper(c);
+	}
+	// Remove some accentued characters that are not supported by the editbox.
+	if (c >= 232 && c <= 235) {
+		return 'E';
+	}
+	if (c >= 238 && c <= 239) {
+		return 'I';
+	}
+	return c;
+}
+
+// a bit per card of the index, in index order
+typedef std::vector<unsigned long long> CardMask;
+
+// lookup tables over all loaded cards, built once, that narrow a deck builder search down to the
+// cards that can possibly match; every candidate still has to be checked against the real filter
+class SearchIndex {
+public:
+	SearchIndex(): data_count(0), pool_count(0) {}
+	void Build();
+	bool IsStale() const;
+	void All(CardMask& mask) const;
+	void Add(CardMask& mask, const CardMask& other) const;
+	void Intersect(CardMask& mask, const CardMask& other) const;
+	void Intersect(CardMask& mask, const std::unordered_map<unsigned int, CardMask>& table, unsigned int key) const;
+	void Exclude(CardMask& mask, const std::unordered_map<unsigned int, CardMask>& table, unsigned int key) const;
+	void MatchAttack(CardMask& mask, unsigned int filter_type, int value) const;
+	void MatchDefense(CardMask& mask, unsigned int filter_type, int value) const;
+	void MatchLevel(CardMask& mask, unsigned int filter_type, unsigned int value) const;
+	void MatchScale(CardMask& mask, unsigned int filter_type, unsigned int value) const;
+	void MatchName(CardMask& mask, const wchar_t* keyword) const;
+	void MatchText(CardMask& mask, const wchar_t* keyword) const;
+	void MatchSetCode(CardMask& mask, unsigned int setcode) const;
+	void Collect(const CardMask& mask, std::vector<unsigned int>& result) const;
+
+	std::vector<code_pointer> cards;
+	std::vector<const CardString*> strings;
+	std::unordered_map<unsigned int, CardMask> type_cards;
+	std::unordered_map<unsigned int, CardMask> race_cards;
+	std::unordered_map<unsigned int, CardMask> attribute_cards;
+	// attribute columns in index order, for the range filters
+	std::vector<int> attack;
+	std::vector<int> defense;
+	std::vector<unsigned int> level;
+	std::vector<unsigned int> lscale;
+
+private:
+	typedef std::unordered_map<unsigned long long, std::vector<unsigned int>> GramTable;
+
+	// and a column predicate into mask, a word of 64 cards at a time; the inner loop has no
+	// branches so that the compiler can vectorize it
+	template<typename T, typename Pred>
+	static void FilterColumn(CardMask& mask, const std::vector<T>& column, Pred pred) {
+		for(size_t word = 0; word < mask.size(); ++word) {
+			const T* values = column.data() + word * 64;
+			size_t count = std::min<size_t>(64, column.size() - word * 64);
+			unsigned long long bits = 0;
+			for(size_t i = 0; i < count; ++i)
+				bits |= (unsigned long long)pred(values[i]) << i;
+			mask[word] &= bits;
+		}
+	}
+	template<typename T>
+	static void FilterRange(CardMask& mask, const std::vector<T>& column, unsigned int filter_type, T value);
+
+	static unsigned long long GramKey(wchar_t a, wchar_t b, wchar_t c);
+	static void AddGrams(GramTable& table, const wchar_t* str, unsigned int index, bool normalize);
+	void MatchGrams(CardMask& mask, const GramTable& table, const wchar_t* keyword, bool normalize) const;
+	void SetBit(std::unordered_map<unsigned int, CardMask>& table, unsigned int key, unsigned int index);
+
+	size_t data_count;
+	size_t pool_count;
+	GramTable name_grams;
+	GramTable text_grams;
+	std::unordered_map<unsigned int, std::vector<unsigned int>> set_cards;
+};
+
+}
+
+#endif //SEARCH_INDEX_H
@@ -0,0 +1,15 @@
+project "ygoserver"
+    kind "ConsoleApp"
+
+    defines { "YGOPRO_SERVER_MODE" }
+    files { "*.cpp", "../data_manager.cpp", "../deck_manager.cpp", "../duel_mode.cpp", "../netserver.cpp", "../replay.cpp", "../replay_verifier.cpp", "../script_profiler.cpp", "../server_stats.cpp", "../single_duel.cpp", "../tag_duel.cpp", "../timer_wheel.cpp" }
+    includedirs { "../../ocgcore" }
+    links { "ocgcore", "clzma", "sqlite3", "lua" , "event" }
+
+    configuration "windows"
+        includedirs { "../../event/include", "../../sqlite3" }
+        links { "ws2_32" }
+    configuration "not vs*"
+        buildoptions { "-std=c++14", "-fno-rtti" }
+    configuration "not windows"
+        links { "event_pthreads", "dl", "pthread" }
@@ -0,0 +1,188 @@
+#include "../config.h"
+#include "../data_manager.h"
+#include "../deck_manager.h"
+#include "../netserver.h"
+#include "../replay_verifier.h"
+#include "../script_profiler.h"
+#include <event2/thread.h>
+#include <signal.h>
+
+int enable_log = 0;
+bool exit_on_return = false;
+bool open_file = false;
+wchar_t open_file_name[256] = L"";
+bool bot_mode = false;
+bool prefer_expansion_script = false;
+
+static volatile sig_atomic_t stop_requested = 0;
+static volatile sig_atomic_t profile_requested = 0;
+
+static void OnStopSignal(int sig) {
+	stop_requested = 1;
+}
+#ifndef _WIN32
+static void OnProfileSignal(int sig) {
+	profile_requested = 1;
+}
+#endif
+
+struct ServerConfig {
+	unsigned short serverport;
+	unsigned int workers;
+	unsigned int observer_delay;
+	bool script_cache;
+	bool script_precompile;
+	char stats_file[256];
+	unsigned int stats_interval;
+	char script_profile[256];
+};
+
+// written to a temporary file first, so that a reader never sees half of it
+static void WriteStats(const char* file) {
+	char temp[300];
+	snprintf(temp, sizeof(temp), "%s.tmp", file);
+	FILE* fp = fopen(temp, "w");
+	if(!fp)
+		return;
+	ygo::ServerStats::Write(fp);
+	ygo::NetServer::WriteRoomStats(fp);
+	fclose(fp);
+	remove(file);
+	rename(temp, file);
+}
+
+static void LoadConfig(ServerConfig& conf) {
+	conf.serverport = 7911;
+	conf.workers = std::thread::hardware_concurrency();
+	conf.observer_delay = 0;
+	conf.script_cache = true;
+	conf.script_precompile = false;
+	conf.stats_file[0] = 0;
+	conf.stats_interval = 10;
+	conf.script_profile[0] = 0;
+	FILE* fp = fopen("system.conf", "r");
+	if(!fp)
+		return;
+	char linebuf[256];
+	char strbuf[32];
+	char valbuf[256];
+	while(fgets(linebuf, 256, fp)) {
+		sscanf(linebuf, "%s = %s", strbuf, valbuf);
+		if(!strcmp(strbuf, "serverport")) {
+			conf.serverport = atoi(valbuf);
+		} else if(!strcmp(strbuf, "server_workers")) {
+			conf.workers = atoi(valbuf);
+		} else if(!strcmp(strbuf, "observer_delay")) {
+			conf.observer_delay = atoi(valbuf);
+		} else if(!strcmp(strbuf, "script_cache")) {
+			conf.script_cache = atoi(valbuf) != 0;
+		} else if(!strcmp(strbuf, "script_precompile")) {
+			conf.script_precompile = atoi(valbuf) != 0;
+		} else if(!strcmp(strbuf, "stats_file")) {
+			strncpy(conf.stats_file, valbuf, sizeof(conf.stats_file) - 1);
+			conf.stats_file[sizeof(conf.stats_file) - 1] = 0;
+		} else if(!strcmp(strbuf, "stats_interval")) {
+			conf.stats_interval = atoi(valbuf);
+		} else if(!strcmp(strbuf, "script_profile")) {
+			strncpy(conf.script_profile, valbuf, sizeof(conf.script_profile) - 1);
+			conf.script_profile[sizeof(conf.script_profile) - 1] = 0;
+		} else if(!strcmp(strbuf, "prefer_expansion_script")) {
+			prefer_expansion_script = atoi(valbuf) != 0;
+		} else if(!strcmp(strbuf, "enable_log")) {
+			enable_log = atoi(valbuf);
+		}
+	}
+	fclose(fp);
+}
+
+int main(int argc, char* argv[]) {
+#ifndef _WIN32
+	setlocale(LC_CTYPE, "UTF-8");
+#endif
+#ifdef _WIN32
+	WORD wVersionRequested;
+	WSADATA wsaData;
+	wVersionRequested = MAKEWORD(2, 2);
+	WSAStartup(wVersionRequested, &wsaData);
+	evthread_use_windows_threads();
+#else
+	evthread_use_pthreads();
+	signal(SIGPIPE, SIG_IGN);
+#endif //_WIN32
+	ServerConfig conf;
+	LoadConfig(conf);
+	const char* verify_path = 0;
+	for(int i = 1; i < argc; ++i) {
+		if(!strcmp(argv[i], "-p") && i + 1 < argc) {
+			conf.serverport = atoi(argv[++i]);
+		} else if(!strcmp(argv[i], "-w") && i + 1 < argc) {
+			conf.workers = atoi(argv[++i]);
+		} else if(!strcmp(argv[i], "-x")) {
+			prefer_expansion_script = true;
+		} else if(!strcmp(argv[i], "-l")) {
+			enable_log = 1;
+		} else if(!strcmp(argv[i], "--verify-replays") && i + 1 < argc) {
+			verify_path = argv[++i];
+		} else {
+			fprintf(stderr, "usage: %s [-p port] [-w workers] [-x] [-l] [--verify-replays dir]\n", argv[0]);
+			return 1;
+		}
+	}
+	ygo::deckManager.LoadLFList();
+	FileSystem::TraversalDir("./expansions", [](const char* name, bool isdir) {
+		if(!isdir && strrchr(name, '.') && !mystrncasecmp(strrchr(name, '.'), ".cdb", 4)) {
+			char fpath[1024];
+			sprintf(fpath, "./expansions/%s", name);
+			ygo::dataManager.LoadDB(fpath);
+		}
+	});
+	if(!ygo::dataManager.LoadDB("cards.cdb")) {
+		fprintf(stderr, "Failed to load cards.cdb\n");
+		return 1;
+	}
+	if(conf.script_cache) {
+		int count = ygo::dataManager.LoadScripts("script", conf.script_precompile);
+		count += ygo::dataManager.LoadScripts("expansions/script", conf.script_precompile);
+		fprintf(stderr, "Cached %d scripts\n", count);
+	}
+	// after the scripts are cached, the state that precompiles them is not a duel
+	if(conf.script_profile[0])
+		ygo::ScriptProfiler::Enable(conf.script_profile);
+	if(verify_path)
+		return ygo::ReplayVerifier::VerifyDirectory(verify_path, conf.workers) ? 0 : 1;
+	ygo::NetServer::SetObserverDelay(conf.observer_delay);
+	if(!ygo::NetServer::StartServer(conf.serverport, true, conf.workers)) {
+		fprintf(stderr, "Failed to listen on port %d\n", conf.serverport);
+		return 1;
+	}
+	fprintf(stderr, "Listening on port %d with %u workers\n", conf.serverport, conf.workers);
+	signal(SIGINT, OnStopSignal);
+	signal(SIGTERM, OnStopSignal);
+#ifndef _WIN32
+	// kill -USR1 writes the script profile and starts a new one
+	signal(SIGUSR1, OnProfileSignal);
+#endif
+	bool stopping = false;
+	unsigned long long next_stats = ygo::ServerStats::Micros() + conf.stats_interval * 1000000ULL;
+	while(!ygo::NetServer::WaitForExit(100)) {
+		if(stop_requested && !stopping) {
+			ygo::NetServer::StopServer();
+			stopping = true;
+		}
+		if(conf.stats_file[0] && conf.stats_interval && ygo::ServerStats::Micros() >= next_stats) {
+			WriteStats(conf.stats_file);
+			next_stats += conf.stats_interval * 1000000ULL;
+		}
+		if(profile_requested) {
+			profile_requested = 0;
+			if(ygo::ScriptProfiler::IsEnabled())
+				ygo::ScriptProfiler::Dump(true);
+		}
+	}
+	if(conf.stats_file[0])
+		WriteStats(conf.stats_file);
+#ifdef _WIN32
+	WSACleanup();
+#endif //_WIN32
+	return 0;
+}
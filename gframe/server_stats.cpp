@@ -0,0 +1,92 @@
+#include "server_stats.h"
+#include <chrono>
+
+namespace ygo {
+
+std::vector<StatsBlock*> ServerStats::blocks;
+std::mutex ServerStats::blocks_mutex;
+thread_local StatsBlock* ServerStats::local = 0;
+unsigned long long ServerStats::start_time = ServerStats::Micros();
+
+void ServerStats::AddProcess(RoomStats& room, unsigned long long micros, unsigned int messages) {
+	StatsBlock* block = Local();
+	Add(block->process_time[Bucket(micros)], 1);
+	Add(block->process_messages[Bucket(messages)], 1);
+	Add(room.process_calls, 1);
+	Add(room.process_time, micros);
+	Add(room.messages, messages);
+	if(micros > room.process_max.load(std::memory_order_relaxed))
+		room.process_max.store(micros, std::memory_order_relaxed);
+}
+void ServerStats::AddResponse(RoomStats& room, unsigned long long millis) {
+	Add(Local()->response_time[Bucket(millis)], 1);
+	Add(room.responses, 1);
+	Add(room.response_time, millis);
+}
+void ServerStats::AddPacket(unsigned char proto, size_t bytes, unsigned int count) {
+	StatsBlock* block = Local();
+	Add(block->packet_count[proto], count);
+	Add(block->packet_bytes[proto], bytes * count);
+}
+// the counters of every thread added up; threads keep writing while this reads
+void ServerStats::Write(FILE* fp) {
+	unsigned long long process_time[STATS_BUCKETS] = { 0 };
+	unsigned long long process_messages[STATS_BUCKETS] = { 0 };
+	unsigned long long response_time[STATS_BUCKETS] = { 0 };
+	unsigned long long packet_count[256] = { 0 };
+	unsigned long long packet_bytes[256] = { 0 };
+	{
+		std::lock_guard<std::mutex> lock(blocks_mutex);
+		for(StatsBlock* block : blocks) {
+			for(int i = 0; i < STATS_BUCKETS; ++i) {
+				process_time[i] += block->process_time[i].load(std::memory_order_relaxed);
+				process_messages[i] += block->process_messages[i].load(std::memory_order_relaxed);
+				response_time[i] += block->response_time[i].load(std::memory_order_relaxed);
+			}
+			for(int i = 0; i < 256; ++i) {
+				packet_count[i] += block->packet_count[i].load(std::memory_order_relaxed);
+				packet_bytes[i] += block->packet_bytes[i].load(std::memory_order_relaxed);
+			}
+		}
+	}
+	fprintf(fp, "uptime %llu s\n", (Micros() - start_time) / 1000000);
+	// bucket n counts the values below 2^n
+	WriteHistogram(fp, "process_us", process_time);
+	WriteHistogram(fp, "messages_per_process", process_messages);
+	WriteHistogram(fp, "response_ms", response_time);
+	for(int i = 0; i < 256; ++i) {
+		if(packet_count[i])
+			fprintf(fp, "stoc 0x%02x packets %llu bytes %llu\n", i, packet_count[i], packet_bytes[i]);
+	}
+}
+// monotonic microseconds
+unsigned long long ServerStats::Micros() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+// blocks live until the process exits, so a thread that has ended still counts
+StatsBlock* ServerStats::Local() {
+	if(!local) {
+		local = new StatsBlock();
+		std::lock_guard<std::mutex> lock(blocks_mutex);
+		blocks.push_back(local);
+	}
+	return local;
+}
+int ServerStats::Bucket(unsigned long long value) {
+	int bucket = 0;
+	while(value && bucket < STATS_BUCKETS - 1) {
+		value >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+void ServerStats::WriteHistogram(FILE* fp, const char* name, const unsigned long long* histogram) {
+	fprintf(fp, "%s", name);
+	for(int i = 0; i < STATS_BUCKETS; ++i) {
+		if(histogram[i])
+			fprintf(fp, " <%llu:%llu", 1ULL << i, histogram[i]);
+	}
+	fprintf(fp, "\n");
+}
+
+}
@@ -0,0 +1,60 @@
+#ifndef SERVER_STATS_H
+#define SERVER_STATS_H
+
+#include <stdio.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace ygo {
+
+#define STATS_BUCKETS	32 // power of two histogram buckets
+#define STATS_ROOMS		50 // rooms listed in the stats, the busiest engines first
+
+// the totals of one room; written by the room's thread and read by the stats writer
+struct RoomStats {
+	RoomStats(): process_calls(0), process_time(0), process_max(0), messages(0), responses(0), response_time(0) {}
+	std::atomic<unsigned long long> process_calls;
+	std::atomic<unsigned long long> process_time; // microseconds
+	std::atomic<unsigned long long> process_max;
+	std::atomic<unsigned long long> messages;
+	std::atomic<unsigned long long> responses;
+	std::atomic<unsigned long long> response_time; // milliseconds
+};
+
+// the counters of one thread, so that worker threads never share a cache line
+struct StatsBlock {
+	std::atomic<unsigned long long> process_time[STATS_BUCKETS];
+	std::atomic<unsigned long long> process_messages[STATS_BUCKETS];
+	std::atomic<unsigned long long> response_time[STATS_BUCKETS];
+	std::atomic<unsigned long long> packet_count[256];
+	std::atomic<unsigned long long> packet_bytes[256];
+};
+
+// engine and network counters of the server: process() time and messages per call,
+// response latency and STOC traffic by packet type
+class ServerStats {
+public:
+	static void AddProcess(RoomStats& room, unsigned long long micros, unsigned int messages);
+	static void AddResponse(RoomStats& room, unsigned long long millis);
+	static void AddPacket(unsigned char proto, size_t bytes, unsigned int count = 1);
+	static void Write(FILE* fp);
+	static unsigned long long Micros();
+
+private:
+	static StatsBlock* Local();
+	static int Bucket(unsigned long long value);
+	static void Add(std::atomic<unsigned long long>& counter, unsigned long long value) {
+		counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+	}
+	static void WriteHistogram(FILE* fp, const char* name, const unsigned long long* histogram);
+
+	static std::vector<StatsBlock*> blocks;
+	static std::mutex blocks_mutex;
+	static thread_local StatsBlock* local;
+	static unsigned long long start_time;
+};
+
+}
+
+#endif //SERVER_STATS_H
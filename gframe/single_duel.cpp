@@ -1,6 +1,9 @@
 #include "single_duel.h"
 #include "netserver.h"
+#include "script_profiler.h"
+#ifndef YGOPRO_SERVER_MODE
 #include "game.h"
+#endif
 #include "../ocgcore/ocgapi.h"
 #include "../ocgcore/common.h"
 #include "../ocgcore/mtrandom.h"
@@ -26,8 +29,7 @@ void SingleDuel::Chat(DuelPlayer* dp, void* pdata, int len) {
 	int msglen = BufferIO::CopyWStr(msg, scc.msg, 256);
 	NetServer::SendBufferToPlayer(players[0], STOC_CHAT, &scc, 4 + msglen * 2);
 	NetServer::ReSendToPlayer(players[1]);
-	for(auto pit = observers.begin(); pit != observers.end(); ++pit)
-		NetServer::ReSendToPlayer(*pit);
+	NetServer::ReSendToObservers(this);
 }
 void SingleDuel::JoinGame(DuelPlayer* dp, void* pdata, bool is_creater) {
 	if(!is_creater) {
@@ -78,8 +80,8 @@ void SingleDuel::JoinGame(DuelPlayer* dp, void* pdata, bool is_creater) {
 		if(players[1]) {
 			NetServer::SendPacketToPlayer(players[1], STOC_HS_PLAYER_ENTER, scpe);
 		}
-		for(auto pit = observers.begin(); pit != observers.end(); ++pit)
-			NetServer::SendPacketToPlayer(*pit, STOC_HS_PLAYER_ENTER, scpe);
+		NetServer::SendPacketToPlayer(0, STOC_HS_PLAYER_ENTER, scpe);
+		NetServer::ReSendToObservers(this);
 		if(!players[0]) {
 			players[0] = dp;
 			dp->type = NETPLAYER_TYPE_PLAYER1;
@@ -90,6 +92,7 @@ void SingleDuel::JoinGame(DuelPlayer* dp, void* pdata, bool is_creater) {
 			sctc.type |= NETPLAYER_TYPE_PLAYER2;
 		}
 	} else {
+		NetServer::FlushObservers(this);
 		observers.insert(dp);
 		dp->type = NETPLAYER_TYPE_OBSERVER;
 		sctc.type |= NETPLAYER_TYPE_OBSERVER;
@@ -99,8 +102,8 @@ void SingleDuel::JoinGame(DuelPlayer* dp, void* pdata, bool is_creater) {
 			NetServer::SendPacketToPlayer(players[0], STOC_HS_WATCH_CHANGE, scwc);
 		if(players[1])
 			NetServer::SendPacketToPlayer(players[1], STOC_HS_WATCH_CHANGE, scwc);
-		for(auto pit = observers.begin(); pit != observers.end(); ++pit)
-			NetServer::SendPacketToPlayer(*pit, STOC_HS_WATCH_CHANGE, scwc);
+		NetServer::SendPacketToPlayer(0, STOC_HS_WATCH_CHANGE, scwc);
+		NetServer::ReSendToObservers(this);
 	}
 	NetServer::SendPacketToPlayer(dp, STOC_JOIN_GAME, scjg);
 	NetServer::SendPacketToPlayer(dp, STOC_TYPE_CHANGE, sctc);
@@ -135,7 +138,7 @@ void SingleDuel::JoinGame(DuelPlayer* dp, void* pdata, bool is_creater) {
 void SingleDuel::LeaveGame(DuelPlayer* dp) {
 	if(dp == host_player) {
 		EndDuel();
-		NetServer::StopServer();
+		NetServer::CloseRoom(this);
 	} else if(dp->type == NETPLAYER_TYPE_OBSERVER) {
 		observers.erase(dp);
 		if(duel_stage == DUEL_STAGE_BEGIN) {
@@ -145,8 +148,8 @@ void SingleDuel::LeaveGame(DuelPlayer* dp) {
 				NetServer::SendPacketToPlayer(players[0], STOC_HS_WATCH_CHANGE, scwc);
 			if(players[1])
 				NetServer::SendPacketToPlayer(players[1], STOC_HS_WATCH_CHANGE, scwc);
-			for(auto pit = observers.begin(); pit != observers.end(); ++pit)
-				NetServer::SendPacketToPlayer(*pit, STOC_HS_WATCH_CHANGE, scwc);
+			NetServer::SendPacketToPlayer(0, STOC_HS_WATCH_CHANGE, scwc);
+			NetServer::ReSendToObservers(this);
 		}
 		NetServer::DisconnectPlayer(dp);
 	} else {
@@ -159,8 +162,8 @@ void SingleDuel::LeaveGame(DuelPlayer* dp) {
 				NetServer::SendPacketToPlayer(players[0], STOC_HS_PLAYER_CHANGE, scpc);
 			if(players[1] && dp->type != 1)
 				NetServer::SendPacketToPlayer(players[1], STOC_HS_PLAYER_CHANGE, scpc);
-			for(auto pit = observers.begin(); pit != observers.end(); ++pit)
-				NetServer::SendPacketToPlayer(*pit, STOC_HS_PLAYER_CHANGE, scpc);
+			NetServer::SendPacketToPlayer(0, STOC_HS_PLAYER_CHANGE, scpc);
+			NetServer::ReSendToObservers(this);
 			NetServer::DisconnectPlayer(dp);
 		} else {
 			if(duel_stage == DUEL_STAGE_SIDING) {
@@ -176,13 +179,11 @@ void SingleDuel::LeaveGame(DuelPlayer* dp) {
 				wbuf[2] = 0x4;
 				NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, wbuf, 3);
 				NetServer::ReSendToPlayer(players[1]);
-				for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-					NetServer::ReSendToPlayer(*oit);
+				NetServer::ReSendToObservers(this);
 				EndDuel();
 				NetServer::SendPacketToPlayer(players[0], STOC_DUEL_END);
 				NetServer::ReSendToPlayer(players[1]);
-				for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-					NetServer::ReSendToPlayer(*oit);
+				NetServer::ReSendToObservers(this);
 			}
 			NetServer::DisconnectPlayer(dp);
 		}
@@ -193,6 +194,7 @@ void SingleDuel::ToDuelist(DuelPlayer* dp) {
 		return;
 	if(players[0] && players[1])
 		return;
+	NetServer::FlushObservers(this);
 	observers.erase(dp);
 	STOC_HS_PlayerEnter scpe;
 	BufferIO::CopyWStr(dp->name, scpe.name, 20);
@@ -213,10 +215,10 @@ void SingleDuel::ToDuelist(DuelPlayer* dp) {
 		NetServer::SendPacketToPlayer(players[1], STOC_HS_PLAYER_ENTER, scpe);
 		NetServer::SendPacketToPlayer(players[1], STOC_HS_WATCH_CHANGE, scwc);
 	}
-	for(auto pit = observers.begin(); pit != observers.end(); ++pit) {
-		NetServer::SendPacketToPlayer(*pit, STOC_HS_PLAYER_ENTER, scpe);
-		NetServer::SendPacketToPlayer(*pit, STOC_HS_WATCH_CHANGE, scwc);
-	}
+	NetServer::SendPacketToPlayer(0, STOC_HS_PLAYER_ENTER, scpe);
+	NetServer::ReSendToObservers(this);
+	NetServer::SendPacketToPlayer(0, STOC_HS_WATCH_CHANGE, scwc);
+	NetServer::ReSendToObservers(this);
 	STOC_TypeChange sctc;
 	sctc.type = (dp == host_player ? 0x10 : 0) | dp->type;
 	NetServer::SendPacketToPlayer(dp, STOC_TYPE_CHANGE, sctc);
@@ -230,11 +232,12 @@ void SingleDuel::ToObserver(DuelPlayer* dp) {
 		NetServer::SendPacketToPlayer(players[0], STOC_HS_PLAYER_CHANGE, scpc);
 	if(players[1])
 		NetServer::SendPacketToPlayer(players[1], STOC_HS_PLAYER_CHANGE, scpc);
-	for(auto pit = observers.begin(); pit != observers.end(); ++pit)
-		NetServer::SendPacketToPlayer(*pit, STOC_HS_PLAYER_CHANGE, scpc);
+	NetServer::SendPacketToPlayer(0, STOC_HS_PLAYER_CHANGE, scpc);
+	NetServer::ReSendToObservers(this);
 	players[dp->type] = 0;
 	ready[dp->type] = false;
 	dp->type = NETPLAYER_TYPE_OBSERVER;
+	NetServer::FlushObservers(this);
 	observers.insert(dp);
 	STOC_TypeChange sctc;
 	sctc.type = (dp == host_player ? 0x10 : 0) | dp->type;
@@ -273,8 +276,8 @@ void SingleDuel::PlayerReady(DuelPlayer* dp, bool is_ready) {
 	NetServer::SendPacketToPlayer(players[dp->type], STOC_HS_PLAYER_CHANGE, scpc);
 	if(players[1 - dp->type])
 		NetServer::SendPacketToPlayer(players[1 - dp->type], STOC_HS_PLAYER_CHANGE, scpc);
-	for(auto pit = observers.begin(); pit != observers.end(); ++pit)
-		NetServer::SendPacketToPlayer(*pit, STOC_HS_PLAYER_CHANGE, scpc);
+	NetServer::SendPacketToPlayer(0, STOC_HS_PLAYER_CHANGE, scpc);
+	NetServer::ReSendToObservers(this);
 }
 void SingleDuel::PlayerKick(DuelPlayer* dp, unsigned char pos) {
 	if(pos > 1 || dp != host_player || dp == players[pos] || !players[pos])
@@ -325,10 +328,9 @@ void SingleDuel::StartDuel(DuelPlayer* dp) {
 	//NetServer::StopBroadcast();
 	NetServer::SendPacketToPlayer(players[0], STOC_DUEL_START);
 	NetServer::ReSendToPlayer(players[1]);
-	for(auto oit = observers.begin(); oit != observers.end(); ++oit) {
+	for(auto oit = observers.begin(); oit != observers.end(); ++oit)
 		(*oit)->state = CTOS_LEAVE_GAME;
-		NetServer::ReSendToPlayer(*oit);
-	}
+	NetServer::ReSendToObservers(this);
 	NetServer::SendPacketToPlayer(players[0], STOC_SELECT_HAND);
 	NetServer::ReSendToPlayer(players[1]);
 	hand_result[0] = 0;
@@ -348,8 +350,7 @@ void SingleDuel::HandResult(DuelPlayer* dp, unsigned char res) {
 		schr.res1 = hand_result[0];
 		schr.res2 = hand_result[1];
 		NetServer::SendPacketToPlayer(players[0], STOC_HAND_RESULT, schr);
-		for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-			NetServer::ReSendToPlayer(*oit);
+		NetServer::ReSendToObservers(this);
 		schr.res1 = hand_result[1];
 		schr.res2 = hand_result[0];
 		NetServer::SendPacketToPlayer(players[1], STOC_HAND_RESULT, schr);
@@ -409,22 +410,29 @@ void SingleDuel::TPResult(DuelPlayer* dp, unsigned char tp) {
 	last_replay.WriteData(players[0]->name, 40, false);
 	last_replay.WriteData(players[1]->name, 40, false);
 	if(!host_info.no_shuffle_deck) {
-		for(size_t i = pdeck[0].main.size() - 1; i > 0; --i) {
+		for(int i = (int)pdeck[0].main.size() - 1; i > 0; --i) {
 			int swap = rnd.real() * (i + 1);
 			std::swap(pdeck[0].main[i], pdeck[0].main[swap]);
 		}
-		for(size_t i = pdeck[1].main.size() - 1; i > 0; --i) {
+		for(int i = (int)pdeck[1].main.size() - 1; i > 0; --i) {
 			int swap = rnd.real() * (i + 1);
 			std::swap(pdeck[1].main[i], pdeck[1].main[swap]);
 		}
 	}
-	time_limit[0] = host_info.time_limit;
-	time_limit[1] = host_info.time_limit;
-	set_script_reader((script_reader)DataManager::ScriptReaderEx);
+	time_limit[0] = host_info.time_limit * 1000;
+	time_limit[1] = host_info.time_limit * 1000;
+	if(ScriptProfiler::IsEnabled())
+		set_script_reader((script_reader)ScriptProfiler::ScriptReader);
+	else
+		set_script_reader((script_reader)DataManager::ScriptReaderEx);
 	set_card_reader((card_reader)DataManager::CardReader);
 	set_message_handler((message_handler)SingleDuel::MessageHandler);
 	rnd.reset(seed);
-	pduel = create_duel(rnd.rand());
+	{
+		std::lock_guard<std::mutex> lock(NetServer::engine_mutex);
+		pduel = create_duel(rnd.rand());
+	}
+	InvalidateQueryCache();
 	set_player_info(pduel, 0, host_info.start_lp, host_info.start_hand, host_info.draw_count);
 	set_player_info(pduel, 1, host_info.start_lp, host_info.start_hand, host_info.draw_count);
 	int opt = (int)host_info.duel_rule << 16;
@@ -472,10 +480,9 @@ void SingleDuel::TPResult(DuelPlayer* dp, unsigned char tp) {
 	if(!swapped)
 		startbuf[1] = 0x10;
 	else startbuf[1] = 0x11;
-	for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-		NetServer::SendBufferToPlayer(*oit, STOC_GAME_MSG, startbuf, 19);
-	RefreshExtra(0);
-	RefreshExtra(1);
+	NetServer::SendBufferToPlayer(0, STOC_GAME_MSG, startbuf, 19);
+	NetServer::ReSendToObservers(this);
+	RefreshField(LOCATION_EXTRA);
 	start_duel(pduel, opt);
 	Process();
 }
@@ -486,13 +493,17 @@ void SingleDuel::Process() {
 	while (!stop) {
 		if (engFlag == 2)
 			break;
+		unsigned long long start = ServerStats::Micros();
 		int result = process(pduel);
+		unsigned long long micros = ServerStats::Micros() - start;
 		engLen = result & 0xffff;
 		engFlag = result >> 16;
+		analyzed_messages = 0;
 		if (engLen > 0) {
 			get_message(pduel, (byte*)&engineBuffer);
 			stop = Analyze(engineBuffer, engLen);
 		}
+		ServerStats::AddProcess(stats, micros, analyzed_messages);
 	}
 	if(stop == 2)
 		DuelEndProc();
@@ -501,8 +512,7 @@ void SingleDuel::DuelEndProc() {
 	if(!match_mode) {
 		NetServer::SendPacketToPlayer(players[0], STOC_DUEL_END);
 		NetServer::ReSendToPlayer(players[1]);
-		for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-			NetServer::ReSendToPlayer(*oit);
+		NetServer::ReSendToObservers(this);
 		duel_stage = DUEL_STAGE_END;
 	} else {
 		int winc[3] = {0, 0, 0};
@@ -514,8 +524,7 @@ void SingleDuel::DuelEndProc() {
 		        || (winc[2] == 3 || (winc[0] == 1 && winc[1] == 1 && winc[2] == 1)) ) {
 			NetServer::SendPacketToPlayer(players[0], STOC_DUEL_END);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			duel_stage = DUEL_STAGE_END;
 		} else {
 			if(players[0] != pplayer[0]) {
@@ -533,8 +542,8 @@ void SingleDuel::DuelEndProc() {
 			players[1]->state = CTOS_UPDATE_DECK;
 			NetServer::SendPacketToPlayer(players[0], STOC_CHANGE_SIDE);
 			NetServer::SendPacketToPlayer(players[1], STOC_CHANGE_SIDE);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::SendPacketToPlayer(*oit, STOC_WAITING_SIDE);
+			NetServer::SendPacketToPlayer(0, STOC_WAITING_SIDE);
+			NetServer::ReSendToObservers(this);
 			duel_stage = DUEL_STAGE_SIDING;
 		}
 	}
@@ -549,8 +558,7 @@ void SingleDuel::Surrender(DuelPlayer* dp) {
 	wbuf[2] = 0;
 	NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, wbuf, 3);
 	NetServer::ReSendToPlayer(players[1]);
-	for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-		NetServer::ReSendToPlayer(*oit);
+	NetServer::ReSendToObservers(this);
 	if(players[player] == pplayer[player]) {
 		match_result[duel_count++] = 1 - player;
 		tp_player = player;
@@ -560,7 +568,7 @@ void SingleDuel::Surrender(DuelPlayer* dp) {
 	}
 	EndDuel();
 	DuelEndProc();
-	event_del(etimer);
+	timer_wheel->Remove(&timer);
 }
 int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 	char* offset, *pbufw, *pbuf = msgbuffer;
@@ -568,6 +576,8 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 	while (pbuf - msgbuffer < (int)len) {
 		offset = pbuf;
 		unsigned char engType = BufferIO::ReadUInt8(pbuf);
+		analyzed_messages++;
+		TrackQueryCache(engType, pbuf);
 		switch (engType) {
 		case MSG_RETRY: {
 			WaitforResponse(last_response);
@@ -593,15 +603,13 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			case 9:
 			case 11: {
 				NetServer::SendBufferToPlayer(players[1 - player], STOC_GAME_MSG, offset, pbuf - offset);
-				for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-					NetServer::ReSendToPlayer(*oit);
+				NetServer::ReSendToObservers(this);
 				break;
 			}
 			case 10: {
 				NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 				NetServer::SendBufferToPlayer(players[1], STOC_GAME_MSG, offset, pbuf - offset);
-				for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-					NetServer::ReSendToPlayer(*oit);
+				NetServer::ReSendToObservers(this);
 				break;
 			}
 			}
@@ -612,8 +620,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			type = BufferIO::ReadInt8(pbuf);
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			if(player > 1) {
 				match_result[duel_count++] = 2;
 				tp_player = 1 - tp_player;
@@ -633,12 +640,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf += count * 11;
 			count = BufferIO::ReadInt8(pbuf);
 			pbuf += count * 8 + 2;
-			RefreshMzone(0);
-			RefreshMzone(1);
-			RefreshSzone(0);
-			RefreshSzone(1);
-			RefreshHand(0);
-			RefreshHand(1);
+			RefreshField(LOCATION_MZONE | LOCATION_SZONE | LOCATION_HAND);
 			WaitforResponse(player);
 			NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, offset, pbuf - offset);
 			return 1;
@@ -657,12 +659,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf += count * 7;
 			count = BufferIO::ReadInt8(pbuf);
 			pbuf += count * 11 + 3;
-			RefreshMzone(0);
-			RefreshMzone(1);
-			RefreshSzone(0);
-			RefreshSzone(1);
-			RefreshHand(0);
-			RefreshHand(1);
+			RefreshField(LOCATION_MZONE | LOCATION_SZONE | LOCATION_HAND);
 			WaitforResponse(player);
 			NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, offset, pbuf - offset);
 			return 1;
@@ -794,8 +791,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf += count * 7;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_CONFIRM_EXTRATOP: {
@@ -804,8 +800,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf += count * 7;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for (auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_CONFIRM_CARDS: {
@@ -815,8 +810,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 				pbuf += count * 7;
 				NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, offset, pbuf - offset);
 				NetServer::ReSendToPlayer(players[1 - player]);
-				for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-					NetServer::ReSendToPlayer(*oit);
+				NetServer::ReSendToObservers(this);
 			} else {
 				pbuf += count * 7;
 				NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, offset, pbuf - offset);
@@ -827,8 +821,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			player = BufferIO::ReadInt8(pbuf);
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_SHUFFLE_HAND: {
@@ -838,8 +831,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			for(int i = 0; i < count; ++i)
 				BufferIO::WriteInt32(pbuf, 0);
 			NetServer::SendBufferToPlayer(players[1 - player], STOC_GAME_MSG, offset, pbuf - offset);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			RefreshHand(player, 0x781fff, 0);
 			break;
 		}
@@ -850,8 +842,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			for (int i = 0; i < count; ++i)
 				BufferIO::WriteInt32(pbuf, 0);
 			NetServer::SendBufferToPlayer(players[1 - player], STOC_GAME_MSG, offset, pbuf - offset);
-			for (auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			RefreshExtra(player);
 			break;
 		}
@@ -859,32 +850,28 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf++;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_SWAP_GRAVE_DECK: {
 			player = BufferIO::ReadInt8(pbuf);
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			RefreshGrave(player);
 			break;
 		}
 		case MSG_REVERSE_DECK: {
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_DECK_TOP: {
 			pbuf += 6;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_SHUFFLE_SET_CARD: {
@@ -893,46 +880,31 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf += count * 8;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			if(loc == LOCATION_MZONE) {
-				RefreshMzone(0, 0x181fff, 0);
-				RefreshMzone(1, 0x181fff, 0);
+				RefreshField(LOCATION_MZONE, 0x181fff, 0);
 			}
 			else {
-				RefreshSzone(0, 0x181fff, 0);
-				RefreshSzone(1, 0x181fff, 0);
+				RefreshField(LOCATION_SZONE, 0x181fff, 0);
 			}
 			break;
 		}
 		case MSG_NEW_TURN: {
-			RefreshMzone(0);
-			RefreshMzone(1);
-			RefreshSzone(0);
-			RefreshSzone(1);
-			RefreshHand(0);
-			RefreshHand(1);
+			RefreshField(LOCATION_MZONE | LOCATION_SZONE | LOCATION_HAND);
 			pbuf++;
-			time_limit[0] = host_info.time_limit;
-			time_limit[1] = host_info.time_limit;
+			time_limit[0] = host_info.time_limit * 1000;
+			time_limit[1] = host_info.time_limit * 1000;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_NEW_PHASE: {
 			pbuf += 2;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			RefreshMzone(0);
-			RefreshMzone(1);
-			RefreshSzone(0);
-			RefreshSzone(1);
-			RefreshHand(0);
-			RefreshHand(1);
+			NetServer::ReSendToObservers(this);
+			RefreshField(LOCATION_MZONE | LOCATION_SZONE | LOCATION_HAND);
 			break;
 		}
 		case MSG_MOVE: {
@@ -950,8 +922,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			if (!(cl & (LOCATION_GRAVE + LOCATION_OVERLAY)) && ((cl & (LOCATION_DECK + LOCATION_HAND)) || (cp & POS_FACEDOWN)))
 				BufferIO::WriteInt32(pbufw, 0);
 			NetServer::SendBufferToPlayer(players[1 - cc], STOC_GAME_MSG, offset, pbuf - offset);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			if (cl != 0 && (cl & 0x80) == 0 && (cl != pl || pc != cc))
 				RefreshSingle(cc, cl, cs);
 			break;
@@ -965,8 +936,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf += 9;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			if((pp & POS_FACEDOWN) && (cp & POS_FACEUP))
 				RefreshSingle(cc, cl, cs);
 			break;
@@ -976,8 +946,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf += 4;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_SWAP: {
@@ -990,8 +959,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf += 16;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			RefreshSingle(c1, l1, s1);
 			RefreshSingle(c2, l2, s2);
 			break;
@@ -1000,46 +968,35 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf += 4;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_SUMMONING: {
 			pbuf += 8;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_SUMMONED: {
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			RefreshMzone(0);
-			RefreshMzone(1);
-			RefreshSzone(0);
-			RefreshSzone(1);
+			NetServer::ReSendToObservers(this);
+			RefreshField(LOCATION_MZONE | LOCATION_SZONE);
 			break;
 		}
 		case MSG_SPSUMMONING: {
 			pbuf += 8;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_SPSUMMONED: {
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			RefreshMzone(0);
-			RefreshMzone(1);
-			RefreshSzone(0);
-			RefreshSzone(1);
+			NetServer::ReSendToObservers(this);
+			RefreshField(LOCATION_MZONE | LOCATION_SZONE);
 			break;
 		}
 		case MSG_FLIPSUMMONING: {
@@ -1047,92 +1004,65 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf += 8;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_FLIPSUMMONED: {
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			RefreshMzone(0);
-			RefreshMzone(1);
-			RefreshSzone(0);
-			RefreshSzone(1);
+			NetServer::ReSendToObservers(this);
+			RefreshField(LOCATION_MZONE | LOCATION_SZONE);
 			break;
 		}
 		case MSG_CHAINING: {
 			pbuf += 16;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_CHAINED: {
 			pbuf++;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			RefreshMzone(0);
-			RefreshMzone(1);
-			RefreshSzone(0);
-			RefreshSzone(1);
-			RefreshHand(0);
-			RefreshHand(1);
+			NetServer::ReSendToObservers(this);
+			RefreshField(LOCATION_MZONE | LOCATION_SZONE | LOCATION_HAND);
 			break;
 		}
 		case MSG_CHAIN_SOLVING: {
 			pbuf++;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_CHAIN_SOLVED: {
 			pbuf++;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			RefreshMzone(0);
-			RefreshMzone(1);
-			RefreshSzone(0);
-			RefreshSzone(1);
-			RefreshHand(0);
-			RefreshHand(1);
+			NetServer::ReSendToObservers(this);
+			RefreshField(LOCATION_MZONE | LOCATION_SZONE | LOCATION_HAND);
 			break;
 		}
 		case MSG_CHAIN_END: {
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			RefreshMzone(0);
-			RefreshMzone(1);
-			RefreshSzone(0);
-			RefreshSzone(1);
-			RefreshHand(0);
-			RefreshHand(1);
+			NetServer::ReSendToObservers(this);
+			RefreshField(LOCATION_MZONE | LOCATION_SZONE | LOCATION_HAND);
 			break;
 		}
 		case MSG_CHAIN_NEGATED: {
 			pbuf++;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_CHAIN_DISABLED: {
 			pbuf++;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_CARD_SELECTED: {
@@ -1147,8 +1077,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf += count * 4;
 			NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_BECOME_TARGET: {
@@ -1156,8 +1085,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf += count * 4;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_DRAW: {
@@ -1173,129 +1101,111 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 					pbufw += 4;
 			}
 			NetServer::SendBufferToPlayer(players[1 - player], STOC_GAME_MSG, offset, pbuf - offset);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_DAMAGE: {
 			pbuf += 5;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_RECOVER: {
 			pbuf += 5;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_EQUIP: {
 			pbuf += 8;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_LPUPDATE: {
 			pbuf += 5;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_UNEQUIP: {
 			pbuf += 4;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_CARD_TARGET: {
 			pbuf += 8;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_CANCEL_TARGET: {
 			pbuf += 8;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_PAY_LPCOST: {
 			pbuf += 5;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_ADD_COUNTER: {
 			pbuf += 7;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_REMOVE_COUNTER: {
 			pbuf += 7;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_ATTACK: {
 			pbuf += 8;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_BATTLE: {
 			pbuf += 26;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_ATTACK_DISABLED: {
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_DAMAGE_STEP_START: {
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			RefreshMzone(0);
-			RefreshMzone(1);
+			NetServer::ReSendToObservers(this);
+			RefreshField(LOCATION_MZONE);
 			break;
 		}
 		case MSG_DAMAGE_STEP_END: {
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			RefreshMzone(0);
-			RefreshMzone(1);
+			NetServer::ReSendToObservers(this);
+			RefreshField(LOCATION_MZONE);
 			break;
 		}
 		case MSG_MISSED_EFFECT: {
@@ -1310,8 +1220,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf += count;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_TOSS_DICE: {
@@ -1320,8 +1229,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf += count;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_ROCK_PAPER_SCISSORS: {
@@ -1334,8 +1242,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf += 1;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for (auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_ANNOUNCE_RACE: {
@@ -1365,16 +1272,14 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf += 9;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_PLAYER_HINT: {
 			pbuf += 6;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_MATCH_KILL: {
@@ -1383,8 +1288,7 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 				match_kill = code;
 				NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 				NetServer::ReSendToPlayer(players[1]);
-				for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-					NetServer::ReSendToPlayer(*oit);
+				NetServer::ReSendToObservers(this);
 			}
 			break;
 		}
@@ -1399,11 +1303,13 @@ void SingleDuel::GetResponse(DuelPlayer* dp, void* pdata, unsigned int len) {
 	last_replay.WriteData(resb, len);
 	set_responseb(pduel, resb);
 	players[dp->type]->state = 0xff;
+	ServerStats::AddResponse(stats, (ServerStats::Micros() - response_start) / 1000);
 	if(host_info.time_limit) {
-		if(time_limit[dp->type] >= time_elapsed)
-			time_limit[dp->type] -= time_elapsed;
+		unsigned long long elapsed = TimerWheel::Now() - time_start;
+		if(time_limit[dp->type] >= elapsed)
+			time_limit[dp->type] -= elapsed;
 		else time_limit[dp->type] = 0;
-		event_del(etimer);
+		timer_wheel->Remove(&timer);
 	}
 	Process();
 }
@@ -1411,25 +1317,31 @@ void SingleDuel::EndDuel() {
 	if(!pduel)
 		return;
 	last_replay.EndRecord();
-	char replaybuf[0x2000], *pbuf = replaybuf;
-	memcpy(pbuf, &last_replay.pheader, sizeof(ReplayHeader));
-	pbuf += sizeof(ReplayHeader);
-	memcpy(pbuf, last_replay.comp_data, last_replay.comp_size);
-	NetServer::SendBufferToPlayer(players[0], STOC_REPLAY, replaybuf, sizeof(ReplayHeader) + last_replay.comp_size);
-	NetServer::ReSendToPlayer(players[1]);
-	for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-		NetServer::ReSendToPlayer(*oit);
-	end_duel(pduel);
+	// a replay that outgrows one packet cannot be delivered to the clients
+	if(sizeof(ReplayHeader) + last_replay.comp_size <= 0x2000 - 3) {
+		char replaybuf[0x2000], *pbuf = replaybuf;
+		memcpy(pbuf, &last_replay.pheader, sizeof(ReplayHeader));
+		pbuf += sizeof(ReplayHeader);
+		memcpy(pbuf, last_replay.comp_data.data(), last_replay.comp_size);
+		NetServer::SendBufferToPlayer(players[0], STOC_REPLAY, replaybuf, sizeof(ReplayHeader) + last_replay.comp_size);
+		NetServer::ReSendToPlayer(players[1]);
+		NetServer::ReSendToObservers(this);
+	}
+	{
+		std::lock_guard<std::mutex> lock(NetServer::engine_mutex);
+		end_duel(pduel);
+	}
 	pduel = 0;
 }
 void SingleDuel::WaitforResponse(int playerid) {
 	last_response = playerid;
+	response_start = ServerStats::Micros();
 	unsigned char msg = MSG_WAITING;
 	NetServer::SendPacketToPlayer(players[1 - playerid], STOC_GAME_MSG, msg);
 	if(host_info.time_limit) {
 		STOC_TimeLimit sctl;
 		sctl.player = playerid;
-		sctl.left_time = time_limit[playerid];
+		sctl.left_time = time_limit[playerid] / 1000;
 		NetServer::SendPacketToPlayer(players[0], STOC_TIME_LIMIT, sctl);
 		NetServer::SendPacketToPlayer(players[1], STOC_TIME_LIMIT, sctl);
 		players[playerid]->state = CTOS_TIME_CONFIRM;
@@ -1442,101 +1354,38 @@ void SingleDuel::TimeConfirm(DuelPlayer* dp) {
 	if(dp->type != last_response)
 		return;
 	players[last_response]->state = CTOS_RESPONSE;
-	time_elapsed = 0;
-	timeval timeout = {1, 0};
-	event_add(etimer, &timeout);
+	time_start = TimerWheel::Now();
+	timer_wheel->Add(&timer, time_limit[last_response]);
 }
 void SingleDuel::RefreshMzone(int player, int flag, int use_cache) {
-	char query_buffer[0x2000];
-	char* qbuf = query_buffer;
-	BufferIO::WriteInt8(qbuf, MSG_UPDATE_DATA);
-	BufferIO::WriteInt8(qbuf, player);
-	BufferIO::WriteInt8(qbuf, LOCATION_MZONE);
-	int len = query_field_card(pduel, player, LOCATION_MZONE, flag, (unsigned char*)qbuf, use_cache);
-	NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, query_buffer, len + 3);
-	int qlen = 0;
-	while(qlen < len) {
-		int clen = BufferIO::ReadInt32(qbuf);
-		qlen += clen;
-		if (clen == 4)
-			continue;
-		if (qbuf[11] & POS_FACEDOWN)
-			memset(qbuf, 0, clen - 4);
-		qbuf += clen - 4;
-	}
-	NetServer::SendBufferToPlayer(players[1 - player], STOC_GAME_MSG, query_buffer, len + 3);
-	for(auto pit = observers.begin(); pit != observers.end(); ++pit)
-		NetServer::ReSendToPlayer(*pit);
+	RefreshLocation(player, LOCATION_MZONE, flag, use_cache);
 }
 void SingleDuel::RefreshSzone(int player, int flag, int use_cache) {
-	char query_buffer[0x2000];
-	char* qbuf = query_buffer;
-	BufferIO::WriteInt8(qbuf, MSG_UPDATE_DATA);
-	BufferIO::WriteInt8(qbuf, player);
-	BufferIO::WriteInt8(qbuf, LOCATION_SZONE);
-	int len = query_field_card(pduel, player, LOCATION_SZONE, flag, (unsigned char*)qbuf, use_cache);
-	NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, query_buffer, len + 3);
-	int qlen = 0;
-	while(qlen < len) {
-		int clen = BufferIO::ReadInt32(qbuf);
-		qlen += clen;
-		if (clen == 4)
-			continue;
-		if (qbuf[11] & POS_FACEDOWN)
-			memset(qbuf, 0, clen - 4);
-		qbuf += clen - 4;
-	}
-	NetServer::SendBufferToPlayer(players[1 - player], STOC_GAME_MSG, query_buffer, len + 3);
-	for(auto pit = observers.begin(); pit != observers.end(); ++pit)
-		NetServer::ReSendToPlayer(*pit);
+	RefreshLocation(player, LOCATION_SZONE, flag, use_cache);
 }
 void SingleDuel::RefreshHand(int player, int flag, int use_cache) {
-	char query_buffer[0x2000];
-	char* qbuf = query_buffer;
-	BufferIO::WriteInt8(qbuf, MSG_UPDATE_DATA);
-	BufferIO::WriteInt8(qbuf, player);
-	BufferIO::WriteInt8(qbuf, LOCATION_HAND);
-	int len = query_field_card(pduel, player, LOCATION_HAND, flag | QUERY_POSITION, (unsigned char*)qbuf, use_cache);
-	NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, query_buffer, len + 3);
-	int qlen = 0;
-	while(qlen < len) {
-		int slen = BufferIO::ReadInt32(qbuf);
-		int qflag = *(int*)qbuf;
-		int offset = 8;
-		if(!(qflag & QUERY_CODE))
-			offset -= 4;
-		unsigned position = ((*(int*)(qbuf + offset)) >> 24) & 0xff;
-		if(!(position & POS_FACEUP))
-			memset(qbuf, 0, slen - 4);
-		qbuf += slen - 4;
-		qlen += slen;
-	}
-	NetServer::SendBufferToPlayer(players[1 - player], STOC_GAME_MSG, query_buffer, len + 3);
-	for(auto pit = observers.begin(); pit != observers.end(); ++pit)
-		NetServer::ReSendToPlayer(*pit);
+	RefreshLocation(player, LOCATION_HAND, flag, use_cache);
 }
 void SingleDuel::RefreshGrave(int player, int flag, int use_cache) {
-	char query_buffer[0x2000];
-	char* qbuf = query_buffer;
-	BufferIO::WriteInt8(qbuf, MSG_UPDATE_DATA);
-	BufferIO::WriteInt8(qbuf, player);
-	BufferIO::WriteInt8(qbuf, LOCATION_GRAVE);
-	int len = query_field_card(pduel, player, LOCATION_GRAVE, flag, (unsigned char*)qbuf, use_cache);
-	NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, query_buffer, len + 3);
-	NetServer::ReSendToPlayer(players[1]);
-	for(auto pit = observers.begin(); pit != observers.end(); ++pit)
-		NetServer::ReSendToPlayer(*pit);
+	RefreshLocation(player, LOCATION_GRAVE, flag, use_cache);
 }
 void SingleDuel::RefreshExtra(int player, int flag, int use_cache) {
-	char query_buffer[0x2000];
-	char* qbuf = query_buffer;
-	BufferIO::WriteInt8(qbuf, MSG_UPDATE_DATA);
-	BufferIO::WriteInt8(qbuf, player);
-	BufferIO::WriteInt8(qbuf, LOCATION_EXTRA);
-	int len = query_field_card(pduel, player, LOCATION_EXTRA, flag, (unsigned char*)qbuf, use_cache);
-	NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, query_buffer, len + 3);
+	RefreshLocation(player, LOCATION_EXTRA, flag, use_cache);
+}
+void SingleDuel::SendLocationQuery(int player, int location, char* query, char* masked, int len) {
+	for(int i = 0; i < 2; ++i) {
+		if(i == player || (!masked && location != LOCATION_EXTRA))
+			SendQueryUpdate(players[i], i, query, len);
+		else if(masked)
+			SendQueryUpdate(players[i], i, masked, len);
+	}
+	if(location == LOCATION_EXTRA)
+		return;
+	if(SendQueryUpdate(0, QUERY_VIEWER_OBSERVER, masked ? masked : query, len))
+		NetServer::ReSendToObservers(this);
 }
 void SingleDuel::RefreshSingle(int player, int location, int sequence, int flag) {
+	InvalidateQueryCache(player, location);
 	char query_buffer[0x2000];
 	char* qbuf = query_buffer;
 	BufferIO::WriteInt8(qbuf, MSG_UPDATE_CARD);
@@ -1549,8 +1398,7 @@ void SingleDuel::RefreshSingle(int player, int location, int sequence, int flag)
 		return;
 	if ((location & 0x90) || ((location & 0x2c) && (qbuf[15] & POS_FACEUP))) {
 		NetServer::ReSendToPlayer(players[1 - player]);
-		for(auto pit = observers.begin(); pit != observers.end(); ++pit)
-			NetServer::ReSendToPlayer(*pit);
+		NetServer::ReSendToObservers(this);
 	}
 }
 int SingleDuel::MessageHandler(long fduel, int type) {
@@ -1558,33 +1406,34 @@ int SingleDuel::MessageHandler(long fduel, int type) {
 		return 0;
 	char msgbuf[1024];
 	get_log_message(fduel, (byte*)msgbuf);
+#ifdef YGOPRO_SERVER_MODE
+	fprintf(stderr, "%s\n", msgbuf);
+#else
 	mainGame->AddDebugMsg(msgbuf);
+#endif
 	return 0;
 }
-void SingleDuel::SingleTimer(evutil_socket_t fd, short events, void* arg) {
+// the player to respond has run out of time
+void SingleDuel::SingleTimer(void* arg) {
 	SingleDuel* sd = static_cast<SingleDuel*>(arg);
-	sd->time_elapsed++;
-	if(sd->time_elapsed >= sd->time_limit[sd->last_response]) {
-		unsigned char wbuf[3];
-		uint32 player = sd->last_response;
-		wbuf[0] = MSG_WIN;
-		wbuf[1] = 1 - player;
-		wbuf[2] = 0x3;
-		NetServer::SendBufferToPlayer(sd->players[0], STOC_GAME_MSG, wbuf, 3);
-		NetServer::ReSendToPlayer(sd->players[1]);
-		for(auto oit = sd->observers.begin(); oit != sd->observers.end(); ++oit)
-			NetServer::ReSendToPlayer(*oit);
-		if(sd->players[player] == sd->pplayer[player]) {
-			sd->match_result[sd->duel_count++] = 1 - player;
-			sd->tp_player = player;
-		} else {
-			sd->match_result[sd->duel_count++] = player;
-			sd->tp_player = 1 - player;
-		}
-		sd->EndDuel();
-		sd->DuelEndProc();
-		event_del(sd->etimer);
+	unsigned char wbuf[3];
+	uint32 player = sd->last_response;
+	sd->time_limit[player] = 0;
+	wbuf[0] = MSG_WIN;
+	wbuf[1] = 1 - player;
+	wbuf[2] = 0x3;
+	NetServer::SendBufferToPlayer(sd->players[0], STOC_GAME_MSG, wbuf, 3);
+	NetServer::ReSendToPlayer(sd->players[1]);
+	NetServer::ReSendToObservers(sd);
+	if(sd->players[player] == sd->pplayer[player]) {
+		sd->match_result[sd->duel_count++] = 1 - player;
+		sd->tp_player = player;
+	} else {
+		sd->match_result[sd->duel_count++] = player;
+		sd->tp_player = 1 - player;
 	}
+	sd->EndDuel();
+	sd->DuelEndProc();
 }
 
 }
@@ -39,9 +39,11 @@ public:
 	void RefreshSingle(int player, int location, int sequence, int flag = 0xf81fff);
 
 	static int MessageHandler(long fduel, int type);
-	static void SingleTimer(evutil_socket_t fd, short events, void* arg);
+	static void SingleTimer(void* arg);
 	
 protected:
+	virtual void SendLocationQuery(int player, int location, char* query, char* masked, int len);
+
 	DuelPlayer* players[2];
 	DuelPlayer* pplayer[2];
 	bool ready[2];
@@ -49,15 +51,14 @@ protected:
 	int deck_error[2];
 	unsigned char hand_result[2];
 	unsigned char last_response;
-	std::set<DuelPlayer*> observers;
 	Replay last_replay;
 	bool match_mode;
 	int match_kill;
 	unsigned char duel_count;
 	unsigned char tp_player;
 	unsigned char match_result[3];
-	unsigned short time_limit[2];
-	unsigned short time_elapsed;
+	unsigned int time_limit[2]; // milliseconds left
+	unsigned long long time_start; // TimerWheel::Now() when the timer was started
 };
 
 }
@@ -1,6 +1,9 @@
 #include "tag_duel.h"
 #include "netserver.h"
+#include "script_profiler.h"
+#ifndef YGOPRO_SERVER_MODE
 #include "game.h"
+#endif
 #include "../ocgcore/ocgapi.h"
 #include "../ocgcore/common.h"
 #include "../ocgcore/mtrandom.h"
@@ -22,8 +25,7 @@ void TagDuel::Chat(DuelPlayer* dp, void* pdata, int len) {
 	int msglen = BufferIO::CopyWStr(msg, scc.msg, 256);
 	for(int i = 0; i < 4; ++i)
 		NetServer::SendBufferToPlayer(players[i], STOC_CHAT, &scc, 4 + msglen * 2);
-	for(auto pit = observers.begin(); pit != observers.end(); ++pit)
-		NetServer::ReSendToPlayer(*pit);
+	NetServer::ReSendToObservers(this);
 }
 void TagDuel::JoinGame(DuelPlayer* dp, void* pdata, bool is_creater) {
 	if(!is_creater) {
@@ -75,12 +77,13 @@ void TagDuel::JoinGame(DuelPlayer* dp, void* pdata, bool is_creater) {
 		for(int i = 0; i < 4; ++i)
 			if(players[i])
 				NetServer::SendPacketToPlayer(players[i], STOC_HS_PLAYER_ENTER, scpe);
-		for(auto pit = observers.begin(); pit != observers.end(); ++pit)
-			NetServer::SendPacketToPlayer(*pit, STOC_HS_PLAYER_ENTER, scpe);
+		NetServer::SendPacketToPlayer(0, STOC_HS_PLAYER_ENTER, scpe);
+		NetServer::ReSendToObservers(this);
 		players[scpe.pos] = dp;
 		dp->type = scpe.pos;
 		sctc.type |= scpe.pos;
 	} else {
+		NetServer::FlushObservers(this);
 		observers.insert(dp);
 		dp->type = NETPLAYER_TYPE_OBSERVER;
 		sctc.type |= NETPLAYER_TYPE_OBSERVER;
@@ -89,8 +92,8 @@ void TagDuel::JoinGame(DuelPlayer* dp, void* pdata, bool is_creater) {
 		for(int i = 0; i < 4; ++i)
 			if(players[i])
 				NetServer::SendPacketToPlayer(players[i], STOC_HS_WATCH_CHANGE, scwc);
-		for(auto pit = observers.begin(); pit != observers.end(); ++pit)
-			NetServer::SendPacketToPlayer(*pit, STOC_HS_WATCH_CHANGE, scwc);
+		NetServer::SendPacketToPlayer(0, STOC_HS_WATCH_CHANGE, scwc);
+		NetServer::ReSendToObservers(this);
 	}
 	NetServer::SendPacketToPlayer(dp, STOC_JOIN_GAME, scjg);
 	NetServer::SendPacketToPlayer(dp, STOC_TYPE_CHANGE, sctc);
@@ -115,7 +118,7 @@ void TagDuel::JoinGame(DuelPlayer* dp, void* pdata, bool is_creater) {
 void TagDuel::LeaveGame(DuelPlayer* dp) {
 	if(dp == host_player) {
 		EndDuel();
-		NetServer::StopServer();
+		NetServer::CloseRoom(this);
 	} else if(dp->type == NETPLAYER_TYPE_OBSERVER) {
 		observers.erase(dp);
 		if(duel_stage == DUEL_STAGE_BEGIN) {
@@ -124,8 +127,8 @@ void TagDuel::LeaveGame(DuelPlayer* dp) {
 			for(int i = 0; i < 4; ++i)
 				if(players[i])
 					NetServer::SendPacketToPlayer(players[i], STOC_HS_WATCH_CHANGE, scwc);
-			for(auto pit = observers.begin(); pit != observers.end(); ++pit)
-				NetServer::SendPacketToPlayer(*pit, STOC_HS_WATCH_CHANGE, scwc);
+			NetServer::SendPacketToPlayer(0, STOC_HS_WATCH_CHANGE, scwc);
+			NetServer::ReSendToObservers(this);
 		}
 		NetServer::DisconnectPlayer(dp);
 	} else {
@@ -137,8 +140,8 @@ void TagDuel::LeaveGame(DuelPlayer* dp) {
 			for(int i = 0; i < 4; ++i)
 				if(players[i])
 					NetServer::SendPacketToPlayer(players[i], STOC_HS_PLAYER_CHANGE, scpc);
-			for(auto pit = observers.begin(); pit != observers.end(); ++pit)
-				NetServer::SendPacketToPlayer(*pit, STOC_HS_PLAYER_CHANGE, scpc);
+			NetServer::SendPacketToPlayer(0, STOC_HS_PLAYER_CHANGE, scpc);
+			NetServer::ReSendToObservers(this);
 			NetServer::DisconnectPlayer(dp);
 		} else if(duel_stage != DUEL_STAGE_END) {
 			EndDuel();
@@ -151,6 +154,7 @@ void TagDuel::ToDuelist(DuelPlayer* dp) {
 	if(players[0] && players[1] && players[2] && players[3])
 		return;
 	if(dp->type == NETPLAYER_TYPE_OBSERVER) {
+		NetServer::FlushObservers(this);
 		observers.erase(dp);
 		STOC_HS_PlayerEnter scpe;
 		BufferIO::CopyWStr(dp->name, scpe.name, 20);
@@ -171,10 +175,10 @@ void TagDuel::ToDuelist(DuelPlayer* dp) {
 				NetServer::SendPacketToPlayer(players[i], STOC_HS_PLAYER_ENTER, scpe);
 				NetServer::SendPacketToPlayer(players[i], STOC_HS_WATCH_CHANGE, scwc);
 			}
-		for(auto pit = observers.begin(); pit != observers.end(); ++pit) {
-			NetServer::SendPacketToPlayer(*pit, STOC_HS_PLAYER_ENTER, scpe);
-			NetServer::SendPacketToPlayer(*pit, STOC_HS_WATCH_CHANGE, scwc);
-		}
+		NetServer::SendPacketToPlayer(0, STOC_HS_PLAYER_ENTER, scpe);
+		NetServer::ReSendToObservers(this);
+		NetServer::SendPacketToPlayer(0, STOC_HS_WATCH_CHANGE, scwc);
+		NetServer::ReSendToObservers(this);
 		STOC_TypeChange sctc;
 		sctc.type = (dp == host_player ? 0x10 : 0) | dp->type;
 		NetServer::SendPacketToPlayer(dp, STOC_TYPE_CHANGE, sctc);
@@ -189,8 +193,8 @@ void TagDuel::ToDuelist(DuelPlayer* dp) {
 		for(int i = 0; i < 4; ++i)
 			if(players[i])
 				NetServer::SendPacketToPlayer(players[i], STOC_HS_PLAYER_CHANGE, scpc);
-		for(auto pit = observers.begin(); pit != observers.end(); ++pit)
-			NetServer::SendPacketToPlayer(*pit, STOC_HS_PLAYER_CHANGE, scpc);
+		NetServer::SendPacketToPlayer(0, STOC_HS_PLAYER_CHANGE, scpc);
+		NetServer::ReSendToObservers(this);
 		STOC_TypeChange sctc;
 		sctc.type = (dp == host_player ? 0x10 : 0) | dptype;
 		NetServer::SendPacketToPlayer(dp, STOC_TYPE_CHANGE, sctc);
@@ -207,11 +211,12 @@ void TagDuel::ToObserver(DuelPlayer* dp) {
 	for(int i = 0; i < 4; ++i)
 		if(players[i])
 			NetServer::SendPacketToPlayer(players[i], STOC_HS_PLAYER_CHANGE, scpc);
-	for(auto pit = observers.begin(); pit != observers.end(); ++pit)
-		NetServer::SendPacketToPlayer(*pit, STOC_HS_PLAYER_CHANGE, scpc);
+	NetServer::SendPacketToPlayer(0, STOC_HS_PLAYER_CHANGE, scpc);
+	NetServer::ReSendToObservers(this);
 	players[dp->type] = 0;
 	ready[dp->type] = false;
 	dp->type = NETPLAYER_TYPE_OBSERVER;
+	NetServer::FlushObservers(this);
 	observers.insert(dp);
 	STOC_TypeChange sctc;
 	sctc.type = (dp == host_player ? 0x10 : 0) | dp->type;
@@ -248,8 +253,8 @@ void TagDuel::PlayerReady(DuelPlayer* dp, bool is_ready) {
 	for(int i = 0; i < 4; ++i)
 		if(players[i])
 			NetServer::SendPacketToPlayer(players[i], STOC_HS_PLAYER_CHANGE, scpc);
-	for(auto pit = observers.begin(); pit != observers.end(); ++pit)
-		NetServer::SendPacketToPlayer(*pit, STOC_HS_PLAYER_CHANGE, scpc);
+	NetServer::SendPacketToPlayer(0, STOC_HS_PLAYER_CHANGE, scpc);
+	NetServer::ReSendToObservers(this);
 }
 void TagDuel::PlayerKick(DuelPlayer* dp, unsigned char pos) {
 	if(pos > 3 || dp != host_player || dp == players[pos] || !players[pos])
@@ -282,10 +287,9 @@ void TagDuel::StartDuel(DuelPlayer* dp) {
 	//NetServer::StopBroadcast();
 	for(int i = 0; i < 4; ++i)
 		NetServer::SendPacketToPlayer(players[i], STOC_DUEL_START);
-	for(auto oit = observers.begin(); oit != observers.end(); ++oit) {
+	for(auto oit = observers.begin(); oit != observers.end(); ++oit)
 		(*oit)->state = CTOS_LEAVE_GAME;
-		NetServer::ReSendToPlayer(*oit);
-	}
+	NetServer::ReSendToObservers(this);
 	NetServer::SendPacketToPlayer(players[0], STOC_SELECT_HAND);
 	NetServer::ReSendToPlayer(players[2]);
 	hand_result[0] = 0;
@@ -307,8 +311,7 @@ void TagDuel::HandResult(DuelPlayer* dp, unsigned char res) {
 		schr.res2 = hand_result[1];
 		NetServer::SendPacketToPlayer(players[0], STOC_HAND_RESULT, schr);
 		NetServer::ReSendToPlayer(players[1]);
-		for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-			NetServer::ReSendToPlayer(*oit);
+		NetServer::ReSendToObservers(this);
 		schr.res1 = hand_result[1];
 		schr.res2 = hand_result[0];
 		NetServer::SendPacketToPlayer(players[2], STOC_HAND_RESULT, schr);
@@ -374,30 +377,37 @@ void TagDuel::TPResult(DuelPlayer* dp, unsigned char tp) {
 	last_replay.WriteData(players[2]->name, 40, false);
 	last_replay.WriteData(players[3]->name, 40, false);
 	if(!host_info.no_shuffle_deck) {
-		for(size_t i = pdeck[0].main.size() - 1; i > 0; --i) {
+		for(int i = (int)pdeck[0].main.size() - 1; i > 0; --i) {
 			int swap = rnd.real() * (i + 1);
 			std::swap(pdeck[0].main[i], pdeck[0].main[swap]);
 		}
-		for(size_t i = pdeck[1].main.size() - 1; i > 0; --i) {
+		for(int i = (int)pdeck[1].main.size() - 1; i > 0; --i) {
 			int swap = rnd.real() * (i + 1);
 			std::swap(pdeck[1].main[i], pdeck[1].main[swap]);
 		}
-		for(size_t i = pdeck[2].main.size() - 1; i > 0; --i) {
+		for(int i = (int)pdeck[2].main.size() - 1; i > 0; --i) {
 			int swap = rnd.real() * (i + 1);
 			std::swap(pdeck[2].main[i], pdeck[2].main[swap]);
 		}
-		for(size_t i = pdeck[3].main.size() - 1; i > 0; --i) {
+		for(int i = (int)pdeck[3].main.size() - 1; i > 0; --i) {
 			int swap = rnd.real() * (i + 1);
 			std::swap(pdeck[3].main[i], pdeck[3].main[swap]);
 		}
 	}
-	time_limit[0] = host_info.time_limit;
-	time_limit[1] = host_info.time_limit;
-	set_script_reader((script_reader)DataManager::ScriptReaderEx);
+	time_limit[0] = host_info.time_limit * 1000;
+	time_limit[1] = host_info.time_limit * 1000;
+	if(ScriptProfiler::IsEnabled())
+		set_script_reader((script_reader)ScriptProfiler::ScriptReader);
+	else
+		set_script_reader((script_reader)DataManager::ScriptReaderEx);
 	set_card_reader((card_reader)DataManager::CardReader);
 	set_message_handler((message_handler)TagDuel::MessageHandler);
 	rnd.reset(seed);
-	pduel = create_duel(rnd.rand());
+	{
+		std::lock_guard<std::mutex> lock(NetServer::engine_mutex);
+		pduel = create_duel(rnd.rand());
+	}
+	InvalidateQueryCache();
 	set_player_info(pduel, 0, host_info.start_lp, host_info.start_hand, host_info.draw_count);
 	set_player_info(pduel, 1, host_info.start_lp, host_info.start_hand, host_info.draw_count);
 	int opt = (int)host_info.duel_rule << 16;
@@ -472,10 +482,9 @@ void TagDuel::TPResult(DuelPlayer* dp, unsigned char tp) {
 	if(!swapped)
 		startbuf[1] = 0x10;
 	else startbuf[1] = 0x11;
-	for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-		NetServer::SendBufferToPlayer(*oit, STOC_GAME_MSG, startbuf, 19);
-	RefreshExtra(0);
-	RefreshExtra(1);
+	NetServer::SendBufferToPlayer(0, STOC_GAME_MSG, startbuf, 19);
+	NetServer::ReSendToObservers(this);
+	RefreshField(LOCATION_EXTRA);
 	start_duel(pduel, opt);
 	Process();
 }
@@ -486,13 +495,17 @@ void TagDuel::Process() {
 	while (!stop) {
 		if (engFlag == 2)
 			break;
+		unsigned long long start = ServerStats::Micros();
 		int result = process(pduel);
+		unsigned long long micros = ServerStats::Micros() - start;
 		engLen = result & 0xffff;
 		engFlag = result >> 16;
+		analyzed_messages = 0;
 		if (engLen > 0) {
 			get_message(pduel, (byte*)&engineBuffer);
 			stop = Analyze(engineBuffer, engLen);
 		}
+		ServerStats::AddProcess(stats, micros, analyzed_messages);
 	}
 	if(stop == 2)
 		DuelEndProc();
@@ -502,8 +515,7 @@ void TagDuel::DuelEndProc() {
 	NetServer::ReSendToPlayer(players[1]);
 	NetServer::ReSendToPlayer(players[2]);
 	NetServer::ReSendToPlayer(players[3]);
-	for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-		NetServer::ReSendToPlayer(*oit);
+	NetServer::ReSendToObservers(this);
 	duel_stage = DUEL_STAGE_END;
 }
 void TagDuel::Surrender(DuelPlayer* dp) {
@@ -515,6 +527,8 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 	while (pbuf - msgbuffer < (int)len) {
 		offset = pbuf;
 		unsigned char engType = BufferIO::ReadUInt8(pbuf);
+		analyzed_messages++;
+		TrackQueryCache(engType, pbuf);
 		switch (engType) {
 		case MSG_RETRY: {
 			WaitforResponse(last_response);
@@ -542,15 +556,13 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 				for(int i = 0; i < 4; ++i)
 					if(players[i] != cur_player[player])
 						NetServer::SendBufferToPlayer(players[i], STOC_GAME_MSG, offset, pbuf - offset);
-				for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-					NetServer::ReSendToPlayer(*oit);
+				NetServer::ReSendToObservers(this);
 				break;
 			}
 			case 10: {
 				for(int i = 0; i < 4; ++i)
 					NetServer::SendBufferToPlayer(players[i], STOC_GAME_MSG, offset, pbuf - offset);
-				for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-					NetServer::ReSendToPlayer(*oit);
+				NetServer::ReSendToObservers(this);
 				break;
 			}
 			}
@@ -563,8 +575,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			EndDuel();
 			return 2;
 		}
@@ -574,12 +585,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf += count * 11;
 			count = BufferIO::ReadInt8(pbuf);
 			pbuf += count * 8 + 2;
-			RefreshMzone(0);
-			RefreshMzone(1);
-			RefreshSzone(0);
-			RefreshSzone(1);
-			RefreshHand(0);
-			RefreshHand(1);
+			RefreshField(LOCATION_MZONE | LOCATION_SZONE | LOCATION_HAND);
 			WaitforResponse(player);
 			NetServer::SendBufferToPlayer(cur_player[player], STOC_GAME_MSG, offset, pbuf - offset);
 			return 1;
@@ -598,12 +604,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			pbuf += count * 7;
 			count = BufferIO::ReadInt8(pbuf);
 			pbuf += count * 11 + 3;
-			RefreshMzone(0);
-			RefreshMzone(1);
-			RefreshSzone(0);
-			RefreshSzone(1);
-			RefreshHand(0);
-			RefreshHand(1);
+			RefreshField(LOCATION_MZONE | LOCATION_SZONE | LOCATION_HAND);
 			WaitforResponse(player);
 			NetServer::SendBufferToPlayer(cur_player[player], STOC_GAME_MSG, offset, pbuf - offset);
 			return 1;
@@ -737,8 +738,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_CONFIRM_EXTRATOP: {
@@ -749,8 +749,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for (auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_CONFIRM_CARDS: {
@@ -762,8 +761,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 				NetServer::ReSendToPlayer(players[1]);
 				NetServer::ReSendToPlayer(players[2]);
 				NetServer::ReSendToPlayer(players[3]);
-				for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-					NetServer::ReSendToPlayer(*oit);
+				NetServer::ReSendToObservers(this);
 			} else {
 				pbuf += count * 7;
 				NetServer::SendBufferToPlayer(cur_player[player], STOC_GAME_MSG, offset, pbuf - offset);
@@ -776,8 +774,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_SHUFFLE_HAND: {
@@ -789,8 +786,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			for(int i = 0; i < 4; ++i)
 				if(players[i] != cur_player[player])
 					NetServer::SendBufferToPlayer(players[i], STOC_GAME_MSG, offset, pbuf - offset);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			RefreshHand(player, 0x781fff, 0);
 			break;
 		}
@@ -803,8 +799,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			for(int i = 0; i < 4; ++i)
 				if(players[i] != cur_player[player])
 					NetServer::SendBufferToPlayer(players[i], STOC_GAME_MSG, offset, pbuf - offset);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			RefreshExtra(player);
 			break;
 		}
@@ -814,8 +809,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_SWAP_GRAVE_DECK: {
@@ -824,8 +818,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			RefreshGrave(player);
 			break;
 		}
@@ -834,8 +827,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_DECK_TOP: {
@@ -844,8 +836,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_SHUFFLE_SET_CARD: {
@@ -856,27 +847,23 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			if(loc == LOCATION_MZONE) {
-				RefreshMzone(0, 0x181fff, 0);
-				RefreshMzone(1, 0x181fff, 0);
+				RefreshField(LOCATION_MZONE, 0x181fff, 0);
 			} else {
-				RefreshSzone(0, 0x181fff, 0);
-				RefreshSzone(1, 0x181fff, 0);
+				RefreshField(LOCATION_SZONE, 0x181fff, 0);
 			}
 			break;
 		}
 		case MSG_NEW_TURN: {
 			pbuf++;
-			time_limit[0] = host_info.time_limit;
-			time_limit[1] = host_info.time_limit;
+			time_limit[0] = host_info.time_limit * 1000;
+			time_limit[1] = host_info.time_limit * 1000;
 			NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, offset, pbuf - offset);
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			if(turn_count > 0) {
 				if(turn_count % 2 == 0) {
 					if(cur_player[0] == players[0])
@@ -899,14 +886,8 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			RefreshMzone(0);
-			RefreshMzone(1);
-			RefreshSzone(0);
-			RefreshSzone(1);
-			RefreshHand(0);
-			RefreshHand(1);
+			NetServer::ReSendToObservers(this);
+			RefreshField(LOCATION_MZONE | LOCATION_SZONE | LOCATION_HAND);
 			break;
 		}
 		case MSG_MOVE: {
@@ -926,8 +907,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			for(int i = 0; i < 4; ++i)
 				if(players[i] != cur_player[cc])
 					NetServer::SendBufferToPlayer(players[i], STOC_GAME_MSG, offset, pbuf - offset);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			if (cl != 0 && (cl & 0x80) == 0 && (cl != pl || pc != cc))
 				RefreshSingle(cc, cl, cs);
 			break;
@@ -943,8 +923,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			if((pp & POS_FACEDOWN) && (cp & POS_FACEUP))
 				RefreshSingle(cc, cl, cs);
 			break;
@@ -956,8 +935,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_SWAP: {
@@ -972,8 +950,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			RefreshSingle(c1, l1, s1);
 			RefreshSingle(c2, l2, s2);
 			break;
@@ -984,8 +961,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_SUMMONING: {
@@ -994,8 +970,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_SUMMONED: {
@@ -1003,12 +978,8 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			RefreshMzone(0);
-			RefreshMzone(1);
-			RefreshSzone(0);
-			RefreshSzone(1);
+			NetServer::ReSendToObservers(this);
+			RefreshField(LOCATION_MZONE | LOCATION_SZONE);
 			break;
 		}
 		case MSG_SPSUMMONING: {
@@ -1017,8 +988,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_SPSUMMONED: {
@@ -1026,12 +996,8 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			RefreshMzone(0);
-			RefreshMzone(1);
-			RefreshSzone(0);
-			RefreshSzone(1);
+			NetServer::ReSendToObservers(this);
+			RefreshField(LOCATION_MZONE | LOCATION_SZONE);
 			break;
 		}
 		case MSG_FLIPSUMMONING: {
@@ -1041,8 +1007,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_FLIPSUMMONED: {
@@ -1050,12 +1015,8 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			RefreshMzone(0);
-			RefreshMzone(1);
-			RefreshSzone(0);
-			RefreshSzone(1);
+			NetServer::ReSendToObservers(this);
+			RefreshField(LOCATION_MZONE | LOCATION_SZONE);
 			break;
 		}
 		case MSG_CHAINING: {
@@ -1064,8 +1025,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_CHAINED: {
@@ -1074,14 +1034,8 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			RefreshMzone(0);
-			RefreshMzone(1);
-			RefreshSzone(0);
-			RefreshSzone(1);
-			RefreshHand(0);
-			RefreshHand(1);
+			NetServer::ReSendToObservers(this);
+			RefreshField(LOCATION_MZONE | LOCATION_SZONE | LOCATION_HAND);
 			break;
 		}
 		case MSG_CHAIN_SOLVING: {
@@ -1090,8 +1044,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_CHAIN_SOLVED: {
@@ -1100,14 +1053,8 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			RefreshMzone(0);
-			RefreshMzone(1);
-			RefreshSzone(0);
-			RefreshSzone(1);
-			RefreshHand(0);
-			RefreshHand(1);
+			NetServer::ReSendToObservers(this);
+			RefreshField(LOCATION_MZONE | LOCATION_SZONE | LOCATION_HAND);
 			break;
 		}
 		case MSG_CHAIN_END: {
@@ -1115,14 +1062,8 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			RefreshMzone(0);
-			RefreshMzone(1);
-			RefreshSzone(0);
-			RefreshSzone(1);
-			RefreshHand(0);
-			RefreshHand(1);
+			NetServer::ReSendToObservers(this);
+			RefreshField(LOCATION_MZONE | LOCATION_SZONE | LOCATION_HAND);
 			break;
 		}
 		case MSG_CHAIN_NEGATED: {
@@ -1131,8 +1072,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_CHAIN_DISABLED: {
@@ -1141,8 +1081,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_CARD_SELECTED: {
@@ -1159,8 +1098,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_BECOME_TARGET: {
@@ -1170,8 +1108,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_DRAW: {
@@ -1189,8 +1126,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			for(int i = 0; i < 4; ++i)
 				if(players[i] != cur_player[player])
 					NetServer::SendBufferToPlayer(players[i], STOC_GAME_MSG, offset, pbuf - offset);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_DAMAGE: {
@@ -1199,8 +1135,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_RECOVER: {
@@ -1209,8 +1144,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_EQUIP: {
@@ -1219,8 +1153,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_LPUPDATE: {
@@ -1229,8 +1162,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_UNEQUIP: {
@@ -1239,8 +1171,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_CARD_TARGET: {
@@ -1249,8 +1180,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_CANCEL_TARGET: {
@@ -1259,8 +1189,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_PAY_LPCOST: {
@@ -1269,8 +1198,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_ADD_COUNTER: {
@@ -1279,8 +1207,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_REMOVE_COUNTER: {
@@ -1289,8 +1216,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_ATTACK: {
@@ -1299,8 +1225,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_BATTLE: {
@@ -1309,8 +1234,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_ATTACK_DISABLED: {
@@ -1318,8 +1242,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_DAMAGE_STEP_START: {
@@ -1327,10 +1250,8 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			RefreshMzone(0);
-			RefreshMzone(1);
+			NetServer::ReSendToObservers(this);
+			RefreshField(LOCATION_MZONE);
 			break;
 		}
 		case MSG_DAMAGE_STEP_END: {
@@ -1338,10 +1259,8 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			RefreshMzone(0);
-			RefreshMzone(1);
+			NetServer::ReSendToObservers(this);
+			RefreshField(LOCATION_MZONE);
 			break;
 		}
 		case MSG_MISSED_EFFECT: {
@@ -1358,8 +1277,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_TOSS_DICE: {
@@ -1370,8 +1288,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_ROCK_PAPER_SCISSORS: {
@@ -1386,8 +1303,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for (auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_ANNOUNCE_RACE: {
@@ -1419,8 +1335,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_PLAYER_HINT: {
@@ -1429,8 +1344,7 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[1]);
 			NetServer::ReSendToPlayer(players[2]);
 			NetServer::ReSendToPlayer(players[3]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			break;
 		}
 		case MSG_TAG_SWAP: {
@@ -1457,15 +1371,11 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			for(int i = 0; i < 4; ++i)
 				if(players[i] != cur_player[player])
 					NetServer::SendBufferToPlayer(players[i], STOC_GAME_MSG, offset, pbuf - offset);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
+			NetServer::ReSendToObservers(this);
 			RefreshExtra(player);
-			RefreshMzone(0, 0x81fff, 0);
-			RefreshMzone(1, 0x81fff, 0);
-			RefreshSzone(0, 0x681fff, 0);
-			RefreshSzone(1, 0x681fff, 0);
-			RefreshHand(0, 0x781fff, 0);
-			RefreshHand(1, 0x781fff, 0);
+			RefreshField(LOCATION_MZONE, 0x81fff, 0);
+			RefreshField(LOCATION_SZONE, 0x681fff, 0);
+			RefreshField(LOCATION_HAND, 0x781fff, 0);
 			break;
 		}
 		case MSG_MATCH_KILL: {
@@ -1483,12 +1393,14 @@ void TagDuel::GetResponse(DuelPlayer* dp, void* pdata, unsigned int len) {
 	last_replay.WriteData(resb, len);
 	set_responseb(pduel, resb);
 	players[dp->type]->state = 0xff;
+	ServerStats::AddResponse(stats, (ServerStats::Micros() - response_start) / 1000);
 	if(host_info.time_limit) {
 		int resp_type = dp->type < 2 ? 0 : 1;
-		if(time_limit[resp_type] >= time_elapsed)
-			time_limit[resp_type] -= time_elapsed;
+		unsigned long long elapsed = TimerWheel::Now() - time_start;
+		if(time_limit[resp_type] >= elapsed)
+			time_limit[resp_type] -= elapsed;
 		else time_limit[resp_type] = 0;
-		event_del(etimer);
+		timer_wheel->Remove(&timer);
 	}
 	Process();
 }
@@ -1496,21 +1408,27 @@ void TagDuel::EndDuel() {
 	if(!pduel)
 		return;
 	last_replay.EndRecord();
-	char replaybuf[0x2000], *pbuf = replaybuf;
-	memcpy(pbuf, &last_replay.pheader, sizeof(ReplayHeader));
-	pbuf += sizeof(ReplayHeader);
-	memcpy(pbuf, last_replay.comp_data, last_replay.comp_size);
-	NetServer::SendBufferToPlayer(players[0], STOC_REPLAY, replaybuf, sizeof(ReplayHeader) + last_replay.comp_size);
-	NetServer::ReSendToPlayer(players[1]);
-	NetServer::ReSendToPlayer(players[2]);
-	NetServer::ReSendToPlayer(players[3]);
-	for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-		NetServer::ReSendToPlayer(*oit);
-	end_duel(pduel);
+	// a replay that outgrows one packet cannot be delivered to the clients
+	if(sizeof(ReplayHeader) + last_replay.comp_size <= 0x2000 - 3) {
+		char replaybuf[0x2000], *pbuf = replaybuf;
+		memcpy(pbuf, &last_replay.pheader, sizeof(ReplayHeader));
+		pbuf += sizeof(ReplayHeader);
+		memcpy(pbuf, last_replay.comp_data.data(), last_replay.comp_size);
+		NetServer::SendBufferToPlayer(players[0], STOC_REPLAY, replaybuf, sizeof(ReplayHeader) + last_replay.comp_size);
+		NetServer::ReSendToPlayer(players[1]);
+		NetServer::ReSendToPlayer(players[2]);
+		NetServer::ReSendToPlayer(players[3]);
+		NetServer::ReSendToObservers(this);
+	}
+	{
+		std::lock_guard<std::mutex> lock(NetServer::engine_mutex);
+		end_duel(pduel);
+	}
 	pduel = 0;
 }
 void TagDuel::WaitforResponse(int playerid) {
 	last_response = playerid;
+	response_start = ServerStats::Micros();
 	unsigned char msg = MSG_WAITING;
 	for(int i = 0; i < 4; ++i)
 		if(players[i] != cur_player[playerid])
@@ -1518,7 +1436,7 @@ void TagDuel::WaitforResponse(int playerid) {
 	if(host_info.time_limit) {
 		STOC_TimeLimit sctl;
 		sctl.player = playerid;
-		sctl.left_time = time_limit[playerid];
+		sctl.left_time = time_limit[playerid] / 1000;
 		NetServer::SendPacketToPlayer(players[0], STOC_TIME_LIMIT, sctl);
 		NetServer::ReSendToPlayer(players[1]);
 		NetServer::ReSendToPlayer(players[2]);
@@ -1533,113 +1451,39 @@ void TagDuel::TimeConfirm(DuelPlayer* dp) {
 	if(dp != cur_player[last_response])
 		return;
 	cur_player[last_response]->state = CTOS_RESPONSE;
-	time_elapsed = 0;
-	timeval timeout = {1, 0};
-	event_add(etimer, &timeout);
+	time_start = TimerWheel::Now();
+	timer_wheel->Add(&timer, time_limit[last_response]);
 }
 void TagDuel::RefreshMzone(int player, int flag, int use_cache) {
-	char query_buffer[0x4000];
-	char* qbuf = query_buffer;
-	BufferIO::WriteInt8(qbuf, MSG_UPDATE_DATA);
-	BufferIO::WriteInt8(qbuf, player);
-	BufferIO::WriteInt8(qbuf, LOCATION_MZONE);
-	int len = query_field_card(pduel, player, LOCATION_MZONE, flag, (unsigned char*)qbuf, use_cache);
-	int pid = (player == 0) ? 0 : 2;
-	NetServer::SendBufferToPlayer(players[pid], STOC_GAME_MSG, query_buffer, len + 3);
-	NetServer::ReSendToPlayer(players[pid + 1]);
-	int qlen = 0;
-	while(qlen < len) {
-		int clen = BufferIO::ReadInt32(qbuf);
-		qlen += clen;
-		if (clen == 4)
-			continue;
-		if (qbuf[11] & POS_FACEDOWN)
-			memset(qbuf, 0, clen - 4);
-		qbuf += clen - 4;
-	}
-	pid = 2 - pid;
-	NetServer::SendBufferToPlayer(players[pid], STOC_GAME_MSG, query_buffer, len + 3);
-	NetServer::ReSendToPlayer(players[pid + 1]);
-	for(auto pit = observers.begin(); pit != observers.end(); ++pit)
-		NetServer::ReSendToPlayer(*pit);
+	RefreshLocation(player, LOCATION_MZONE, flag, use_cache);
 }
 void TagDuel::RefreshSzone(int player, int flag, int use_cache) {
-	char query_buffer[0x4000];
-	char* qbuf = query_buffer;
-	BufferIO::WriteInt8(qbuf, MSG_UPDATE_DATA);
-	BufferIO::WriteInt8(qbuf, player);
-	BufferIO::WriteInt8(qbuf, LOCATION_SZONE);
-	int len = query_field_card(pduel, player, LOCATION_SZONE, flag, (unsigned char*)qbuf, use_cache);
-	int pid = (player == 0) ? 0 : 2;
-	NetServer::SendBufferToPlayer(players[pid], STOC_GAME_MSG, query_buffer, len + 3);
-	NetServer::ReSendToPlayer(players[pid + 1]);
-	int qlen = 0;
-	while(qlen < len) {
-		int clen = BufferIO::ReadInt32(qbuf);
-		qlen += clen;
-		if (clen == 4)
-			continue;
-		if (qbuf[11] & POS_FACEDOWN)
-			memset(qbuf, 0, clen - 4);
-		qbuf += clen - 4;
-	}
-	pid = 2 - pid;
-	NetServer::SendBufferToPlayer(players[pid], STOC_GAME_MSG, query_buffer, len + 3);
-	NetServer::ReSendToPlayer(players[pid + 1]);
-	for(auto pit = observers.begin(); pit != observers.end(); ++pit)
-		NetServer::ReSendToPlayer(*pit);
+	RefreshLocation(player, LOCATION_SZONE, flag, use_cache);
 }
 void TagDuel::RefreshHand(int player, int flag, int use_cache) {
-	char query_buffer[0x4000];
-	char* qbuf = query_buffer;
-	BufferIO::WriteInt8(qbuf, MSG_UPDATE_DATA);
-	BufferIO::WriteInt8(qbuf, player);
-	BufferIO::WriteInt8(qbuf, LOCATION_HAND);
-	int len = query_field_card(pduel, player, LOCATION_HAND, flag | QUERY_POSITION, (unsigned char*)qbuf, use_cache);
-	NetServer::SendBufferToPlayer(cur_player[player], STOC_GAME_MSG, query_buffer, len + 3);
-	int qlen = 0;
-	while(qlen < len) {
-		int slen = BufferIO::ReadInt32(qbuf);
-		int qflag = *(int*)qbuf;
-		int offset = 8;
-		if(!(qflag & QUERY_CODE))
-			offset -= 4;
-		unsigned position = ((*(int*)(qbuf + offset)) >> 24) & 0xff;
-		if(!(position & POS_FACEUP))
-			memset(qbuf, 0, slen - 4);
-		qbuf += slen - 4;
-		qlen += slen;
-	}
-	for(int i = 0; i < 4; ++i)
-		if(players[i] != cur_player[player])
-			NetServer::SendBufferToPlayer(players[i], STOC_GAME_MSG, query_buffer, len + 3);
-	for(auto pit = observers.begin(); pit != observers.end(); ++pit)
-		NetServer::ReSendToPlayer(*pit);
+	RefreshLocation(player, LOCATION_HAND, flag, use_cache);
 }
 void TagDuel::RefreshGrave(int player, int flag, int use_cache) {
-	char query_buffer[0x4000];
-	char* qbuf = query_buffer;
-	BufferIO::WriteInt8(qbuf, MSG_UPDATE_DATA);
-	BufferIO::WriteInt8(qbuf, player);
-	BufferIO::WriteInt8(qbuf, LOCATION_GRAVE);
-	int len = query_field_card(pduel, player, LOCATION_GRAVE, flag, (unsigned char*)qbuf, use_cache);
-	NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, query_buffer, len + 3);
-	NetServer::ReSendToPlayer(players[1]);
-	NetServer::ReSendToPlayer(players[2]);
-	NetServer::ReSendToPlayer(players[3]);
-	for(auto pit = observers.begin(); pit != observers.end(); ++pit)
-		NetServer::ReSendToPlayer(*pit);
+	RefreshLocation(player, LOCATION_GRAVE, flag, use_cache);
 }
 void TagDuel::RefreshExtra(int player, int flag, int use_cache) {
-	char query_buffer[0x4000];
-	char* qbuf = query_buffer;
-	BufferIO::WriteInt8(qbuf, MSG_UPDATE_DATA);
-	BufferIO::WriteInt8(qbuf, player);
-	BufferIO::WriteInt8(qbuf, LOCATION_EXTRA);
-	int len = query_field_card(pduel, player, LOCATION_EXTRA, flag, (unsigned char*)qbuf, use_cache);
-	NetServer::SendBufferToPlayer(cur_player[player], STOC_GAME_MSG, query_buffer, len + 3);
+	RefreshLocation(player, LOCATION_EXTRA, flag, use_cache);
+}
+void TagDuel::SendLocationQuery(int player, int location, char* query, char* masked, int len) {
+	for(int i = 0; i < 4; ++i) {
+		bool owner = (location & (LOCATION_HAND | LOCATION_EXTRA)) ? players[i] == cur_player[player] : i / 2 == player;
+		if(owner || (!masked && location != LOCATION_EXTRA))
+			SendQueryUpdate(players[i], i, query, len);
+		else if(masked)
+			SendQueryUpdate(players[i], i, masked, len);
+	}
+	if(location == LOCATION_EXTRA)
+		return;
+	if(SendQueryUpdate(0, QUERY_VIEWER_OBSERVER, masked ? masked : query, len))
+		NetServer::ReSendToObservers(this);
 }
 void TagDuel::RefreshSingle(int player, int location, int sequence, int flag) {
+	InvalidateQueryCache(player, location);
 	char query_buffer[0x4000];
 	char* qbuf = query_buffer;
 	BufferIO::WriteInt8(qbuf, MSG_UPDATE_CARD);
@@ -1655,8 +1499,7 @@ void TagDuel::RefreshSingle(int player, int location, int sequence, int flag) {
 			pid = 2 - pid;
 			NetServer::SendBufferToPlayer(players[pid], STOC_GAME_MSG, query_buffer, len + 4);
 			NetServer::ReSendToPlayer(players[pid + 1]);
-			for(auto pit = observers.begin(); pit != observers.end(); ++pit)
-				NetServer::ReSendToPlayer(*pit);
+			NetServer::ReSendToObservers(this);
 		}
 	} else {
 		int pid = (player == 0) ? 0 : 2;
@@ -1668,8 +1511,7 @@ void TagDuel::RefreshSingle(int player, int location, int sequence, int flag) {
 			for(int i = 0; i < 4; ++i)
 				if(players[i] != cur_player[player])
 					NetServer::ReSendToPlayer(players[i]);
-			for(auto pit = observers.begin(); pit != observers.end(); ++pit)
-				NetServer::ReSendToPlayer(*pit);
+			NetServer::ReSendToObservers(this);
 		}
 	}
 }
@@ -1678,26 +1520,28 @@ int TagDuel::MessageHandler(long fduel, int type) {
 		return 0;
 	char msgbuf[1024];
 	get_log_message(fduel, (byte*)msgbuf);
+#ifdef YGOPRO_SERVER_MODE
+	fprintf(stderr, "%s\n", msgbuf);
+#else
 	mainGame->AddDebugMsg(msgbuf);
+#endif
 	return 0;
 }
-void TagDuel::TagTimer(evutil_socket_t fd, short events, void* arg) {
+// the player to respond has run out of time
+void TagDuel::TagTimer(void* arg) {
 	TagDuel* sd = static_cast<TagDuel*>(arg);
-	sd->time_elapsed++;
-	if(sd->time_elapsed >= sd->time_limit[sd->last_response]) {
-		unsigned char wbuf[3];
-		uint32 player = sd->last_response;
-		wbuf[0] = MSG_WIN;
-		wbuf[1] = 1 - player;
-		wbuf[2] = 0x3;
-		NetServer::SendBufferToPlayer(sd->players[0], STOC_GAME_MSG, wbuf, 3);
-		NetServer::ReSendToPlayer(sd->players[1]);
-		NetServer::ReSendToPlayer(sd->players[2]);
-		NetServer::ReSendToPlayer(sd->players[3]);
-		sd->EndDuel();
-		sd->DuelEndProc();
-		event_del(sd->etimer);
-	}
+	unsigned char wbuf[3];
+	uint32 player = sd->last_response;
+	sd->time_limit[player] = 0;
+	wbuf[0] = MSG_WIN;
+	wbuf[1] = 1 - player;
+	wbuf[2] = 0x3;
+	NetServer::SendBufferToPlayer(sd->players[0], STOC_GAME_MSG, wbuf, 3);
+	NetServer::ReSendToPlayer(sd->players[1]);
+	NetServer::ReSendToPlayer(sd->players[2]);
+	NetServer::ReSendToPlayer(sd->players[3]);
+	sd->EndDuel();
+	sd->DuelEndProc();
 }
 
 }
@@ -39,13 +39,14 @@ public:
 	void RefreshSingle(int player, int location, int sequence, int flag = 0xf81fff);
 
 	static int MessageHandler(long fduel, int type);
-	static void TagTimer(evutil_socket_t fd, short events, void* arg);
+	static void TagTimer(void* arg);
 	
 protected:
+	virtual void SendLocationQuery(int player, int location, char* query, char* masked, int len);
+
 	DuelPlayer* players[4];
 	DuelPlayer* pplayer[4];
 	DuelPlayer* cur_player[2];
-	std::set<DuelPlayer*> observers;
 	bool ready[4];
 	Deck pdeck[4];
 	int deck_error[4];
@@ -53,8 +54,8 @@ protected:
 	unsigned char last_response;
 	Replay last_replay;
 	unsigned char turn_count;
-	unsigned short time_limit[2];
-	unsigned short time_elapsed;
+	unsigned int time_limit[2]; // milliseconds left
+	unsigned long long time_start; // TimerWheel::Now() when the timer was started
 };
 
 }
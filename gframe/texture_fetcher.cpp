@@ -0,0 +1,209 @@
+#include "config.h"
+#include "texture_fetcher.h"
+#include <SFML/Network.hpp>
+
+namespace ygo {
+
+TextureFetcher::~TextureFetcher() {
+	Stop();
+}
+void TextureFetcher::SetCacheDir(const char* dir) {
+	cache_dir = dir;
+}
+void TextureFetcher::Fetch(int id, const char* host, const char* path) {
+	FetchRequest request;
+	request.id = id;
+	request.host = host;
+	request.path = path;
+	{
+		std::lock_guard<std::mutex> lock(fetch_mutex);
+		if(stopping)
+			return;
+		requests.push_back(request);
+		if(!worker.joinable())
+			worker = std::thread(&TextureFetcher::FetchThread, this);
+	}
+	fetch_cond.notify_one();
+}
+bool TextureFetcher::Poll(FetchResult& result) {
+	std::lock_guard<std::mutex> lock(fetch_mutex);
+	if(results.empty())
+		return false;
+	result.id = results.front().id;
+	result.last = results.front().last;
+	result.body.swap(results.front().body);
+	results.pop_front();
+	return true;
+}
+// a download in progress is finished first, bounded by FETCH_TIMEOUT
+void TextureFetcher::Stop() {
+	{
+		std::lock_guard<std::mutex> lock(fetch_mutex);
+		stopping = true;
+		requests.clear();
+	}
+	fetch_cond.notify_all();
+	if(worker.joinable())
+		worker.join();
+}
+void TextureFetcher::FetchThread() {
+	while(true) {
+		FetchRequest request;
+		{
+			std::unique_lock<std::mutex> lock(fetch_mutex);
+			fetch_cond.wait(lock, [this]() { return stopping || !requests.empty(); });
+			if(stopping)
+				return;
+			request = requests.front();
+			requests.pop_front();
+		}
+		if(!cache_loaded) {
+			LoadIndex();
+			cache_loaded = true;
+		}
+		Download(request);
+	}
+}
+void TextureFetcher::Download(const FetchRequest& request) {
+	std::string url = request.host + request.path;
+	std::vector<char> body;
+	auto cit = index.find(url);
+	bool cached = cit != index.end() && ReadCache(cit->second.hash, body);
+	if(cached)
+		Deliver(request.id, body, false);
+	// sf::Http takes the port apart from the host
+	std::string host = request.host;
+	unsigned short port = 0;
+	size_t colon = host.rfind(':');
+	if(colon != std::string::npos && colon + 1 < host.size() && host.find_first_not_of("0123456789", colon + 1) == std::string::npos) {
+		port = atoi(host.c_str() + colon + 1);
+		host.erase(colon);
+	}
+	sf::Http http(host, port);
+	sf::Http::Request req(request.path, sf::Http::Request::Get);
+	if(cached) {
+		if(!cit->second.etag.empty())
+			req.setField("If-None-Match", cit->second.etag);
+		if(!cit->second.modified.empty())
+			req.setField("If-Modified-Since", cit->second.modified);
+	}
+	sf::Http::Response response = http.sendRequest(req, sf::seconds(FETCH_TIMEOUT));
+	if(response.getStatus() != sf::Http::Response::Ok) {
+		Deliver(request.id, std::vector<char>(), true);
+		return;
+	}
+	const std::string& data = response.getBody();
+	body.assign(data.begin(), data.end());
+	FetchCacheEntry entry;
+	entry.hash = HashBody(body);
+	entry.etag = response.getField("ETag");
+	entry.modified = response.getField("Last-Modified");
+	bool changed = !cached || entry.hash != cit->second.hash;
+	if(changed)
+		WriteCache(entry.hash, body);
+	else
+		body.clear();
+	Deliver(request.id, body, true);
+	std::string old_hash = cached ? cit->second.hash : std::string();
+	index[url] = entry;
+	if(changed && cached)
+		DropCache(old_hash);
+	SaveIndex();
+}
+// remove a cached body no url refers to anymore
+void TextureFetcher::DropCache(const std::string& hash) {
+	for(auto& entry : index) {
+		if(entry.second.hash == hash)
+			return;
+	}
+	std::string file = cache_dir + "/" + hash;
+	remove(file.c_str());
+}
+void TextureFetcher::Deliver(int id, const std::vector<char>& body, bool last) {
+	FetchResult result;
+	result.id = id;
+	result.last = last;
+	result.body = body;
+	std::lock_guard<std::mutex> lock(fetch_mutex);
+	results.push_back(result);
+}
+bool TextureFetcher::ReadCache(const std::string& hash, std::vector<char>& body) {
+	std::string file = cache_dir + "/" + hash;
+	FILE* fp = fopen(file.c_str(), "rb");
+	if(!fp)
+		return false;
+	body.clear();
+	char block[0x4000];
+	size_t len;
+	while((len = fread(block, 1, sizeof(block), fp)) > 0)
+		body.insert(body.end(), block, block + len);
+	fclose(fp);
+	// the file name is the hash of its content, so a damaged copy does not pass
+	return !body.empty() && HashBody(body) == hash;
+}
+void TextureFetcher::WriteCache(const std::string& hash, const std::vector<char>& body) {
+	FileSystem::MakeDir(cache_dir.c_str());
+	std::string file = cache_dir + "/" + hash;
+	std::string temp = file + ".tmp";
+	FILE* fp = fopen(temp.c_str(), "wb");
+	if(!fp)
+		return;
+	bool written = fwrite(body.data(), 1, body.size(), fp) == body.size();
+	fclose(fp);
+	remove(file.c_str());
+	if(!written || rename(temp.c_str(), file.c_str()))
+		remove(temp.c_str());
+}
+// one line per url: url, content hash, etag and last modified, separated by tabs
+void TextureFetcher::LoadIndex() {
+	std::string file = cache_dir + "/index.txt";
+	FILE* fp = fopen(file.c_str(), "r");
+	if(!fp)
+		return;
+	char linebuf[1024];
+	while(fgets(linebuf, sizeof(linebuf), fp)) {
+		std::string line(linebuf);
+		while(!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+			line.pop_back();
+		std::vector<std::string> fields;
+		size_t start = 0, tab;
+		while((tab = line.find('\t', start)) != std::string::npos) {
+			fields.push_back(line.substr(start, tab - start));
+			start = tab + 1;
+		}
+		fields.push_back(line.substr(start));
+		if(fields.size() != 4)
+			continue;
+		FetchCacheEntry& entry = index[fields[0]];
+		entry.hash = fields[1];
+		entry.etag = fields[2];
+		entry.modified = fields[3];
+	}
+	fclose(fp);
+}
+void TextureFetcher::SaveIndex() {
+	FileSystem::MakeDir(cache_dir.c_str());
+	std::string file = cache_dir + "/index.txt";
+	std::string temp = file + ".tmp";
+	FILE* fp = fopen(temp.c_str(), "w");
+	if(!fp)
+		return;
+	for(auto& entry : index)
+		fprintf(fp, "%s\t%s\t%s\t%s\n", entry.first.c_str(), entry.second.hash.c_str(), entry.second.etag.c_str(), entry.second.modified.c_str());
+	fclose(fp);
+	remove(file.c_str());
+	rename(temp.c_str(), file.c_str());
+}
+// 64-bit FNV-1a
+std::string TextureFetcher::HashBody(const std::vector<char>& body) {
+	unsigned long long hash = 0xcbf29ce484222325ULL;
+	for(char c : body) {
+		hash ^= (unsigned char)c;
+		hash *= 0x100000001b3ULL;
+	}
+	char buf[20];
+	sprintf(buf, "%016llx", hash);
+	return buf;
+}
+
+}
@@ -0,0 +1,71 @@
+#ifndef TEXTURE_FETCHER_H
+#define TEXTURE_FETCHER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace ygo {
+
+#define FETCH_TIMEOUT		10 // seconds
+
+struct FetchRequest {
+	int id;
+	std::string host;
+	std::string path;
+};
+
+struct FetchResult {
+	int id;
+	bool last; // no more results for this id
+	std::vector<char> body;
+};
+
+struct FetchCacheEntry {
+	std::string hash;
+	std::string etag;
+	std::string modified;
+};
+
+// downloads textures on a background thread into a content addressed disk cache.
+// a cached copy is handed out right away and then revalidated with If-None-Match/If-Modified-Since;
+// a changed body is handed out again. results are picked up with Poll; every request ends with
+// one marked last, with an empty body when there was nothing new
+class TextureFetcher {
+public:
+	TextureFetcher(): cache_loaded(false), stopping(false) {}
+	~TextureFetcher();
+	void SetCacheDir(const char* dir);
+	void Fetch(int id, const char* host, const char* path);
+	bool Poll(FetchResult& result);
+	void Stop();
+
+private:
+	void FetchThread();
+	void Download(const FetchRequest& request);
+	void Deliver(int id, const std::vector<char>& body, bool last);
+	bool ReadCache(const std::string& hash, std::vector<char>& body);
+	void WriteCache(const std::string& hash, const std::vector<char>& body);
+	void DropCache(const std::string& hash);
+	void LoadIndex();
+	void SaveIndex();
+	static std::string HashBody(const std::vector<char>& body);
+
+	std::string cache_dir;
+	std::unordered_map<std::string, FetchCacheEntry> index;
+	bool cache_loaded;
+	std::deque<FetchRequest> requests;
+	std::deque<FetchResult> results;
+	std::thread worker;
+	std::mutex fetch_mutex;
+	std::condition_variable fetch_cond;
+	bool stopping;
+};
+
+}
+
+#endif //TEXTURE_FETCHER_H
@@ -0,0 +1,139 @@
+#include "thumb_atlas.h"
+#include "image_manager.h"
+
+namespace ygo {
+
+void ThumbAtlas::SetDriver(irr::video::IVideoDriver* drv) {
+	driver = drv;
+}
+// queue a thumbnail drawn at dest for the next Draw; returns false when the caller has to draw it
+// directly, which happens for the rest of a frame in which the atlas ran full or the window was resized
+bool ThumbAtlas::Queue(int code, irr::video::ITexture* thumb, const ThumbBadge* badges, int count, const irr::core::recti& dest) {
+	if(!driver || full)
+		return false;
+	irr::core::dimension2du size(dest.getWidth(), dest.getHeight());
+	if(size.Width == 0 || size.Height == 0 || size.Width > ATLAS_PAGE_SIZE || size.Height > ATLAS_PAGE_SIZE)
+		return false;
+	if(size != slot_size) {
+		if(!slots.empty()) {
+			full = true;
+			return false;
+		}
+		slot_size = size;
+	}
+	unsigned long long key = (unsigned int)code;
+	for(int i = 0; i < count; ++i)
+		key |= (unsigned long long)badges[i].id << (32 + i * 4);
+	auto sit = slots.find(key);
+	if(sit == slots.end()) {
+		if(!AddSlot(key, thumb, badges, count)) {
+			full = true;
+			return false;
+		}
+		sit = slots.find(key);
+	}
+	if(runs.empty() || runs.back().page != sit->second.page) {
+		runs.emplace_back();
+		runs.back().page = sit->second.page;
+	}
+	runs.back().positions.push_back(dest.UpperLeftCorner);
+	runs.back().sources.push_back(sit->second.rect);
+	return true;
+}
+// upload the slots composed since the last frame, then draw the queued runs in order
+void ThumbAtlas::Draw() {
+	for(auto& page : pages) {
+		if(page.pending.empty())
+			continue;
+		void* data = page.texture->lock();
+		if(data) {
+			irr::video::IImage* holder = driver->createImageFromData(page.texture->getColorFormat(), page.texture->getSize(), data, true, false);
+			for(auto& slot : page.pending)
+				slot.second->copyTo(holder, slot.first);
+			holder->drop();
+			page.texture->unlock();
+		}
+		for(auto& slot : page.pending)
+			slot.second->drop();
+		page.pending.clear();
+	}
+	for(auto& run : runs)
+		driver->draw2DImageBatch(pages[run.page].texture, run.positions, run.sources, 0, irr::video::SColor(255, 255, 255, 255), true);
+	runs.clear();
+	if(full)
+		Clear();
+}
+void ThumbAtlas::Clear() {
+	for(auto& page : pages) {
+		for(auto& slot : page.pending)
+			slot.second->drop();
+		driver->removeTexture(page.texture);
+	}
+	pages.clear();
+	slots.clear();
+	runs.clear();
+	slot_size = irr::core::dimension2du(0, 0);
+	next_slot = 0;
+	full = false;
+}
+bool ThumbAtlas::AddSlot(unsigned long long key, irr::video::ITexture* thumb, const ThumbBadge* badges, int count) {
+	int columns = ATLAS_PAGE_SIZE / slot_size.Width;
+	int per_page = columns * (ATLAS_PAGE_SIZE / slot_size.Height);
+	int page = next_slot / per_page;
+	if(page >= ATLAS_MAX_PAGES)
+		return false;
+	if(page >= (int)pages.size()) {
+		char name[32];
+		sprintf(name, "thumb_atlas_%d", page);
+		bool flgmip = driver->getTextureCreationFlag(irr::video::ETCF_CREATE_MIP_MAPS);
+		driver->setTextureCreationFlag(irr::video::ETCF_CREATE_MIP_MAPS, false);
+		AtlasPage atlas_page;
+		atlas_page.texture = driver->addTexture(irr::core::dimension2du(ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE), name, irr::video::ECF_A8R8G8B8);
+		driver->setTextureCreationFlag(irr::video::ETCF_CREATE_MIP_MAPS, flgmip);
+		if(!atlas_page.texture)
+			return false;
+		pages.push_back(atlas_page);
+	}
+	int cell = next_slot % per_page;
+	irr::core::position2di pos((cell % columns) * slot_size.Width, (cell / columns) * slot_size.Height);
+	irr::video::IImage* image = driver->createImage(irr::video::ECF_A8R8G8B8, slot_size);
+	irr::core::dimension2du thumb_size = thumb->getOriginalSize();
+	Compose(image, thumb, irr::core::recti(0, 0, thumb_size.Width, thumb_size.Height), irr::core::recti(0, 0, slot_size.Width, slot_size.Height), false);
+	for(int i = 0; i < count; ++i)
+		Compose(image, badges[i].texture, badges[i].source, badges[i].dest, true);
+	pages[page].pending.push_back(std::make_pair(pos, image));
+	AtlasSlot slot;
+	slot.page = page;
+	slot.rect = irr::core::recti(pos, slot_size);
+	slots[key] = slot;
+	next_slot++;
+	return true;
+}
+// scale the source rect of texture, given in original size coordinates like draw2DImage takes it,
+// into the dest rect of target
+void ThumbAtlas::Compose(irr::video::IImage* target, irr::video::ITexture* texture, const irr::core::recti& source, const irr::core::recti& dest, bool alpha) {
+	if(!texture || dest.getWidth() <= 0 || dest.getHeight() <= 0)
+		return;
+	irr::core::dimension2du real = texture->getSize();
+	irr::core::dimension2du original = texture->getOriginalSize();
+	irr::core::recti rect(source.UpperLeftCorner.X * real.Width / original.Width, source.UpperLeftCorner.Y * real.Height / original.Height,
+	                      source.LowerRightCorner.X * real.Width / original.Width, source.LowerRightCorner.Y * real.Height / original.Height);
+	void* data = texture->lock();
+	if(!data)
+		return;
+	irr::video::IImage* whole = driver->createImageFromData(texture->getColorFormat(), real, data, true, false);
+	irr::video::IImage* part = driver->createImage(irr::video::ECF_A8R8G8B8, irr::core::dimension2du(rect.getWidth(), rect.getHeight()));
+	whole->copyTo(part, irr::core::position2di(0, 0), rect);
+	whole->drop();
+	texture->unlock();
+	irr::video::IImage* scaled = driver->createImage(irr::video::ECF_A8R8G8B8, irr::core::dimension2du(dest.getWidth(), dest.getHeight()));
+	imageScaleNNAA(part, scaled);
+	part->drop();
+	if(alpha)
+		scaled->copyToWithAlpha(target, dest.UpperLeftCorner, irr::core::recti(0, 0, dest.getWidth(), dest.getHeight()), irr::video::SColor(255, 255, 255, 255));
+	else
+		scaled->copyTo(target, dest.UpperLeftCorner);
+	scaled->drop();
+}
+
+}
@@ -0,0 +1,63 @@
+#ifndef THUMB_ATLAS_H
+#define THUMB_ATLAS_H
+
+#include "config.h"
+#include <unordered_map>
+#include <vector>
+
+namespace ygo {
+
+#define ATLAS_PAGE_SIZE		1024
+#define ATLAS_MAX_PAGES		4
+
+// an icon drawn over a thumbnail; id tells the icons apart in the atlas key and must be below 16
+struct ThumbBadge {
+	int id;
+	irr::video::ITexture* texture;
+	irr::core::recti source;
+	irr::core::recti dest;
+};
+
+struct AtlasSlot {
+	int page;
+	irr::core::recti rect;
+};
+
+struct AtlasPage {
+	irr::video::ITexture* texture;
+	std::vector<std::pair<irr::core::position2di, irr::video::IImage*>> pending;
+};
+
+// consecutive sprites of one page, drawn with a single draw2DImageBatch
+struct AtlasRun {
+	int page;
+	irr::core::array<irr::core::position2di> positions;
+	irr::core::array<irr::core::recti> sources;
+};
+
+// card thumbnails composed with their icons at the size they are drawn at, packed into shared pages
+// the way CGUITTFont pages its glyphs; a deck builder frame then takes a few batched draws
+class ThumbAtlas {
+public:
+	ThumbAtlas(): driver(0), next_slot(0), full(false) {}
+	void SetDriver(irr::video::IVideoDriver* drv);
+	bool Queue(int code, irr::video::ITexture* thumb, const ThumbBadge* badges, int count, const irr::core::recti& dest);
+	void Draw();
+	void Clear();
+
+private:
+	bool AddSlot(unsigned long long key, irr::video::ITexture* thumb, const ThumbBadge* badges, int count);
+	void Compose(irr::video::IImage* target, irr::video::ITexture* texture, const irr::core::recti& source, const irr::core::recti& dest, bool alpha);
+
+	irr::video::IVideoDriver* driver;
+	std::unordered_map<unsigned long long, AtlasSlot> slots;
+	std::vector<AtlasPage> pages;
+	std::vector<AtlasRun> runs;
+	irr::core::dimension2du slot_size;
+	int next_slot;
+	bool full;
+};
+
+}
+
+#endif //THUMB_ATLAS_H
@@ -0,0 +1,133 @@
+#include "timer_wheel.h"
+#include <chrono>
+
+namespace ygo {
+
+TimerWheel::TimerWheel(event_base* base): next_tick(0), count(0) {
+	for(int level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+		for(int slot = 0; slot < TIMER_WHEEL_SLOTS; ++slot) {
+			slots[level][slot].prev = &slots[level][slot];
+			slots[level][slot].next = &slots[level][slot];
+		}
+	}
+	ev = event_new(base, -1, EV_TIMEOUT, OnTimer, this);
+}
+TimerWheel::~TimerWheel() {
+	for(int level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+		for(int slot = 0; slot < TIMER_WHEEL_SLOTS; ++slot) {
+			TimerEntry* head = &slots[level][slot];
+			while(head->next != head) {
+				head->next->pending = false;
+				Unlink(head->next);
+			}
+		}
+	}
+	event_free(ev);
+}
+// a pending entry is moved to the new deadline; it never fires before it
+void TimerWheel::Add(TimerEntry* entry, unsigned long long milliseconds) {
+	Remove(entry);
+	unsigned long long now = Now();
+	// an empty wheel has stopped ticking and catches up at once
+	if(!count && next_tick < now / TIMER_WHEEL_TICK)
+		next_tick = now / TIMER_WHEEL_TICK;
+	entry->expires = (now + milliseconds + TIMER_WHEEL_TICK - 1) / TIMER_WHEEL_TICK;
+	if(entry->expires < next_tick)
+		entry->expires = next_tick;
+	entry->pending = true;
+	count++;
+	Insert(entry);
+	Schedule();
+}
+void TimerWheel::Remove(TimerEntry* entry) {
+	if(!entry->pending)
+		return;
+	Unlink(entry);
+	entry->pending = false;
+	count--;
+}
+// monotonic milliseconds
+unsigned long long TimerWheel::Now() {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+void TimerWheel::OnTimer(evutil_socket_t fd, short events, void* arg) {
+	TimerWheel* wheel = (TimerWheel*)arg;
+	unsigned long long now = Now() / TIMER_WHEEL_TICK;
+	while(wheel->count && wheel->next_tick <= now)
+		wheel->Tick();
+	wheel->Schedule();
+}
+// level n holds the deadlines less than 64^(n+1) ticks ahead, in the slot of their n-th group of 6 bits
+void TimerWheel::Insert(TimerEntry* entry) {
+	unsigned long long delta = entry->expires - next_tick;
+	if(delta >> (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) {
+		delta = (1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+		entry->expires = next_tick + delta;
+	}
+	int level = 0;
+	while(delta >> (TIMER_WHEEL_BITS * (level + 1)))
+		level++;
+	int slot = (entry->expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+	Link(&slots[level][slot], entry);
+}
+void TimerWheel::Cascade(int level, int slot) {
+	TimerEntry list;
+	list.prev = list.next = &list;
+	Splice(&slots[level][slot], &list);
+	while(list.next != &list) {
+		TimerEntry* entry = list.next;
+		Unlink(entry);
+		Insert(entry);
+	}
+}
+// a callback may add or remove any entry, its own included
+void TimerWheel::Tick() {
+	unsigned long long tick = next_tick;
+	for(int level = 1; level < TIMER_WHEEL_LEVELS && !((tick >> (TIMER_WHEEL_BITS * (level - 1))) & TIMER_WHEEL_MASK); ++level)
+		Cascade(level, (tick >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK);
+	next_tick = tick + 1;
+	TimerEntry list;
+	list.prev = list.next = &list;
+	Splice(&slots[0][tick & TIMER_WHEEL_MASK], &list);
+	while(list.next != &list) {
+		TimerEntry* entry = list.next;
+		Remove(entry);
+		entry->callback(entry->arg);
+	}
+}
+// wake up at the first occupied slot of the lowest level, or where the next level has to come down
+void TimerWheel::Schedule() {
+	if(!count) {
+		event_del(ev);
+		return;
+	}
+	unsigned long long tick = next_tick;
+	while((tick & TIMER_WHEEL_MASK) && slots[0][tick & TIMER_WHEEL_MASK].next == &slots[0][tick & TIMER_WHEEL_MASK])
+		tick++;
+	unsigned long long now = Now();
+	unsigned long long wait = tick * TIMER_WHEEL_TICK > now ? tick * TIMER_WHEEL_TICK - now : 0;
+	timeval timeout = {(long)(wait / 1000), (long)(wait % 1000) * 1000};
+	event_add(ev, &timeout);
+}
+void TimerWheel::Link(TimerEntry* head, TimerEntry* entry) {
+	entry->prev = head->prev;
+	entry->next = head;
+	head->prev->next = entry;
+	head->prev = entry;
+}
+void TimerWheel::Unlink(TimerEntry* entry) {
+	entry->prev->next = entry->next;
+	entry->next->prev = entry->prev;
+	entry->prev = entry->next = 0;
+}
+void TimerWheel::Splice(TimerEntry* from, TimerEntry* to) {
+	if(from->next == from)
+		return;
+	to->next = from->next;
+	to->prev = from->prev;
+	to->next->prev = to;
+	to->prev->next = to;
+	from->prev = from->next = from;
+}
+
+}
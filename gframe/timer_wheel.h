@@ -0,0 +1,57 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <event2/event.h>
+
+namespace ygo {
+
+#define TIMER_WHEEL_TICK	100 // milliseconds
+#define TIMER_WHEEL_BITS	6
+#define TIMER_WHEEL_SLOTS	(1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK	(TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS	4 // 2^24 ticks, a later deadline fires at that horizon
+
+typedef void (*TimerCallback)(void* arg);
+
+// a deadline on a TimerWheel; it is owned by its user and linked into the wheel while pending
+struct TimerEntry {
+	TimerEntry(): expires(0), callback(0), arg(0), prev(0), next(0), pending(false) {}
+	unsigned long long expires;
+	TimerCallback callback;
+	void* arg;
+	TimerEntry* prev;
+	TimerEntry* next;
+	bool pending;
+};
+
+// the deadlines of one event loop in a hierarchical timing wheel. the loop is only woken up
+// for the tick of the next deadline, or to move far deadlines down a level, instead of once
+// per timer and second
+class TimerWheel {
+public:
+	explicit TimerWheel(event_base* base);
+	~TimerWheel();
+	void Add(TimerEntry* entry, unsigned long long milliseconds);
+	void Remove(TimerEntry* entry);
+	static unsigned long long Now();
+
+private:
+	static void OnTimer(evutil_socket_t fd, short events, void* arg);
+	void Insert(TimerEntry* entry);
+	void Cascade(int level, int slot);
+	void Tick();
+	void Schedule();
+	static void Link(TimerEntry* head, TimerEntry* entry);
+	static void Unlink(TimerEntry* entry);
+	static void Splice(TimerEntry* from, TimerEntry* to);
+
+	// every slot is the sentinel of a circular list
+	TimerEntry slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+	unsigned long long next_tick;
+	unsigned int count;
+	event* ev;
+};
+
+}
+
+#endif //TIMER_WHEEL_H
@@ -230,11 +230,11 @@ typedef unsigned long Instruction;
 ** created/deleted/resumed/yielded.
 */
 #if !defined(luai_userstateopen)
-#define luai_userstateopen(L)		((void)L)
+#define luai_userstateopen(L)		{ if (lua_userstateopen) lua_userstateopen(L); }
 #endif
 
 #if !defined(luai_userstateclose)
-#define luai_userstateclose(L)		((void)L)
+#define luai_userstateclose(L)		{ if (lua_userstateclose) lua_userstateclose(L); }
 #endif
 
 #if !defined(luai_userstatethread)
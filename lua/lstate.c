@@ -47,6 +47,10 @@
 #endif
 
 
+void (*lua_userstateopen) (lua_State *L) = NULL;
+void (*lua_userstateclose) (lua_State *L) = NULL;
+
+
 
 /*
 ** thread state + extra space
@@ -151,6 +151,13 @@ LUA_API lua_CFunction (lua_atpanic) (lua_State *L, lua_CFunction panicf);
 
 LUA_API const lua_Number *(lua_version) (lua_State *L);
 
+/*
+** called with every main state once it is built and before it is freed;
+** they let an embedder follow the states a library creates (ygopro)
+*/
+LUA_API void (*lua_userstateopen) (lua_State *L);
+LUA_API void (*lua_userstateclose) (lua_State *L);
+
 
 /*
 ** basic stack manipulation